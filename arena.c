@@ -0,0 +1,92 @@
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "arena.h"
+
+/* Function Definitions */
+
+/* First aligned byte after the block header */
+static unsigned char *block_data(ArenaBlock *block)
+{
+	return (unsigned char *)(((uintptr_t)(block + 1) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+}
+
+/* Block holding size bytes, with room to align them */
+static ArenaBlock *new_block(size_t size)
+{
+	ArenaBlock *block = malloc(sizeof(ArenaBlock) + ARENA_ALIGN + size);
+	if(block != NULL)
+	{
+		block -> next = NULL;
+		block -> size = size;
+		block -> used = 0;
+	}
+	return block;
+}
+
+/*
+Arena alloc
+* Input: Arena and a number of bytes
+*Output: Aligned memory valid until the next reset, NULL when out of memory
+*Description: A new block is at least twice the size of the current one.
+*/
+void *arena_alloc(Arena *arena, size_t n)
+{
+	if(n > SIZE_MAX / 2)
+		return NULL;
+	n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	ArenaBlock *block = arena -> head;
+	if(block == NULL || block -> size - block -> used < n)
+	{
+		size_t size = block ? 2 * block -> size : ARENA_MIN_BLOCK;
+		if(size < n)
+			size = n;
+		if((block = new_block(size)) == NULL)
+			return NULL;
+		block -> next = arena -> head;
+		arena -> head = block;
+		arena -> total += size;
+	}
+
+	void *memory = block_data(block) + block -> used;
+	block -> used += n;
+	return memory;
+}
+
+/*
+Arena reset
+* Input: Arena
+*Output: Empty arena with the same capacity, in one block
+*/
+void arena_reset(Arena *arena)
+{
+	if(arena -> head == NULL)
+		return;
+
+	if(arena -> head -> next != NULL)
+	{
+		size_t total = arena -> total;
+		arena_free(arena);
+		if((arena -> head = new_block(total)) != NULL)
+			arena -> total = total;
+		return;
+	}
+	arena -> head -> used = 0;
+}
+
+/*
+Arena free
+* Input: Arena
+*Output: Its blocks freed
+*/
+void arena_free(Arena *arena)
+{
+	while(arena -> head != NULL)
+	{
+		ArenaBlock *next = arena -> head -> next;
+		free(arena -> head);
+		arena -> head = next;
+	}
+	arena -> total = 0;
+}
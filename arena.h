@@ -0,0 +1,45 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Arena: bump allocator for the buffers of one job. Nothing
+ * is freed on its own; arena_reset releases everything at once
+ * and keeps the memory for the next job. A job that needs more
+ * than the arena holds chains further blocks, which the next
+ * reset merges into one block of their total size, so a stream
+ * of similar jobs runs out of a single block without calling
+ * malloc. An arena is not thread safe. A zeroed Arena is empty
+ * and ready to use.
+ */
+
+/* Alignment of every allocation, a cache line */
+#define ARENA_ALIGN 64
+
+/* Size of the first block */
+#define ARENA_MIN_BLOCK (64 * 1024)
+
+typedef struct _ArenaBlock
+{
+    struct _ArenaBlock *next;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+typedef struct _Arena
+{
+    ArenaBlock *head;       /* block allocations come from, older blocks follow */
+    size_t total;           /* bytes of all blocks */
+} Arena;
+
+/* Allocate n bytes aligned to ARENA_ALIGN, NULL when out of memory */
+void *arena_alloc(Arena *arena, size_t n);
+
+/* Release every allocation, keeping the memory */
+void arena_reset(Arena *arena);
+
+/* Free the memory of the arena, which is empty afterwards */
+void arena_free(Arena *arena);
+
+#endif
@@ -0,0 +1,682 @@
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "io_engine.h"
+#include "stats.h"
+#include "stego.h"
+#include "types.h"
+
+/*
+ * Work stealing scheduler: every worker owns a queue of job
+ * indices. It takes its own jobs from the head, in manifest
+ * order, and once its queue is empty steals from the tail of
+ * another worker's queue.
+ */
+typedef struct _JobQueue
+{
+    pthread_mutex_t lock;
+    size_t *jobs;
+    size_t head;
+    size_t tail;
+} JobQueue;
+
+typedef struct _BatchRun
+{
+    BatchJob *jobs;
+    size_t num_jobs;
+    JobQueue *queues;
+    int num_workers;
+} BatchRun;
+
+typedef struct _BatchWorker
+{
+    BatchRun *run;
+    int id;
+    pthread_t thread;
+} BatchWorker;
+
+/*
+ * Job of an asynchronous batch: its files are read whole by
+ * the I/O engine, a worker encodes or decodes them in memory
+ * and the engine writes the result back.
+ */
+typedef struct _AsyncJob
+{
+    BatchJob *job;
+    const char *output_fname;
+    int image_fd;           /* cover or stego image */
+    int secret_fd;          /* secret to embed, encodings only */
+    int output_fd;          /* stego image or decoded secret */
+    unsigned char *image;   /* cover (encoded in place) or stego image */
+    char *secret;           /* secret to embed or decoded secret */
+    size_t image_size;
+    size_t secret_size;
+    size_t buffered;        /* bytes read, counted against BATCH_ASYNC_BUFFERED */
+    IoRequest request[2];
+    int pending;            /* requests not finished */
+    int writing;            /* back from the worker */
+    int failed;
+    double start;
+    struct _AsyncJob *next;
+} AsyncJob;
+
+typedef struct _AsyncRun
+{
+    IoEngine engine;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    AsyncJob *ready_head;   /* read, waiting for a worker */
+    AsyncJob *ready_tail;
+    int stop;
+} AsyncRun;
+
+/* Function Definitions */
+
+/*
+Parse manifest line
+* Input: Job with its line set
+*Output: argv and type of the job, e_failure on malformed lines
+*Description: Builds the argv array read_and_validate_encode_args and
+read_and_validate_decode_args expect, the line is split in place.
+*/
+static Status parse_job(BatchJob *job)
+{
+	char *save;
+	char *op = strtok_r(job -> line, " \t\r\n", &save);
+	int argc = 2;
+
+	job -> argv[0] = "batch";
+	while(argc < BATCH_MAX_ARGS - 1 && (job -> argv[argc] = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+		argc++;
+	job -> argv[argc] = NULL;
+
+	if(strcmp(op, "e") == 0 || strcmp(op, "-e") == 0)
+	{
+		job -> type = e_encode;
+		job -> argv[1] = "-e";
+		return (argc == 4 || argc == 5) ? e_success : e_failure;
+	}
+	if(strcmp(op, "d") == 0 || strcmp(op, "-d") == 0)
+	{
+		job -> type = e_decode;
+		job -> argv[1] = "-d";
+		return (argc == 3 || argc == 4) ? e_success : e_failure;
+	}
+
+	job -> type = e_unsupported;
+	return e_failure;
+}
+
+/*
+Read manifest
+* Input: Manifest file name
+*Output: Array of jobs and their count, NULL on errors
+*/
+static BatchJob *read_manifest(const char *manifest_fname, size_t *num_jobs)
+{
+	FILE *fptr = fopen(manifest_fname, "r");
+	if(fptr == NULL)
+	{
+		perror("fopen");
+		fprintf(stderr, "ERROR: Unable to open file %s\n", manifest_fname);
+		return NULL;
+	}
+
+	BatchJob *jobs = NULL;
+	size_t count = 0, capacity = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+
+	while(getline(&line, &line_size, fptr) != -1)
+	{
+		char *text = line + strspn(line, " \t\r\n");
+		if(*text == '\0' || *text == '#')
+			continue;
+
+		if(count == capacity)
+		{
+			capacity = capacity ? 2 * capacity : 64;
+			BatchJob *grown = realloc(jobs, capacity * sizeof(BatchJob));
+			if(grown == NULL)
+				break;
+			jobs = grown;
+		}
+
+		BatchJob *job = &jobs[count++];
+		memset(job, 0, sizeof(*job));
+		job -> line = strdup(text);
+		job -> status = (job -> line != NULL) ? parse_job(job) : e_failure;
+		if(job -> status != e_success)
+			job -> type = e_unsupported;
+	}
+
+	free(line);
+	fclose(fptr);
+
+	if(count == 0)
+		fprintf(stderr, "ERROR: No jobs in %s\n", manifest_fname);
+	*num_jobs = count;
+	return jobs;
+}
+
+/*
+Run job
+* Input: Job and the worker's reusable encode and decode contexts
+*Output: Job status and duration
+*/
+static void run_job(BatchJob *job, EncodeInfo *encInfo, DecodeInfo *decInfo)
+{
+	double start = stats_now();
+
+	encInfo -> stats = decInfo -> stats = job -> stats;
+	if(job -> type == e_encode)
+	{
+		if(job -> stats != NULL)
+			stats_init(job -> stats, "encode");
+		job -> status = (read_and_validate_encode_args(job -> argv, encInfo) == e_success &&
+		                 do_encoding(encInfo) == e_success) ? e_success : e_failure;
+		close_files(encInfo);
+	}
+	else if(job -> type == e_decode)
+	{
+		if(job -> stats != NULL)
+			stats_init(job -> stats, "decode");
+		job -> status = (read_and_validate_decode_args(job -> argv, decInfo) == d_success &&
+		                 do_decoding(decInfo) == d_success) ? e_success : e_failure;
+		close_files_for_decoding(decInfo);
+	}
+
+	job -> seconds = stats_now() - start;
+}
+
+/*
+Take job
+* Input: Run state and worker id
+*Output: Index of the next job for this worker, 0 when no job is left
+*/
+static int take_job(BatchRun *run, int id, size_t *index)
+{
+	for(int k = 0; k < run -> num_workers; k++)
+	{
+		JobQueue *queue = &run -> queues[(id + k) % run -> num_workers];
+		int found = 0;
+
+		pthread_mutex_lock(&queue -> lock);
+		if(queue -> head < queue -> tail)
+		{
+			//Own queue: next job in order, other queues: steal the last one
+			*index = (k == 0) ? queue -> jobs[queue -> head++] : queue -> jobs[--queue -> tail];
+			found = 1;
+		}
+		pthread_mutex_unlock(&queue -> lock);
+
+		if(found)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+Batch worker
+*Description: One EncodeInfo and one DecodeInfo per worker, reused
+(with their buffers) for every job the worker runs.
+*/
+static void *batch_worker(void *arg)
+{
+	BatchWorker *worker = arg;
+	EncodeInfo encInfo = { 0 };
+	DecodeInfo decInfo = { 0 };
+	size_t index;
+
+	encInfo.num_threads = decInfo.num_threads = 1;
+	encInfo.quiet = decInfo.quiet = 1;
+
+	while(take_job(worker -> run, worker -> id, &index))
+		run_job(&worker -> run -> jobs[index], &encInfo, &decInfo);
+
+	release_encode_info(&encInfo);
+	release_decode_info(&decInfo);
+	return NULL;
+}
+
+/* Open a file of a job, with the messages of the synchronous path */
+static int open_job_file(const char *fname, int flags)
+{
+	int fd = open(fname, flags, 0666);
+	if(fd < 0)
+	{
+		perror("open");
+		fprintf(stderr, "ERROR: Unable to open file %s\n", fname);
+	}
+	return fd;
+}
+
+/* Read a whole file of a job into a new buffer */
+static Status read_job_file(AsyncRun *run, AsyncJob *async, int fd, IoRequest *request, void **buffer, size_t *size)
+{
+	struct stat st;
+
+	if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (*buffer = malloc(st.st_size ? st.st_size : 1)) == NULL)
+		return e_failure;
+
+	*size = st.st_size;
+	request -> fd = fd;
+	request -> write = 0;
+	request -> buffer = *buffer;
+	request -> size = st.st_size;
+	request -> offset = 0;
+	request -> arg = async;
+	async -> pending++;
+	io_engine_submit(&run -> engine, request);
+	return e_success;
+}
+
+/*
+Start async job
+* Input: Run state, a free AsyncJob and the job
+*Output: Reads of the job's files submitted, e_failure when a file
+cannot be opened or read
+*Description: The arguments pass the checks of the synchronous path,
+which also gives the default output names.
+*/
+static Status start_async_job(AsyncRun *run, AsyncJob *async, BatchJob *job)
+{
+	EncodeInfo encInfo = { 0 };
+	DecodeInfo decInfo = { 0 };
+
+	memset(async, 0, sizeof(*async));
+	async -> job = job;
+	async -> image_fd = async -> secret_fd = async -> output_fd = -1;
+	async -> start = stats_now();
+	if(job -> stats != NULL)
+	{
+		stats_init(job -> stats, (job -> type == e_encode) ? "encode" : "decode");
+		stats_stage_begin(job -> stats, "read_files");
+	}
+
+	if(job -> type == e_encode)
+	{
+		if(read_and_validate_encode_args(job -> argv, &encInfo) != e_success ||
+		   (async -> image_fd = open_job_file(encInfo.src_image_fname, O_RDONLY)) < 0 ||
+		   (async -> secret_fd = open_job_file(encInfo.secret_fname, O_RDONLY)) < 0)
+			return e_failure;
+		async -> output_fname = encInfo.stego_image_fname;
+	}
+	else
+	{
+		if(read_and_validate_decode_args(job -> argv, &decInfo) != d_success ||
+		   (async -> image_fd = open_job_file(decInfo.d_stego_image_fname, O_RDONLY)) < 0)
+			return e_failure;
+		async -> output_fname = decInfo.decoded_fname;
+	}
+
+	if((async -> output_fd = open_job_file(async -> output_fname, O_WRONLY | O_CREAT | O_TRUNC)) < 0 ||
+	   read_job_file(run, async, async -> image_fd, &async -> request[0], (void **)&async -> image, &async -> image_size) != e_success ||
+	   (async -> secret_fd >= 0 &&
+	    read_job_file(run, async, async -> secret_fd, &async -> request[1], (void **)&async -> secret, &async -> secret_size) != e_success))
+	{
+		fprintf(stderr, "ERROR: Unable to read the files of %s\n", job -> argv[2]);
+		return e_failure;
+	}
+	return e_success;
+}
+
+/*
+Finish async job
+* Input: AsyncJob with nothing outstanding
+*Output: Job status and duration, files closed and buffers freed
+*/
+static void finish_async_job(AsyncJob *async)
+{
+	BatchJob *job = async -> job;
+
+	job -> status = async -> failed ? e_failure : e_success;
+	job -> seconds = stats_now() - async -> start;
+	stats_stage_end(job -> stats, job -> status);
+
+	if(async -> image_fd >= 0)
+		close(async -> image_fd);
+	if(async -> secret_fd >= 0)
+		close(async -> secret_fd);
+	if(async -> output_fd >= 0 && close(async -> output_fd) != 0)
+		job -> status = e_failure;
+	free(async -> image);
+	free(async -> secret);
+}
+
+/*
+Run async job
+* Input: Run state, the worker's context and a job whose files are read
+*Output: Write of the stego image or decoded secret submitted
+*Description: Covers are encoded in place. Failed jobs go back to the
+I/O thread with a no-op request.
+*/
+static void run_async_job(AsyncRun *run, StegoContext *ctx, AsyncJob *async)
+{
+	BatchJob *job = async -> job;
+	IoRequest *request = &async -> request[0];
+
+	ctx -> stats = job -> stats;
+	if(job -> type == e_encode)
+	{
+		async -> failed = stego_encode(ctx, async -> image, async -> image_size, async -> secret, async -> secret_size,
+		                               async -> image) != e_success;
+		request -> buffer = async -> image;
+		request -> size = async -> image_size;
+	}
+	else
+	{
+		async -> failed = stego_decode_alloc(ctx, async -> image, async -> image_size, &async -> secret,
+		                                     &async -> secret_size) != d_success;
+		request -> buffer = (unsigned char *)async -> secret;
+		request -> size = async -> secret_size;
+	}
+
+	if(async -> failed)
+		request -> size = 0;
+	request -> fd = async -> output_fd;
+	request -> write = 1;
+	request -> offset = 0;
+	async -> writing = 1;
+	async -> pending = 1;
+
+	stats_stage_begin(job -> stats, "write_file");
+	io_engine_submit(&run -> engine, request);
+	io_engine_flush(&run -> engine);
+}
+
+/*
+Async worker
+*Description: Takes the jobs whose files are read, with one StegoContext
+reused for every job.
+*/
+static void *async_worker(void *arg)
+{
+	AsyncRun *run = arg;
+	StegoContext ctx;
+
+	stego_context_init(&ctx);
+	pthread_mutex_lock(&run -> lock);
+	for(;;)
+	{
+		while(run -> ready_head == NULL && !run -> stop)
+			pthread_cond_wait(&run -> cond, &run -> lock);
+		if(run -> ready_head == NULL)
+			break;
+
+		AsyncJob *async = run -> ready_head;
+		if((run -> ready_head = async -> next) == NULL)
+			run -> ready_tail = NULL;
+		pthread_mutex_unlock(&run -> lock);
+
+		run_async_job(run, &ctx, async);
+		pthread_mutex_lock(&run -> lock);
+	}
+	pthread_mutex_unlock(&run -> lock);
+	stego_context_free(&ctx);
+	return NULL;
+}
+
+/* Hand a job whose files are read to the workers */
+static void push_ready(AsyncRun *run, AsyncJob *async)
+{
+	async -> next = NULL;
+	pthread_mutex_lock(&run -> lock);
+	if(run -> ready_tail != NULL)
+		run -> ready_tail -> next = async;
+	else
+		run -> ready_head = async;
+	run -> ready_tail = async;
+	pthread_cond_signal(&run -> cond);
+	pthread_mutex_unlock(&run -> lock);
+}
+
+/*
+Run async
+* Input: Jobs, their count, number of workers and the I/O backend
+*Output: Job statuses and durations, e_failure when the engine cannot start
+*Description: The calling thread does the I/O: it keeps up to
+BATCH_ASYNC_JOBS jobs (and BATCH_ASYNC_BUFFERED bytes) in flight, hands
+the jobs whose reads completed to the workers and finishes the jobs
+whose writes completed.
+*/
+static Status run_async(BatchJob *jobs, size_t num_jobs, int num_workers, IoBackend backend)
+{
+	AsyncRun run = { 0 };
+	AsyncJob *slots = calloc(BATCH_ASYNC_JOBS, sizeof(AsyncJob));
+	pthread_t *workers = calloc(num_workers, sizeof(pthread_t));
+
+	if(slots == NULL || workers == NULL || io_engine_init(&run.engine, backend, 2 * BATCH_ASYNC_JOBS) != e_success)
+	{
+		for(size_t i = 0; i < num_jobs; i++)
+			jobs[i].status = e_failure;
+		free(slots);
+		free(workers);
+		return e_failure;
+	}
+	printf("Batch I/O: %s\n", io_engine_name(&run.engine));
+
+	pthread_mutex_init(&run.lock, NULL);
+	pthread_cond_init(&run.cond, NULL);
+	int started = 0;
+	for(; started < num_workers; started++)
+	{
+		if(pthread_create(&workers[started], NULL, async_worker, &run) != 0)
+			break;
+	}
+
+	//Free slots are chained through next
+	AsyncJob *free_slots = NULL;
+	for(int i = BATCH_ASYNC_JOBS - 1; i >= 0; i--)
+	{
+		slots[i].next = free_slots;
+		free_slots = &slots[i];
+	}
+
+	size_t next = 0, active = 0, buffered = 0;
+	while(started > 0)
+	{
+		while(next < num_jobs && free_slots != NULL && (active == 0 || buffered < BATCH_ASYNC_BUFFERED))
+		{
+			BatchJob *job = &jobs[next++];
+			if(job -> type == e_unsupported)
+				continue;
+
+			AsyncJob *async = free_slots;
+			free_slots = async -> next;
+			if(start_async_job(&run, async, job) != e_success)
+			{
+				//Reads already submitted must complete before the buffers go
+				async -> failed = 1;
+				if(async -> pending == 0)
+				{
+					finish_async_job(async);
+					async -> next = free_slots;
+					free_slots = async;
+					continue;
+				}
+			}
+			async -> buffered = async -> image_size + async -> secret_size;
+			buffered += async -> buffered;
+			active++;
+		}
+		if(active == 0)
+			break;
+
+		IoRequest *request = io_engine_wait(&run.engine);
+		AsyncJob *async = request -> arg;
+		if(request -> error)
+		{
+			fprintf(stderr, "ERROR: Unable to %s %s: %s\n", request -> write ? "write" : "read",
+			        request -> write ? async -> output_fname : async -> job -> argv[(request == &async -> request[1]) ? 3 : 2],
+			        strerror(request -> error));
+			async -> failed = 1;
+		}
+		if(--async -> pending > 0)
+			continue;
+
+		if(!async -> writing && !async -> failed)
+		{
+			stats_stage_end(async -> job -> stats, e_success);
+			push_ready(&run, async);
+			continue;
+		}
+
+		buffered -= async -> buffered;
+		finish_async_job(async);
+		async -> next = free_slots;
+		free_slots = async;
+		active--;
+	}
+
+	pthread_mutex_lock(&run.lock);
+	run.stop = 1;
+	pthread_cond_broadcast(&run.cond);
+	pthread_mutex_unlock(&run.lock);
+	for(int w = 0; w < started; w++)
+		pthread_join(workers[w], NULL);
+
+	//Jobs left behind when no worker could start
+	for(; next < num_jobs; next++)
+		jobs[next].status = e_failure;
+
+	io_engine_free(&run.engine);
+	pthread_mutex_destroy(&run.lock);
+	pthread_cond_destroy(&run.cond);
+	free(slots);
+	free(workers);
+	return (started > 0) ? e_success : e_failure;
+}
+
+/*
+Print report
+* Input: Jobs, their count and the total run time
+*Output: One status line per job and a summary, e_failure if any job failed
+*/
+static Status print_report(BatchJob *jobs, size_t num_jobs, double seconds)
+{
+	size_t failed = 0;
+
+	for(size_t i = 0; i < num_jobs; i++)
+	{
+		BatchJob *job = &jobs[i];
+		const char *op = (job -> type == e_encode) ? "encode" : (job -> type == e_decode) ? "decode" : "invalid";
+
+		printf("%6zu  %-7s %-40s %-6s %9.3f ms\n", i + 1, op, job -> argv[2] ? job -> argv[2] : "-",
+		       job -> status == e_success ? "ok" : "FAILED", job -> seconds * 1e3);
+		failed += (job -> status != e_success);
+	}
+
+	for(size_t i = 0; i < num_jobs; i++)
+	{
+		if(jobs[i].stats != NULL && jobs[i].type != e_unsupported)
+			stats_print_json(jobs[i].stats, stdout);
+	}
+
+	printf("Batch: %zu jobs, %zu failed, %.3f s, %.1f jobs/s\n", num_jobs, failed, seconds,
+	       seconds > 0 ? num_jobs / seconds : 0.0);
+	return failed ? e_failure : e_success;
+}
+
+/*
+Do batch
+* Input: Manifest file name, number of worker threads, whether to print statistics
+and the I/O backend
+*Output: e_success if every job succeeded
+*Description: Reads the manifest, spreads the jobs round robin over the
+worker queues, runs the workers and prints the per job report. With an
+I/O engine the jobs go through run_async instead, in manifest order.
+*/
+Status do_batch(const char *manifest_fname, int num_threads, int print_stats, IoBackend backend)
+{
+	size_t num_jobs = 0;
+	BatchJob *jobs = read_manifest(manifest_fname, &num_jobs);
+	if(jobs == NULL || num_jobs == 0)
+	{
+		free(jobs);
+		return e_failure;
+	}
+
+	BatchRun run = { jobs, num_jobs, NULL, num_threads < 1 ? 1 : num_threads };
+	if((size_t)run.num_workers > num_jobs)
+		run.num_workers = num_jobs;
+	run.queues = calloc(run.num_workers, sizeof(JobQueue));
+	BatchWorker *workers = calloc(run.num_workers, sizeof(BatchWorker));
+	//Room for num_workers slices of ceil(num_jobs / num_workers) indices
+	size_t *indices = malloc((num_jobs + run.num_workers) * sizeof(size_t));
+	RunStats *stats = print_stats ? calloc(num_jobs, sizeof(RunStats)) : NULL;
+	if(run.queues == NULL || workers == NULL || indices == NULL || (print_stats && stats == NULL))
+	{
+		fprintf(stderr, "ERROR: Memory allocation failed\n");
+		free(run.queues);
+		free(workers);
+		free(indices);
+		free(stats);
+		return e_failure;
+	}
+	if(stats != NULL)
+	{
+		for(size_t i = 0; i < num_jobs; i++)
+			jobs[i].stats = &stats[i];
+	}
+
+	//Round robin distribution, each queue uses a slice of indices
+	size_t slice = (num_jobs + run.num_workers - 1) / run.num_workers;
+	for(int w = 0; w < run.num_workers; w++)
+	{
+		pthread_mutex_init(&run.queues[w].lock, NULL);
+		run.queues[w].jobs = indices + w * slice;
+	}
+	for(size_t i = 0; i < num_jobs; i++)
+	{
+		if(jobs[i].type == e_unsupported)
+			continue;
+		JobQueue *queue = &run.queues[i % run.num_workers];
+		queue -> jobs[queue -> tail++] = i;
+	}
+
+	double start = stats_now();
+	if(backend != io_backend_sync)
+		run_async(jobs, num_jobs, run.num_workers, backend);
+	else
+	{
+		int started = 1;
+		for(int w = 0; w < run.num_workers; w++)
+		{
+			workers[w].run = &run;
+			workers[w].id = w;
+		}
+		for(; started < run.num_workers; started++)
+		{
+			if(pthread_create(&workers[started].thread, NULL, batch_worker, &workers[started]) != 0)
+				break;
+		}
+		batch_worker(&workers[0]);
+		for(int w = 1; w < started; w++)
+			pthread_join(workers[w].thread, NULL);
+	}
+	double seconds = stats_now() - start;
+
+	Status status = print_report(jobs, num_jobs, seconds);
+
+	for(int w = 0; w < run.num_workers; w++)
+		pthread_mutex_destroy(&run.queues[w].lock);
+	for(size_t i = 0; i < num_jobs; i++)
+		free(jobs[i].line);
+	free(run.queues);
+	free(workers);
+	free(indices);
+	free(stats);
+	free(jobs);
+	return status;
+}
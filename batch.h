@@ -0,0 +1,44 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "types.h" // Contains user defined types
+#include "io_engine.h"
+#include "stats.h"
+
+/*
+ * Batch mode: runs every job of a manifest in one process.
+ * Manifest lines are
+ *     e <cover.bmp> <secret.txt> [stego.bmp]
+ *     d <stego.bmp> [decoded.txt]
+ * Empty lines and lines starting with '#' are skipped.
+ * Jobs must be independent of each other: with several
+ * workers they run in no particular order.
+ * With an I/O engine (--aio) the files of up to
+ * BATCH_ASYNC_JOBS jobs are read and written asynchronously
+ * while the workers encode and decode in memory (stego.h).
+ */
+
+/* Longest argv built for a job: name, operation, 3 files, NULL */
+#define BATCH_MAX_ARGS 6
+
+/* Jobs of an asynchronous batch in flight at once */
+#define BATCH_ASYNC_JOBS 64
+
+/* Bytes they may hold in memory, a larger job still runs alone */
+#define BATCH_ASYNC_BUFFERED (512L * 1024 * 1024)
+
+/* One job of the manifest */
+typedef struct _BatchJob
+{
+    OperationType type;
+    char *line;
+    char *argv[BATCH_MAX_ARGS];
+    Status status;
+    double seconds;
+    RunStats *stats;
+} BatchJob;
+
+/* Run every job of the manifest on num_threads workers, print_stats adds a JSON line per job */
+Status do_batch(const char *manifest_fname, int num_threads, int print_stats, IoBackend backend);
+
+#endif
@@ -0,0 +1,451 @@
+
+/*
+ * Benchmarks for the LSB kernels, the CRC32C and ChaCha20 implementations and for
+ * end to end encoding/decoding.
+ *
+ * Build from the repository root:
+ *     gcc -O2 -I. bench/bench_stego.c $(ls *.c | grep -v test_encode.c) -o bench_stego -pthread
+ *
+ * Usage:
+ *     ./bench_stego [-s sizes_in_MB] [-j threads] [-d tmpdir] [-o results.jsonl] [-k]
+ *
+ * -s  comma separated cover sizes in MB (default 1,16,256)
+ * -k  kernels (and CRC32C, ChaCha20) only, skip the end to end runs
+ * -o  append one JSON object per result to the file
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "encode.h"
+#include "decode.h"
+#include "lsb.h"
+#include "crc32c.h"
+#include "chacha20.h"
+#include "types.h"
+
+/* Image bytes used by the kernel benchmarks */
+#define KERNEL_IMAGE_SIZE (64u << 20)
+
+/* Kernel benchmarks run until this much time has passed */
+#define KERNEL_MIN_SECONDS 0.5
+
+/* Results file given with -o, NULL when not requested */
+static FILE *fptr_results;
+
+/* Monotonic clock in seconds */
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Fill a buffer with pseudo random bytes (xorshift64) */
+static void fill_random(char *buffer, size_t n, uint64_t *state)
+{
+	for(size_t i = 0; i < n; i += 8)
+	{
+		*state ^= *state << 13;
+		*state ^= *state >> 7;
+		*state ^= *state << 17;
+		memcpy(buffer + i, state, (n - i < 8) ? n - i : 8);
+	}
+}
+
+/*
+Report
+* Input: Benchmark name, variant, payload bytes, image bytes, seconds and peak RSS
+*Output: One table row on stdout and one JSON line in the results file
+*/
+static void report(const char *bench, const char *variant, double payload_bytes, double image_bytes,
+                   double seconds, long peak_rss_kb)
+{
+	double mb_per_s = image_bytes / seconds / 1e6;
+	double ns_per_byte = seconds * 1e9 / payload_bytes;
+
+	printf("%-14s %-10s %12.0f %12.0f %10.1f MB/s %8.3f ns/B %8ld KB\n", bench, variant,
+	       payload_bytes, image_bytes, mb_per_s, ns_per_byte, peak_rss_kb);
+
+	if(fptr_results != NULL)
+	{
+		fprintf(fptr_results, "{\"bench\":\"%s\",\"variant\":\"%s\",\"payload_bytes\":%.0f,\"image_bytes\":%.0f,"
+		        "\"seconds\":%.6f,\"mb_per_s\":%.3f,\"ns_per_byte\":%.4f,\"peak_rss_kb\":%ld}\n",
+		        bench, variant, payload_bytes, image_bytes, seconds, mb_per_s, ns_per_byte, peak_rss_kb);
+		fflush(fptr_results);
+	}
+}
+
+/* Peak RSS of this process in KB */
+static long self_peak_rss(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/*
+Kernel benchmarks
+*Description: Times the single byte reference functions, every bulk
+kernel the CPU supports, the kernels of the deeper depths and every
+CRC32C implementation on the same in-memory image buffer.
+*/
+static void bench_kernels(void)
+{
+	static const char *kernels[] = { "scalar", "sse2", "bmi2", "avx2" };
+	size_t payload_size = KERNEL_IMAGE_SIZE / 8;
+	char *image = malloc(KERNEL_IMAGE_SIZE);
+	char *payload = malloc(payload_size * LSB_MAX_DEPTH);
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+	if(image == NULL || payload == NULL)
+	{
+		fprintf(stderr, "ERROR: Memory allocation failed\n");
+		free(image);
+		free(payload);
+		return;
+	}
+	fill_random(image, KERNEL_IMAGE_SIZE, &state);
+	fill_random(payload, payload_size * LSB_MAX_DEPTH, &state);
+
+	//Single byte functions used by the original per byte loops
+	double start = now_seconds(), seconds;
+	int rounds = 0;
+	do
+	{
+		for(size_t i = 0; i < payload_size; i++)
+			encode_byte_to_lsb(payload[i], image + 8 * i);
+		rounds++;
+	} while((seconds = now_seconds() - start) < KERNEL_MIN_SECONDS);
+	report("encode_byte", "reference", (double)rounds * payload_size, (double)rounds * KERNEL_IMAGE_SIZE, seconds, self_peak_rss());
+
+	start = now_seconds();
+	rounds = 0;
+	do
+	{
+		for(size_t i = 0; i < payload_size; i++)
+			payload[i] = decode_byte_from_lsb(0, image + 8 * i);
+		rounds++;
+	} while((seconds = now_seconds() - start) < KERNEL_MIN_SECONDS);
+	report("decode_byte", "reference", (double)rounds * payload_size, (double)rounds * KERNEL_IMAGE_SIZE, seconds, self_peak_rss());
+
+	//Bulk kernels
+	for(size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+	{
+		if(lsb_select_kernel(kernels[k]) != 0)
+			continue;
+
+		start = now_seconds();
+		rounds = 0;
+		do
+		{
+			encode_bytes_to_lsb(payload, payload_size, image);
+			rounds++;
+		} while((seconds = now_seconds() - start) < KERNEL_MIN_SECONDS);
+		report("encode_bytes", kernels[k], (double)rounds * payload_size, (double)rounds * KERNEL_IMAGE_SIZE, seconds, self_peak_rss());
+
+		start = now_seconds();
+		rounds = 0;
+		do
+		{
+			decode_bytes_from_lsb(image, payload_size, payload);
+			rounds++;
+		} while((seconds = now_seconds() - start) < KERNEL_MIN_SECONDS);
+		report("decode_bytes", kernels[k], (double)rounds * payload_size, (double)rounds * KERNEL_IMAGE_SIZE, seconds, self_peak_rss());
+	}
+
+	lsb_select_kernel(NULL);
+
+	//Deeper depths fill the same image with depth times the payload
+	for(int depth = 2; depth <= LSB_MAX_DEPTH; depth++)
+	{
+		char variant[16];
+		size_t depth_payload = LSB_ROUND_CHUNK(payload_size * depth, depth);
+		snprintf(variant, sizeof(variant), "depth%d", depth);
+
+		start = now_seconds();
+		rounds = 0;
+		do
+		{
+			encode_bytes_to_lsb_depth(payload, depth_payload, image, depth);
+			rounds++;
+		} while((seconds = now_seconds() - start) < KERNEL_MIN_SECONDS);
+		report("encode_bytes", variant, (double)rounds * depth_payload, (double)rounds * KERNEL_IMAGE_SIZE, seconds, self_peak_rss());
+
+		start = now_seconds();
+		rounds = 0;
+		do
+		{
+			decode_bytes_from_lsb_depth(image, depth_payload, payload, depth);
+			rounds++;
+		} while((seconds = now_seconds() - start) < KERNEL_MIN_SECONDS);
+		report("decode_bytes", variant, (double)rounds * depth_payload, (double)rounds * KERNEL_IMAGE_SIZE, seconds, self_peak_rss());
+	}
+
+	//CRC32C of the whole buffer, the decoder checks every payload with it
+	static const char *crc_impls[] = { "slice8", "sse42" };
+	for(size_t k = 0; k < sizeof(crc_impls) / sizeof(crc_impls[0]); k++)
+	{
+		volatile uint32_t crc = 0;
+
+		if(crc32c_select(crc_impls[k]) != 0)
+			continue;
+
+		start = now_seconds();
+		rounds = 0;
+		do
+		{
+			crc = crc32c(crc, image, KERNEL_IMAGE_SIZE);
+			rounds++;
+		} while((seconds = now_seconds() - start) < KERNEL_MIN_SECONDS);
+		report("crc32c", crc_impls[k], (double)rounds * KERNEL_IMAGE_SIZE, (double)rounds * KERNEL_IMAGE_SIZE, seconds, self_peak_rss());
+	}
+
+	crc32c_select(NULL);
+
+	//ChaCha20 keystream XORed over the whole buffer, as encrypted payloads are
+	static const char *cipher_impls[] = { "scalar", "sse2", "avx2" };
+	static const unsigned char salt[CHACHA20_SALT_SIZE];
+	ChaCha20Key key;
+	chacha20_key_from_passphrase(&key, "bench", salt);
+	for(size_t k = 0; k < sizeof(cipher_impls) / sizeof(cipher_impls[0]); k++)
+	{
+		if(chacha20_select(cipher_impls[k]) != 0)
+			continue;
+
+		start = now_seconds();
+		rounds = 0;
+		do
+		{
+			chacha20_payload_xor(&key, 0, image, image, KERNEL_IMAGE_SIZE);
+			rounds++;
+		} while((seconds = now_seconds() - start) < KERNEL_MIN_SECONDS);
+		report("chacha20", cipher_impls[k], (double)rounds * KERNEL_IMAGE_SIZE, (double)rounds * KERNEL_IMAGE_SIZE, seconds, self_peak_rss());
+	}
+
+	chacha20_select(NULL);
+
+	free(image);
+	free(payload);
+}
+
+/*
+Write synthetic BMP
+* Input: File name and approximate size in bytes
+*Output: 24 bit BMP of width 4096 with random pixels, e_failure on I/O errors
+*/
+static Status write_synthetic_bmp(const char *fname, size_t size)
+{
+	unsigned int width = 4096;
+	unsigned int height = (size > 54 + width * 3) ? (size - 54) / (width * 3) : 1;
+	unsigned int image_size = width * height * 3;
+	unsigned char header[54] = { 'B', 'M' };
+	uint32_t fields[] = { 54 + image_size, 0, 54, 40, width, height };
+	uint16_t planes_bits[] = { 1, 24 };
+	uint64_t state = 0x2545F4914F6CDD1DULL;
+
+	memcpy(header + 2, fields, sizeof(fields));
+	memcpy(header + 26, planes_bits, sizeof(planes_bits));
+	memcpy(header + 34, &image_size, 4);
+
+	FILE *fptr = fopen(fname, "wb");
+	if(fptr == NULL)
+		return e_failure;
+
+	char *buffer = malloc(1 << 20);
+	int ok = (buffer != NULL) && fwrite(header, 1, 54, fptr) == 54;
+	for(size_t left = image_size; ok && left > 0; )
+	{
+		size_t n = left < (1 << 20) ? left : (1 << 20);
+		fill_random(buffer, n, &state);
+		ok = fwrite(buffer, 1, n, fptr) == n;
+		left -= n;
+	}
+
+	free(buffer);
+	return (fclose(fptr) == 0 && ok) ? e_success : e_failure;
+}
+
+/*
+Write secret
+* Input: File name and size in bytes
+*Output: File of random bytes, e_failure on I/O errors
+*/
+static Status write_secret(const char *fname, size_t size)
+{
+	FILE *fptr = fopen(fname, "wb");
+	uint64_t state = 0xD1B54A32D192ED03ULL;
+	if(fptr == NULL)
+		return e_failure;
+
+	char *buffer = malloc(1 << 20);
+	int ok = (buffer != NULL);
+	for(size_t left = size; ok && left > 0; )
+	{
+		size_t n = left < (1 << 20) ? left : (1 << 20);
+		fill_random(buffer, n, &state);
+		ok = fwrite(buffer, 1, n, fptr) == n;
+		left -= n;
+	}
+
+	free(buffer);
+	return (fclose(fptr) == 0 && ok) ? e_success : e_failure;
+}
+
+/*
+Run in child
+* Input: Encode or decode arguments and thread count
+*Output: Seconds taken by do_encoding/do_decoding and the child's peak RSS
+*Description: Each run happens in a fresh process so the peak RSS
+belongs to that run only.
+*/
+static double run_in_child(char *argv[], int num_threads, long *peak_rss_kb)
+{
+	int pipe_fd[2];
+	double seconds = -1;
+
+	if(pipe(pipe_fd) != 0)
+		return -1;
+
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		Status status;
+		double start = now_seconds();
+
+		close(pipe_fd[0]);
+		if(strcmp(argv[1], "-e") == 0)
+		{
+			EncodeInfo encInfo = { 0 };
+			encInfo.num_threads = num_threads;
+			encInfo.quiet = 1;
+			status = (read_and_validate_encode_args(argv, &encInfo) == e_success) ? do_encoding(&encInfo) : e_failure;
+			close_files(&encInfo);
+		}
+		else
+		{
+			DecodeInfo decInfo = { 0 };
+			decInfo.num_threads = num_threads;
+			decInfo.quiet = 1;
+			status = (read_and_validate_decode_args(argv, &decInfo) == d_success && do_decoding(&decInfo) == d_success) ? e_success : e_failure;
+			close_files_for_decoding(&decInfo);
+		}
+
+		seconds = (status == e_success) ? now_seconds() - start : -1;
+		write(pipe_fd[1], &seconds, sizeof(seconds));
+		_exit(0);
+	}
+
+	close(pipe_fd[1]);
+	if(pid > 0)
+	{
+		struct rusage usage;
+		if(read(pipe_fd[0], &seconds, sizeof(seconds)) != sizeof(seconds))
+			seconds = -1;
+		wait4(pid, NULL, 0, &usage);
+		*peak_rss_kb = usage.ru_maxrss;
+	}
+	close(pipe_fd[0]);
+	return seconds;
+}
+
+/*
+End to end benchmarks
+* Input: Cover size in MB, thread count and scratch directory
+*Description: Creates a synthetic cover and a secret filling about 90% of
+its capacity, then times do_encoding and do_decoding on them.
+*/
+static void bench_end_to_end(size_t size_mb, int num_threads, const char *dir)
+{
+	char cover[4096], secret[4096], stego[4096], decoded[4096], variant[32];
+	size_t cover_size = size_mb << 20;
+	size_t secret_size = (cover_size - 54) / 8 * 9 / 10 - 64;
+	long peak_rss_kb = 0;
+
+	snprintf(cover, sizeof(cover), "%s/bench_cover_%zu.bmp", dir, size_mb);
+	snprintf(secret, sizeof(secret), "%s/bench_secret_%zu.txt", dir, size_mb);
+	snprintf(stego, sizeof(stego), "%s/bench_stego_%zu.bmp", dir, size_mb);
+	snprintf(decoded, sizeof(decoded), "%s/bench_decoded_%zu.txt", dir, size_mb);
+	snprintf(variant, sizeof(variant), "%zuMB/j%d", size_mb, num_threads);
+
+	if(write_synthetic_bmp(cover, cover_size) != e_success || write_secret(secret, secret_size) != e_success)
+	{
+		fprintf(stderr, "ERROR: Unable to create the benchmark files in %s\n", dir);
+		return;
+	}
+
+	char *encode_argv[] = { "bench", "-e", cover, secret, stego, NULL };
+	double seconds = run_in_child(encode_argv, num_threads, &peak_rss_kb);
+	if(seconds > 0)
+		report("do_encoding", variant, secret_size, cover_size, seconds, peak_rss_kb);
+	else
+		fprintf(stderr, "ERROR: Encoding %s failed\n", cover);
+
+	char *decode_argv[] = { "bench", "-d", stego, decoded, NULL };
+	seconds = run_in_child(decode_argv, num_threads, &peak_rss_kb);
+	if(seconds > 0)
+		report("do_decoding", variant, secret_size, 8.0 * secret_size, seconds, peak_rss_kb);
+	else
+		fprintf(stderr, "ERROR: Decoding %s failed\n", stego);
+
+	unlink(cover);
+	unlink(secret);
+	unlink(stego);
+	unlink(decoded);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *sizes = "1,16,256";
+	const char *dir = "/tmp";
+	int num_threads = 1, kernels_only = 0;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			sizes = argv[++i];
+		else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			num_threads = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			dir = argv[++i];
+		else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+		{
+			if((fptr_results = fopen(argv[++i], "a")) == NULL)
+			{
+				perror("fopen");
+				return 1;
+			}
+		}
+		else if(strcmp(argv[i], "-k") == 0)
+			kernels_only = 1;
+		else
+		{
+			printf("Usage: %s [-s sizes_in_MB] [-j threads] [-d tmpdir] [-o results.jsonl] [-k]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	printf("%-14s %-10s %12s %12s %15s %13s %11s\n", "bench", "variant", "payload B", "image B", "throughput", "per payload B", "peak RSS");
+	bench_kernels();
+
+	if(!kernels_only)
+	{
+		char *list = strdup(sizes), *save;
+		for(char *size = strtok_r(list, ",", &save); size != NULL; size = strtok_r(NULL, ",", &save))
+		{
+			if(atol(size) > 0)
+				bench_end_to_end(atol(size), num_threads, dir);
+		}
+		free(list);
+	}
+
+	if(fptr_results != NULL)
+		fclose(fptr_results);
+	return 0;
+}
@@ -0,0 +1,312 @@
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bmp.h"
+#include "stats.h"
+#include "types.h"
+
+/* Compression values of the DIB header */
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+
+/* Function Definitions */
+
+static uint32_t get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get_le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+/*
+Parse BMP header
+* Input: First bytes of the file (up to BMP_MAX_HEADER_SIZE) and their count
+*Output: BmpInfo, e_failure for anything but uncompressed 24 and 32 bit images
+*Description: Accepts BITMAPINFOHEADER up to BITMAPV5HEADER. 32 bit images
+with BI_BITFIELDS must use the usual BGRA masks, so the fourth byte of a
+pixel is the alpha (or unused) channel.
+*/
+Status bmp_parse_header(const unsigned char *header, size_t size, BmpInfo *info)
+{
+	if(size < BMP_FILE_HEADER_SIZE + 40 || header[0] != 'B' || header[1] != 'M')
+		return e_failure;
+
+	memset(info, 0, sizeof(*info));
+	info -> data_offset = get_le32(header + 10);
+	info -> header_size = get_le32(header + 14);
+	int32_t width = get_le32(header + 18);
+	int32_t height = get_le32(header + 22);
+	info -> bit_count = get_le16(header + 28);
+	info -> compression = get_le32(header + 30);
+
+	if(info -> header_size < 40 || info -> header_size > 124 || get_le16(header + 26) != 1)
+		return e_failure;
+	if(width <= 0 || height == 0 || height == INT32_MIN)
+		return e_failure;
+	if(info -> bit_count != 24 && info -> bit_count != 32)
+		return e_failure;
+
+	size_t headers_end = BMP_FILE_HEADER_SIZE + info -> header_size;
+	if(info -> compression == BI_BITFIELDS && info -> bit_count == 32)
+	{
+		//Masks follow a 40 byte header, or are part of the larger ones
+		if(info -> header_size == 40)
+			headers_end += 12;
+		if(size < BMP_FILE_HEADER_SIZE + 52 ||
+		   get_le32(header + 54) != 0x00FF0000 || get_le32(header + 58) != 0x0000FF00 || get_le32(header + 62) != 0x000000FF)
+			return e_failure;
+	}
+	else if(info -> compression != BI_RGB)
+		return e_failure;
+
+	if(info -> data_offset < headers_end)
+		return e_failure;
+
+	info -> width = width;
+	info -> height = (height < 0) ? -height : height;
+	info -> top_down = (height < 0);
+	info -> pixel_bytes = info -> bit_count / 8;
+	info -> row_stride = ((size_t)info -> width * info -> bit_count + 31) / 32 * 4;
+	info -> row_carriers = (size_t)info -> width * 3;
+	return e_success;
+}
+
+/*
+Read DIB headers
+* Input: Stream positioned at the start of the file, buffer of BMP_MAX_HEADER_SIZE bytes
+*Output: Number of header bytes read into the buffer and parsed, 0 for unsupported images
+*/
+static size_t read_dib_headers(FILE *fptr, unsigned char *header, BmpInfo *info)
+{
+	//The DIB header size tells how much more to read
+	if(fread(header, 1, BMP_FILE_HEADER_SIZE + 4, fptr) != BMP_FILE_HEADER_SIZE + 4)
+		return 0;
+
+	size_t size = BMP_FILE_HEADER_SIZE + get_le32(header + BMP_FILE_HEADER_SIZE);
+	uint data_offset = get_le32(header + 10);
+	if(size < BMP_FILE_HEADER_SIZE + 40 || size > BMP_MAX_HEADER_SIZE)
+		return 0;
+
+	//BI_BITFIELDS masks after a 40 byte header are read as well when present
+	if(size < BMP_FILE_HEADER_SIZE + 52 && data_offset >= BMP_FILE_HEADER_SIZE + 52)
+		size = BMP_FILE_HEADER_SIZE + 52;
+
+	if(fread(header + BMP_FILE_HEADER_SIZE + 4, 1, size - BMP_FILE_HEADER_SIZE - 4, fptr) != size - BMP_FILE_HEADER_SIZE - 4)
+		return 0;
+	stats_count_io(io_read, size);
+
+	return (bmp_parse_header(header, size, info) == e_success) ? size : 0;
+}
+
+/*
+Read BMP header
+* Input: Stream positioned at the start of the file
+*Output: BmpInfo, stream positioned at the pixel array
+*Description: Only reads forward, so the stream may be a pipe.
+*/
+Status bmp_read_header(FILE *fptr, BmpInfo *info)
+{
+	unsigned char header[BMP_MAX_HEADER_SIZE];
+
+	size_t size = read_dib_headers(fptr, header, info);
+	if(size == 0)
+		return e_failure;
+
+	//Skip the rest of the headers (color table, gaps)
+	for(size_t left = info -> data_offset - size; left > 0; )
+	{
+		size_t n = (left < sizeof(header)) ? left : sizeof(header);
+		if(fread(header, 1, n, fptr) != n)
+			return e_failure;
+		stats_count_io(io_read, n);
+		left -= n;
+	}
+
+	return e_success;
+}
+
+/*
+Read BMP header bytes
+* Input: Stream positioned at the start of the file
+*Output: BmpInfo and a malloc'd copy of the data_offset bytes in front of
+the pixel array, stream positioned at the pixel array
+*Description: Like bmp_read_header, for streams that cannot be read a
+second time (pipes) but whose headers are copied elsewhere.
+*/
+Status bmp_read_header_bytes(FILE *fptr, BmpInfo *info, unsigned char **bytes)
+{
+	unsigned char header[BMP_MAX_HEADER_SIZE];
+
+	*bytes = NULL;
+	size_t size = read_dib_headers(fptr, header, info);
+	if(size == 0 || (*bytes = malloc(info -> data_offset)) == NULL)
+		return e_failure;
+	memcpy(*bytes, header, size);
+
+	//The rest of the headers (color table, gaps)
+	size_t left = info -> data_offset - size;
+	if(fread(*bytes + size, 1, left, fptr) != left)
+	{
+		free(*bytes);
+		*bytes = NULL;
+		return e_failure;
+	}
+	stats_count_io(io_read, left);
+
+	return e_success;
+}
+
+/* Carriers per row times rows, padding and alpha bytes excluded */
+size_t bmp_capacity(const BmpInfo *info)
+{
+	return info -> row_carriers * info -> height;
+}
+
+/* File offset of carrier c */
+static inline size_t carrier_offset(const BmpInfo *info, size_t c)
+{
+	size_t row = c / info -> row_carriers;
+	size_t col = c % info -> row_carriers;
+
+	if(info -> pixel_bytes == 4)
+		col = col / 3 * 4 + col % 3;
+	return info -> data_offset + row * info -> row_stride + col;
+}
+
+/*
+Carrier end
+* Input: BmpInfo and a number of carriers
+*Output: File offset just past the last of them
+*Description: Gaps (padding, alpha) are attributed to the carrier that
+follows them, so consecutive ranges of carriers give adjacent spans.
+*/
+size_t bmp_carrier_end(const BmpInfo *info, size_t carriers)
+{
+	return carriers ? carrier_offset(info, carriers - 1) + 1 : info -> data_offset;
+}
+
+/*
+Carriers before
+* Input: BmpInfo and a file offset in the pixel array
+*Output: Number of carriers stored before the offset
+*/
+size_t bmp_carriers_before(const BmpInfo *info, size_t offset)
+{
+	if(offset <= info -> data_offset)
+		return 0;
+
+	size_t relative = offset - info -> data_offset;
+	size_t row = relative / info -> row_stride;
+	size_t col = relative % info -> row_stride;
+
+	if(info -> pixel_bytes == 4)
+		col = col / 4 * 3 + (col % 4 < 3 ? col % 4 : 3);
+	if(col > info -> row_carriers)
+		col = info -> row_carriers;
+	return row * info -> row_carriers + col;
+}
+
+/* n carriers touch at most n / row_carriers + 2 rows */
+size_t bmp_span_limit(const BmpInfo *info, size_t n)
+{
+	return (n / info -> row_carriers + 2) * info -> row_stride;
+}
+
+/*
+Move pixels
+*Description: Moves count carriers of 32 bit pixels between a row, at
+channel 0, 1 or 2 of its first pixel, and the dense buffer. The direction
+is a compile time constant, so gather and scatter each get a straight
+line loop over whole pixels, 3 channels moved and the alpha byte skipped;
+only the partial pixels at both ends go a byte at a time.
+*/
+static inline __attribute__((always_inline)) void move_pixels(unsigned char *row, unsigned char *dense, size_t count, size_t channel, const int to_span)
+{
+	size_t i = 0;
+
+	//Rest of the pixel the run starts in
+	if(channel != 0)
+	{
+		for(; channel < 3 && i < count; i++, channel++, row++)
+		{
+			if(to_span)
+				*row = dense[i];
+			else
+				dense[i] = *row;
+		}
+		row++;
+	}
+
+	for(; i + 3 <= count; i += 3, row += 4)
+	{
+		if(to_span)
+		{
+			row[0] = dense[i];
+			row[1] = dense[i + 1];
+			row[2] = dense[i + 2];
+		}
+		else
+		{
+			dense[i] = row[0];
+			dense[i + 1] = row[1];
+			dense[i + 2] = row[2];
+		}
+	}
+
+	for(; i < count; i++, row++)
+	{
+		if(to_span)
+			*row = dense[i];
+		else
+			dense[i] = *row;
+	}
+}
+
+/*
+Move carriers
+*Description: Walks the rows covered by n carriers from first. Each row
+is one memcpy for 24 bit images; 32 bit pixels copy 3 of their 4 bytes.
+*/
+static inline __attribute__((always_inline)) void move_carriers(const BmpInfo *info, size_t first, size_t n, unsigned char *span, unsigned char *dense, const int to_span)
+{
+	size_t base = bmp_carrier_end(info, first);
+
+	while(n > 0)
+	{
+		size_t col = first % info -> row_carriers;
+		size_t count = info -> row_carriers - col;
+		if(count > n)
+			count = n;
+
+		unsigned char *row = span + (carrier_offset(info, first) - base);
+		if(info -> pixel_bytes == 3)
+		{
+			if(to_span)
+				memcpy(row, dense, count);
+			else
+				memcpy(dense, row, count);
+		}
+		else
+			move_pixels(row, dense, count, col % 3, to_span);
+
+		dense += count;
+		first += count;
+		n -= count;
+	}
+}
+
+/* Span to dense buffer */
+void bmp_gather(const BmpInfo *info, size_t first, size_t n, const unsigned char *span, unsigned char *dense)
+{
+	move_carriers(info, first, n, (unsigned char *)span, dense, 0);
+}
+
+/* Dense buffer to span, the gaps in between keep their bytes */
+void bmp_scatter(const BmpInfo *info, size_t first, size_t n, const unsigned char *dense, unsigned char *span)
+{
+	move_carriers(info, first, n, span, (unsigned char *)dense, 1);
+}
@@ -0,0 +1,64 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * BMP layout: which bytes of the file carry hidden bits.
+ * Carriers are the blue, green and red bytes of every pixel
+ * in file order (bottom-up or top-down alike); row padding
+ * and the alpha byte of 32 bit pixels are never modified.
+ * Carrier c lives at a fixed file offset, so any range of
+ * carriers maps to one span of the file.
+ */
+
+/* BITMAPFILEHEADER size */
+#define BMP_FILE_HEADER_SIZE 14
+
+/* BITMAPFILEHEADER followed by the largest DIB header (BITMAPV5HEADER) */
+#define BMP_MAX_HEADER_SIZE (BMP_FILE_HEADER_SIZE + 124)
+
+typedef struct _BmpInfo
+{
+    uint data_offset;       /* bfOffBits, start of the pixel array */
+    uint header_size;       /* DIB header size, 40 up to 124 (V5) */
+    uint width;
+    uint height;
+    int top_down;           /* negative height in the header */
+    uint bit_count;         /* 24 or 32 */
+    uint compression;       /* BI_RGB or BI_BITFIELDS */
+    uint pixel_bytes;       /* 3 or 4 */
+    size_t row_stride;      /* bytes per row, padding included */
+    size_t row_carriers;    /* carrier bytes per row, 3 * width */
+} BmpInfo;
+
+/* Parse the file and DIB headers, e_failure for unsupported images */
+Status bmp_parse_header(const unsigned char *header, size_t size, BmpInfo *info);
+
+/* Read and parse the headers from the start of a stream, then skip to the pixel array */
+Status bmp_read_header(FILE *fptr, BmpInfo *info);
+
+/* Same, keeping a malloc'd copy of the data_offset bytes in front of the pixel array */
+Status bmp_read_header_bytes(FILE *fptr, BmpInfo *info, unsigned char **bytes);
+
+/* Number of carrier bytes in the image */
+size_t bmp_capacity(const BmpInfo *info);
+
+/* File offset just past the first carriers carrier bytes (the pixel array start for 0) */
+size_t bmp_carrier_end(const BmpInfo *info, size_t carriers);
+
+/* Number of carrier bytes located before a file offset */
+size_t bmp_carriers_before(const BmpInfo *info, size_t offset);
+
+/* Largest file span of n consecutive carriers */
+size_t bmp_span_limit(const BmpInfo *info, size_t n);
+
+/* Copy n carriers from a file span starting at bmp_carrier_end(first) into a dense buffer */
+void bmp_gather(const BmpInfo *info, size_t first, size_t n, const unsigned char *span, unsigned char *dense);
+
+/* Store n carriers from a dense buffer back into their file span */
+void bmp_scatter(const BmpInfo *info, size_t first, size_t n, const unsigned char *dense, unsigned char *span);
+
+#endif
@@ -0,0 +1,355 @@
+#include <string.h>
+#include <sys/random.h>
+#include "chacha20.h"
+#include "sha256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHACHA20_X86 1
+#endif
+
+/* One entry per implementation, xor_blocks handles whole blocks */
+typedef struct _ChaCha20Impl
+{
+    const char *name;
+    void (*xor_blocks)(const uint32_t state[16], uint32_t counter, const unsigned char *in, unsigned char *out, size_t blocks);
+    int (*supported)(void);
+} ChaCha20Impl;
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d) do { \
+	a += b; d = ROTL32(d ^ a, 16); c += d; b = ROTL32(b ^ c, 12); \
+	a += b; d = ROTL32(d ^ a, 8);  c += d; b = ROTL32(b ^ c, 7); } while(0)
+
+/* Function Definitions */
+
+/* One keystream block */
+static void keystream_block(const uint32_t state[16], uint32_t counter, unsigned char out[CHACHA20_BLOCK_SIZE])
+{
+	uint32_t x[16];
+
+	memcpy(x, state, sizeof(x));
+	x[12] = counter;
+	for(int round = 0; round < 10; round++)
+	{
+		QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+		QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+		QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+		QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+		QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+		QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+		QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+		QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+	}
+
+	for(int i = 0; i < 16; i++)
+	{
+		uint32_t word = x[i] + ((i == 12) ? counter : state[i]);
+		out[4 * i] = word;
+		out[4 * i + 1] = word >> 8;
+		out[4 * i + 2] = word >> 16;
+		out[4 * i + 3] = word >> 24;
+	}
+}
+
+/*
+Scalar
+*Description: Reference implementation, one block at a time.
+*/
+static void xor_blocks_scalar(const uint32_t state[16], uint32_t counter, const unsigned char *in, unsigned char *out, size_t blocks)
+{
+	unsigned char keystream[CHACHA20_BLOCK_SIZE];
+
+	for(; blocks > 0; blocks--, counter++, in += CHACHA20_BLOCK_SIZE, out += CHACHA20_BLOCK_SIZE)
+	{
+		keystream_block(state, counter, keystream);
+		for(int i = 0; i < CHACHA20_BLOCK_SIZE; i++)
+			out[i] = in[i] ^ keystream[i];
+	}
+}
+
+static int always_supported(void)
+{
+	return 1;
+}
+
+#ifdef CHACHA20_X86
+
+#define ROTL_SSE2(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define QUARTER_SSE2(a, b, c, d) do { \
+	a = _mm_add_epi32(a, b); d = ROTL_SSE2(_mm_xor_si128(d, a), 16); \
+	c = _mm_add_epi32(c, d); b = ROTL_SSE2(_mm_xor_si128(b, c), 12); \
+	a = _mm_add_epi32(a, b); d = ROTL_SSE2(_mm_xor_si128(d, a), 8); \
+	c = _mm_add_epi32(c, d); b = ROTL_SSE2(_mm_xor_si128(b, c), 7); } while(0)
+
+/* XOR 16 bytes of keystream */
+__attribute__((target("sse2")))
+static inline void xor_store_sse2(const unsigned char *in, unsigned char *out, __m128i keystream)
+{
+	_mm_storeu_si128((__m128i *)out, _mm_xor_si128(_mm_loadu_si128((const __m128i *)in), keystream));
+}
+
+/*
+SSE2
+*Description: 4 blocks at a time, each vector holds one state word of the
+4 blocks. The words are transposed back to block order 4 at a time.
+*/
+__attribute__((target("sse2")))
+static void xor_blocks_sse2(const uint32_t state[16], uint32_t counter, const unsigned char *in, unsigned char *out, size_t blocks)
+{
+	for(; blocks >= 4; blocks -= 4, counter += 4, in += 4 * CHACHA20_BLOCK_SIZE, out += 4 * CHACHA20_BLOCK_SIZE)
+	{
+		__m128i s[16], x[16];
+
+		for(int i = 0; i < 16; i++)
+			s[i] = _mm_set1_epi32(state[i]);
+		s[12] = _mm_add_epi32(_mm_set1_epi32(counter), _mm_setr_epi32(0, 1, 2, 3));
+		memcpy(x, s, sizeof(x));
+
+		for(int round = 0; round < 10; round++)
+		{
+			QUARTER_SSE2(x[0], x[4], x[8], x[12]);
+			QUARTER_SSE2(x[1], x[5], x[9], x[13]);
+			QUARTER_SSE2(x[2], x[6], x[10], x[14]);
+			QUARTER_SSE2(x[3], x[7], x[11], x[15]);
+			QUARTER_SSE2(x[0], x[5], x[10], x[15]);
+			QUARTER_SSE2(x[1], x[6], x[11], x[12]);
+			QUARTER_SSE2(x[2], x[7], x[8], x[13]);
+			QUARTER_SSE2(x[3], x[4], x[9], x[14]);
+		}
+
+		for(int g = 0; g < 4; g++)
+		{
+			__m128i a = _mm_add_epi32(x[4 * g], s[4 * g]);
+			__m128i b = _mm_add_epi32(x[4 * g + 1], s[4 * g + 1]);
+			__m128i c = _mm_add_epi32(x[4 * g + 2], s[4 * g + 2]);
+			__m128i d = _mm_add_epi32(x[4 * g + 3], s[4 * g + 3]);
+			__m128i ab_low = _mm_unpacklo_epi32(a, b), ab_high = _mm_unpackhi_epi32(a, b);
+			__m128i cd_low = _mm_unpacklo_epi32(c, d), cd_high = _mm_unpackhi_epi32(c, d);
+
+			xor_store_sse2(in + 16 * g, out + 16 * g, _mm_unpacklo_epi64(ab_low, cd_low));
+			xor_store_sse2(in + 64 + 16 * g, out + 64 + 16 * g, _mm_unpackhi_epi64(ab_low, cd_low));
+			xor_store_sse2(in + 128 + 16 * g, out + 128 + 16 * g, _mm_unpacklo_epi64(ab_high, cd_high));
+			xor_store_sse2(in + 192 + 16 * g, out + 192 + 16 * g, _mm_unpackhi_epi64(ab_high, cd_high));
+		}
+	}
+
+	xor_blocks_scalar(state, counter, in, out, blocks);
+}
+
+static int sse2_supported(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+#define ROTL_AVX2(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+/* Rotations by whole bytes are byte shuffles */
+#define QUARTER_AVX2(a, b, c, d) do { \
+	a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16); \
+	c = _mm256_add_epi32(c, d); b = ROTL_AVX2(_mm256_xor_si256(b, c), 12); \
+	a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8); \
+	c = _mm256_add_epi32(c, d); b = ROTL_AVX2(_mm256_xor_si256(b, c), 7); } while(0)
+
+/*
+AVX2
+*Description: 8 blocks at a time like the SSE2 version. After the 4x4
+transposes, the low half of a vector belongs to block k and the high
+half to block k + 4.
+*/
+__attribute__((target("avx2")))
+static void xor_blocks_avx2(const uint32_t state[16], uint32_t counter, const unsigned char *in, unsigned char *out, size_t blocks)
+{
+	const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+	                                       2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+	                                      3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+
+	for(; blocks >= 8; blocks -= 8, counter += 8, in += 8 * CHACHA20_BLOCK_SIZE, out += 8 * CHACHA20_BLOCK_SIZE)
+	{
+		__m256i x[16];
+		__m256i counters = _mm256_add_epi32(_mm256_set1_epi32(counter), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+		//The input state is broadcast again at the end rather than kept in registers
+		for(int i = 0; i < 16; i++)
+			x[i] = _mm256_set1_epi32(state[i]);
+		x[12] = counters;
+
+		for(int round = 0; round < 10; round++)
+		{
+			QUARTER_AVX2(x[0], x[4], x[8], x[12]);
+			QUARTER_AVX2(x[1], x[5], x[9], x[13]);
+			QUARTER_AVX2(x[2], x[6], x[10], x[14]);
+			QUARTER_AVX2(x[3], x[7], x[11], x[15]);
+			QUARTER_AVX2(x[0], x[5], x[10], x[15]);
+			QUARTER_AVX2(x[1], x[6], x[11], x[12]);
+			QUARTER_AVX2(x[2], x[7], x[8], x[13]);
+			QUARTER_AVX2(x[3], x[4], x[9], x[14]);
+		}
+
+		for(int g = 0; g < 4; g++)
+		{
+			__m256i a = _mm256_add_epi32(x[4 * g], (g == 3) ? counters : _mm256_set1_epi32(state[4 * g]));
+			__m256i b = _mm256_add_epi32(x[4 * g + 1], _mm256_set1_epi32(state[4 * g + 1]));
+			__m256i c = _mm256_add_epi32(x[4 * g + 2], _mm256_set1_epi32(state[4 * g + 2]));
+			__m256i d = _mm256_add_epi32(x[4 * g + 3], _mm256_set1_epi32(state[4 * g + 3]));
+			__m256i ab_low = _mm256_unpacklo_epi32(a, b), ab_high = _mm256_unpackhi_epi32(a, b);
+			__m256i cd_low = _mm256_unpacklo_epi32(c, d), cd_high = _mm256_unpackhi_epi32(c, d);
+			__m256i rows[4] =
+			{
+				_mm256_unpacklo_epi64(ab_low, cd_low), _mm256_unpackhi_epi64(ab_low, cd_low),
+				_mm256_unpacklo_epi64(ab_high, cd_high), _mm256_unpackhi_epi64(ab_high, cd_high)
+			};
+
+			for(int k = 0; k < 4; k++)
+			{
+				size_t low = k * CHACHA20_BLOCK_SIZE + 16 * g, high = (k + 4) * CHACHA20_BLOCK_SIZE + 16 * g;
+				_mm_storeu_si128((__m128i *)(out + low), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + low)),
+				                 _mm256_castsi256_si128(rows[k])));
+				_mm_storeu_si128((__m128i *)(out + high), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + high)),
+				                 _mm256_extracti128_si256(rows[k], 1)));
+			}
+		}
+	}
+
+	xor_blocks_sse2(state, counter, in, out, blocks);
+}
+
+static int avx2_supported(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+/* Implementations in order of preference */
+static const ChaCha20Impl impls[] =
+{
+#ifdef CHACHA20_X86
+    { "avx2", xor_blocks_avx2, avx2_supported },
+    { "sse2", xor_blocks_sse2, sse2_supported },
+#endif
+    { "scalar", xor_blocks_scalar, always_supported },
+};
+
+static const ChaCha20Impl *active_impl = &impls[sizeof(impls) / sizeof(impls[0]) - 1];
+
+/*
+ChaCha20 XOR
+* Input: Key, keystream offset, data, output and size
+*Output: The data XORed with the keystream from offset on
+*Description: Partial blocks at either end are done one block at a time,
+the whole blocks in between by the selected implementation.
+*/
+void chacha20_xor(const ChaCha20Key *key, uint64_t offset, const void *in, void *out, size_t n)
+{
+	const unsigned char *src = in;
+	unsigned char *dst = out;
+	unsigned char keystream[CHACHA20_BLOCK_SIZE];
+	uint32_t counter = offset / CHACHA20_BLOCK_SIZE;
+	size_t skip = offset % CHACHA20_BLOCK_SIZE;
+
+	if(skip > 0 && n > 0)
+	{
+		size_t take = (n < CHACHA20_BLOCK_SIZE - skip) ? n : CHACHA20_BLOCK_SIZE - skip;
+		keystream_block(key -> state, counter++, keystream);
+		for(size_t i = 0; i < take; i++)
+			dst[i] = src[i] ^ keystream[skip + i];
+		src += take;
+		dst += take;
+		n -= take;
+	}
+
+	size_t blocks = n / CHACHA20_BLOCK_SIZE;
+	active_impl -> xor_blocks(key -> state, counter, src, dst, blocks);
+	counter += blocks;
+	src += blocks * CHACHA20_BLOCK_SIZE;
+	dst += blocks * CHACHA20_BLOCK_SIZE;
+	n -= blocks * CHACHA20_BLOCK_SIZE;
+
+	if(n > 0)
+	{
+		keystream_block(key -> state, counter, keystream);
+		for(size_t i = 0; i < n; i++)
+			dst[i] = src[i] ^ keystream[i];
+	}
+}
+
+void chacha20_payload_xor(const ChaCha20Key *key, size_t pos, const void *in, void *out, size_t n)
+{
+	chacha20_xor(key, CHACHA20_PAYLOAD_OFFSET + (uint64_t)pos, in, out, n);
+}
+
+/*
+Key from passphrase
+* Input: Key to set, passphrase and salt
+*Output: ChaCha20 state with the derived 256 bit key and a zero nonce
+*/
+void chacha20_key_from_passphrase(ChaCha20Key *key, const char *passphrase, const unsigned char salt[CHACHA20_SALT_SIZE])
+{
+	static const uint32_t sigma[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };   /* "expand 32-byte k" */
+	unsigned char derived[32];
+
+	pbkdf2_sha256(passphrase, strlen(passphrase), salt, CHACHA20_SALT_SIZE, CHACHA20_KDF_ITERATIONS, derived, sizeof(derived));
+
+	memset(key, 0, sizeof(*key));
+	memcpy(key -> state, sigma, sizeof(sigma));
+	for(int i = 0; i < 8; i++)
+		key -> state[4 + i] = derived[4 * i] | derived[4 * i + 1] << 8 | derived[4 * i + 2] << 16 | (uint32_t)derived[4 * i + 3] << 24;
+	memset(derived, 0, sizeof(derived));
+}
+
+/*
+New salt
+* Input: Salt buffer
+*Output: CHACHA20_SALT_SIZE random bytes from the kernel
+*/
+Status chacha20_new_salt(unsigned char salt[CHACHA20_SALT_SIZE])
+{
+	return (getrandom(salt, CHACHA20_SALT_SIZE, 0) == CHACHA20_SALT_SIZE) ? e_success : e_failure;
+}
+
+uint32_t chacha20_key_check(const ChaCha20Key *key)
+{
+	unsigned char keystream[CHACHA20_BLOCK_SIZE];
+
+	keystream_block(key -> state, 0, keystream);
+	return keystream[0] | keystream[1] << 8 | keystream[2] << 16 | (uint32_t)keystream[3] << 24;
+}
+
+/*
+Select implementation
+* Input: Implementation name, or NULL to pick the best one the CPU supports
+*Output: 0 on success, -1 if the implementation is unknown or not supported
+*/
+int chacha20_select(const char *name)
+{
+#ifdef CHACHA20_X86
+	__builtin_cpu_init();
+#endif
+	for(size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+	{
+		if(name != NULL && strcmp(name, impls[i].name) != 0)
+			continue;
+		if(!impls[i].supported())
+			continue;
+
+		active_impl = &impls[i];
+		return 0;
+	}
+	return -1;
+}
+
+const char *chacha20_name(void)
+{
+	return active_impl -> name;
+}
+
+/* Pick the implementation once before main runs */
+__attribute__((constructor))
+static void chacha20_init(void)
+{
+	chacha20_select(NULL);
+}
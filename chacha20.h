@@ -0,0 +1,60 @@
+#ifndef CHACHA20_H
+#define CHACHA20_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * ChaCha20 (RFC 8439) encryption of the secret data. The key is
+ * derived from a passphrase and a random salt stored in the stego
+ * header (PBKDF2-HMAC-SHA256, see sha256.h), so every image has a
+ * key of its own and the nonce is always zero. Keystream block 0
+ * gives a key check value stored next to the salt, which rejects
+ * a wrong passphrase before anything is decoded; payload byte i is
+ * XORed with keystream byte CHACHA20_PAYLOAD_OFFSET + i, so any
+ * piece of the payload is encrypted or decrypted on its own, as
+ * the stripes and tiles are. The keystream is generated 8 blocks
+ * at a time with AVX2, 4 with SSE2 or 1 with scalar code, picked
+ * once at runtime like the LSB kernels.
+ */
+
+#define CHACHA20_BLOCK_SIZE 64
+
+/* Bytes of salt in the stego header */
+#define CHACHA20_SALT_SIZE 16
+
+/* PBKDF2 iterations of the key derivation */
+#define CHACHA20_KDF_ITERATIONS 20000
+
+/* Keystream byte of payload byte 0, block 0 gives the key check value */
+#define CHACHA20_PAYLOAD_OFFSET CHACHA20_BLOCK_SIZE
+
+/* Initial state of the cipher, word 12 (the block counter) is set per block */
+typedef struct _ChaCha20Key
+{
+    uint32_t state[16];
+} ChaCha20Key;
+
+/* Key of a passphrase and a salt */
+void chacha20_key_from_passphrase(ChaCha20Key *key, const char *passphrase, const unsigned char salt[CHACHA20_SALT_SIZE]);
+
+/* Random salt for a new image, e_failure when no random bytes are available */
+Status chacha20_new_salt(unsigned char salt[CHACHA20_SALT_SIZE]);
+
+/* Key check value stored in the stego header */
+uint32_t chacha20_key_check(const ChaCha20Key *key);
+
+/* XOR n bytes with the keystream from byte offset, in and out may be the same buffer */
+void chacha20_xor(const ChaCha20Key *key, uint64_t offset, const void *in, void *out, size_t n);
+
+/* Encrypt or decrypt n payload bytes starting at payload byte pos */
+void chacha20_payload_xor(const ChaCha20Key *key, size_t pos, const void *in, void *out, size_t n);
+
+/* Force an implementation by name ("scalar", "sse2", "avx2"), NULL for auto */
+int chacha20_select(const char *name);
+
+/* Name of the implementation in use */
+const char *chacha20_name(void);
+
+#endif
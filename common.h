@@ -4,4 +4,51 @@
 /* Magic string to identify whether stegged or not */
 #define MAGIC_STRING "#*"
 
+/*
+ * The 32 bit extension size field also carries the encoding
+ * options and the header version, so stego images of older
+ * versions (all option bits zero) still decode:
+ *     bits 0-7   extension size
+ *     bits 8-9   LSB depth of the secret data - 1
+ *     bit 10     secret data is compressed (see lz.h)
+ *     bit 11     secret data is scattered with a key (see scatter.h)
+ *     bit 12     a CRC32C of the secret data (see crc32c.h) follows
+ *                the size field
+ *     bit 13     secret data is encrypted (see chacha20.h), a 16 byte
+ *                salt and a 32 bit key check value follow the size
+ *                field, in front of the CRC
+ *     bit 14     secret data is a container of files (see container.h),
+ *                the extension is empty and bit 10 means its files
+ *                are compressed one by one
+ *     bits 24-31 header version: 0 for a 32 bit size field, 1 for
+ *                a 64 bit one (high 32 bits first); images of a
+ *                newer version are rejected like unknown options
+ */
+#define HEADER_EXTN_SIZE_MASK 0xFF
+#define HEADER_DEPTH_SHIFT 8
+#define HEADER_DEPTH_MASK 0x3
+#define HEADER_COMPRESSED (1 << 10)
+#define HEADER_SCATTERED (1 << 11)
+#define HEADER_CRC (1 << 12)
+#define HEADER_ENCRYPTED (1 << 13)
+#define HEADER_CONTAINER (1 << 14)
+
+#define HEADER_VERSION_SHIFT 24
+
+/* Version of the headers this version writes */
+#define HEADER_VERSION 1
+
+/* Option bits of the field this version understands */
+#define HEADER_KNOWN_BITS 0x7FFF
+
+/* Field of a header this version decodes: known options and a version up to HEADER_VERSION */
+#define HEADER_SUPPORTED(field) \
+    (((field) & ~HEADER_KNOWN_BITS & ((1u << HEADER_VERSION_SHIFT) - 1)) == 0 && ((field) >> HEADER_VERSION_SHIFT) <= HEADER_VERSION)
+
+/* Carriers of the size field in a header of a version */
+#define HEADER_SIZE_CARRIERS(version) ((version) ? 64 : 32)
+
+/* Print a stage progress message unless the run is quiet */
+#define STAGE_MSG(info, ...) do { if (!(info)->quiet) printf(__VA_ARGS__); } while (0)
+
 #endif
@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <string.h>
+#include "container.h"
+#include "crc32c.h"
+#include "lz.h"
+#include "stats.h"
+
+/* Bytes copied per pass while packing */
+#define CONTAINER_COPY_SIZE (64 * 1024)
+
+/* Function Definitions */
+
+static void put_u32(unsigned char *bytes, uint32_t value)
+{
+	for(int i = 0; i < 4; i++)
+		bytes[i] = value >> (24 - 8 * i);
+}
+
+static void put_u64(unsigned char *bytes, uint64_t value)
+{
+	put_u32(bytes, value >> 32);
+	put_u32(bytes + 4, (uint32_t)value);
+}
+
+static uint32_t get_u32(const unsigned char *bytes)
+{
+	return (uint32_t)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+}
+
+static uint64_t get_u64(const unsigned char *bytes)
+{
+	return (uint64_t)get_u32(bytes) << 32 | get_u32(bytes + 4);
+}
+
+/*
+Valid name
+* Input: Name and its length
+*Output: 1 when the name is a plain file name, safe to create in the output directory
+*/
+static int valid_name(const char *name, size_t length)
+{
+	if(length == 0 || length > CONTAINER_MAX_NAME || memchr(name, '\0', length) != NULL ||
+	   memchr(name, '/', length) != NULL || memchr(name, '\\', length) != NULL)
+		return 0;
+	return !(length == 1 && name[0] == '.') && !(length == 2 && name[0] == '.' && name[1] == '.');
+}
+
+/*
+Copy bytes
+* Input: Source stream, number of bytes, destination stream (NULL to only read) and CRC
+*Output: n bytes copied from in to out and added to the CRC, e_failure on I/O errors
+*/
+static Status copy_bytes(FILE *in, uint64_t n, FILE *out, uint32_t *crc)
+{
+	char *buffer = malloc(CONTAINER_COPY_SIZE);
+	Status status = (buffer != NULL) ? e_success : e_failure;
+
+	while(status == e_success && n > 0)
+	{
+		size_t chunk = (n < CONTAINER_COPY_SIZE) ? n : CONTAINER_COPY_SIZE;
+		if(fread(buffer, 1, chunk, in) != chunk)
+		{
+			status = e_failure;
+			break;
+		}
+		stats_count_io(io_read, chunk);
+		*crc = crc32c(*crc, buffer, chunk);
+		if(out != NULL)
+		{
+			if(fwrite(buffer, 1, chunk, out) != chunk)
+				status = e_failure;
+			stats_count_io(io_write, chunk);
+		}
+		n -= chunk;
+	}
+
+	free(buffer);
+	return status;
+}
+
+/*
+Pack file
+* Input: File name, its entry (offset set), compress flag and the container stream
+*Output: The file's bytes at entry offset, the rest of the entry filled in
+*Description: Compressed files are read back from the container for their CRC,
+from the page cache in practice.
+*/
+static Status pack_file(const char *fname, ContainerEntry *entry, int compress, FILE *out)
+{
+	FILE *in = fopen(fname, "rb");
+	off_t stored;
+
+	if(in == NULL)
+	{
+		perror("fopen");
+		fprintf(stderr, "ERROR: Unable to open file %s\n", fname);
+		return e_failure;
+	}
+	fseeko(in, 0, SEEK_END);
+	entry -> size = ftello(in);
+	fseeko(in, 0, SEEK_SET);
+
+	Status status;
+	if(compress)
+	{
+		entry -> flags = CONTAINER_COMPRESSED;
+		status = lz_compress_file(in, entry -> size, out, &stored);
+		entry -> stored_size = stored;
+		if(status == e_success && (fflush(out) != 0 || fseeko(out, entry -> offset, SEEK_SET) != 0 ||
+		                           copy_bytes(out, entry -> stored_size, NULL, &entry -> crc) != e_success))
+			status = e_failure;
+	}
+	else
+	{
+		entry -> stored_size = entry -> size;
+		status = copy_bytes(in, entry -> size, out, &entry -> crc);
+	}
+
+	if(status != e_success)
+		fprintf(stderr, "ERROR: Failed to add %s to the container\n", fname);
+	fclose(in);
+	return status;
+}
+
+/*
+Pack container
+* Input: File names, their count, compress flag and an empty stream
+*Output: The container written to out and its size, e_failure on invalid names or I/O errors
+*Description: Every file is stored under its name without the directories,
+compressed on its own with -z so that it can be extracted on its own. The
+files are written first, from the end of the index on, and the index once
+their offsets and CRCs are known.
+*/
+Status container_pack(char *const files[], int count, int compress, FILE *out, off_t *size)
+{
+	uint32_t index_size = CONTAINER_HEADER_SIZE;
+	uint64_t pos;
+	Status status = e_success;
+
+	if(count < 1 || count > CONTAINER_MAX_FILES)
+	{
+		fprintf(stderr, "ERROR: A container holds 1 to %d files\n", CONTAINER_MAX_FILES);
+		return e_failure;
+	}
+
+	ContainerEntry *entries = calloc(count, sizeof(ContainerEntry));
+	if(entries == NULL)
+		return e_failure;
+
+	for(int i = 0; i < count && status == e_success; i++)
+	{
+		const char *name = strrchr(files[i], '/') ? strrchr(files[i], '/') + 1 : files[i];
+		if(!valid_name(name, strlen(name)))
+		{
+			fprintf(stderr, "ERROR: %s cannot be stored in a container\n", files[i]);
+			status = e_failure;
+		}
+		else if(container_find(entries, i, name) != NULL)
+		{
+			fprintf(stderr, "ERROR: More than one file is named %s\n", name);
+			status = e_failure;
+		}
+		else
+		{
+			strcpy(entries[i].name, name);
+			index_size += CONTAINER_ENTRY_SIZE + strlen(name);
+		}
+	}
+
+	pos = index_size;
+	for(int i = 0; i < count && status == e_success; i++)
+	{
+		//Zeros up to the next aligned offset
+		while(pos % CONTAINER_ALIGN != 0 && status == e_success)
+			status = (fseeko(out, pos++, SEEK_SET) == 0 && fputc(0, out) != EOF) ? e_success : e_failure;
+
+		entries[i].offset = pos;
+		if(status == e_success && fseeko(out, pos, SEEK_SET) != 0)
+			status = e_failure;
+		if(status == e_success)
+			status = pack_file(files[i], &entries[i], compress, out);
+		pos += entries[i].stored_size;
+	}
+
+	unsigned char *index = (status == e_success) ? malloc(index_size) : NULL;
+	if(index != NULL)
+	{
+		size_t at = CONTAINER_HEADER_SIZE;
+		for(int i = 0; i < count; i++)
+		{
+			size_t length = strlen(entries[i].name);
+			put_u64(index + at, entries[i].offset);
+			put_u64(index + at + 8, entries[i].stored_size);
+			put_u64(index + at + 16, entries[i].size);
+			put_u32(index + at + 24, entries[i].crc);
+			index[at + 28] = entries[i].flags;
+			index[at + 29] = length;
+			memcpy(index + at + CONTAINER_ENTRY_SIZE, entries[i].name, length);
+			at += CONTAINER_ENTRY_SIZE + length;
+		}
+		put_u32(index, count);
+		put_u32(index + 4, index_size);
+		put_u32(index + 8, crc32c(0, index + CONTAINER_HEADER_SIZE, index_size - CONTAINER_HEADER_SIZE));
+
+		if(fseek(out, 0, SEEK_SET) != 0 || fwrite(index, 1, index_size, out) != index_size || fflush(out) != 0)
+			status = e_failure;
+		stats_count_io(io_write, index_size);
+	}
+	else
+		status = e_failure;
+
+	*size = pos;
+	free(index);
+	free(entries);
+	return status;
+}
+
+/*
+Parse container header
+* Input: First CONTAINER_HEADER_SIZE bytes of the payload
+*Output: Number of files and size of the index, e_failure when they cannot be right
+*/
+Status container_parse_header(const unsigned char *header, uint32_t *count, uint32_t *index_size)
+{
+	*count = get_u32(header);
+	*index_size = get_u32(header + 4);
+
+	if(*count < 1 || *count > CONTAINER_MAX_FILES ||
+	   *index_size < CONTAINER_HEADER_SIZE + *count * CONTAINER_ENTRY_SIZE ||
+	   *index_size > CONTAINER_HEADER_SIZE + *count * (CONTAINER_ENTRY_SIZE + CONTAINER_MAX_NAME))
+		return e_failure;
+	return e_success;
+}
+
+/*
+Parse container index
+* Input: Index, its size, payload size, entries to fill and their count
+*Output: The entries, e_failure when the CRC does not match or an entry is out of bounds
+*/
+Status container_parse_index(const unsigned char *index, uint32_t index_size, uint64_t payload_size,
+                             ContainerEntry *entries, uint32_t count)
+{
+	size_t at = CONTAINER_HEADER_SIZE;
+
+	if(crc32c(0, index + CONTAINER_HEADER_SIZE, index_size - CONTAINER_HEADER_SIZE) != get_u32(index + 8))
+		return e_failure;
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		if(at + CONTAINER_ENTRY_SIZE > index_size)
+			return e_failure;
+
+		ContainerEntry *entry = &entries[i];
+		size_t length = index[at + 29];
+		entry -> offset = get_u64(index + at);
+		entry -> stored_size = get_u64(index + at + 8);
+		entry -> size = get_u64(index + at + 16);
+		entry -> crc = get_u32(index + at + 24);
+		entry -> flags = index[at + 28];
+		if(at + CONTAINER_ENTRY_SIZE + length > index_size || !valid_name((const char *)index + at + CONTAINER_ENTRY_SIZE, length) ||
+		   entry -> offset < index_size || entry -> offset > payload_size || entry -> stored_size > payload_size - entry -> offset)
+			return e_failure;
+		memcpy(entry -> name, index + at + CONTAINER_ENTRY_SIZE, length);
+		entry -> name[length] = '\0';
+		at += CONTAINER_ENTRY_SIZE + length;
+	}
+	return (at == index_size) ? e_success : e_failure;
+}
+
+/*
+Find entry
+* Input: Entries, their count and a name
+*Output: First entry of that name, NULL when there is none
+*/
+const ContainerEntry *container_find(const ContainerEntry *entries, uint32_t count, const char *name)
+{
+	for(uint32_t i = 0; i < count; i++)
+	{
+		if(strcmp(entries[i].name, name) == 0)
+			return &entries[i];
+	}
+	return NULL;
+}
@@ -0,0 +1,73 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Container of several files of any type, the payload of images
+ * encoded with -c or -a (option bit 14 of the header). The
+ * payload starts with an index, all fields big endian like the
+ * header:
+ *     32 bit  number of files
+ *     32 bit  size of the index in bytes, these fields included
+ *     32 bit  CRC32C of the entries
+ *     one entry per file:
+ *         64 bit  payload offset of the file's bytes
+ *         64 bit  bytes stored
+ *         64 bit  size of the file, the stored bytes are an LZ
+ *                 stream (see lz.h) when the file is compressed
+ *         32 bit  CRC32C of the stored bytes
+ *         8 bit   flags
+ *         8 bit   length of the name, then the name
+ * The files follow in index order, each one starting at a whole
+ * depth group of every depth (see LSB_GROUP_BYTES). The carriers
+ * of a file follow from its offset, so one file is extracted
+ * without decoding the others.
+ */
+
+/* Bytes in front of the entries */
+#define CONTAINER_HEADER_SIZE 12
+
+/* Bytes of an entry besides its name */
+#define CONTAINER_ENTRY_SIZE 30
+
+/* Longest name, names are the file names without their directories */
+#define CONTAINER_MAX_NAME 255
+
+/* Most files in a container */
+#define CONTAINER_MAX_FILES 4096
+
+/* Files start at multiples of this many payload bytes */
+#define CONTAINER_ALIGN 3
+
+/* Entry flag of a file stored as an LZ stream */
+#define CONTAINER_COMPRESSED 0x01
+
+typedef struct _ContainerEntry
+{
+    uint64_t offset;        /* payload offset of the stored bytes */
+    uint64_t stored_size;
+    uint64_t size;          /* size of the file */
+    uint32_t crc;           /* CRC32C of the stored bytes */
+    unsigned flags;
+    char name[CONTAINER_MAX_NAME + 1];
+} ContainerEntry;
+
+/* Write the container of count files to out, compressing each one when compress is set */
+Status container_pack(char *const files[], int count, int compress, FILE *out, off_t *size);
+
+/* Number of files and index size from the first CONTAINER_HEADER_SIZE payload bytes */
+Status container_parse_header(const unsigned char *header, uint32_t *count, uint32_t *index_size);
+
+/* Entries of an index of index_size bytes in a payload of payload_size bytes, e_failure when it is corrupt */
+Status container_parse_index(const unsigned char *index, uint32_t index_size, uint64_t payload_size,
+                             ContainerEntry *entries, uint32_t count);
+
+/* Entry of a name, NULL when there is none */
+const ContainerEntry *container_find(const ContainerEntry *entries, uint32_t count, const char *name);
+
+#endif
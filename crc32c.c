@@ -0,0 +1,264 @@
+#include <stdint.h>
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32C_X86 1
+#endif
+
+/* Castagnoli polynomial, bit reversed */
+#define CRC32C_POLY 0x82F63B78
+
+/* One entry per implementation */
+typedef struct _Crc32cImpl
+{
+    const char *name;
+    uint32_t (*update)(uint32_t crc, const unsigned char *data, size_t n);
+    int (*supported)(void);
+} Crc32cImpl;
+
+/* Slicing-by-8 tables, table[k][b] is the CRC of byte b followed by k zero bytes */
+static uint32_t table[8][256];
+
+/* x^(2^k) modulo the polynomial, for crc32c_combine */
+static uint32_t x2n_table[32];
+
+/* Bytes per stream of the 3-way SSE4.2 loop */
+#define CRC32C_STREAM 4096
+
+/* shift_table[s][k][b] moves byte k of a CRC register past (s + 1) * CRC32C_STREAM zero bytes */
+static uint32_t shift_table[2][4][256];
+
+/* Function Definitions */
+
+/*
+Slicing-by-8
+*Description: Portable implementation, 8 table lookups for every 8 bytes.
+Works on the inverted CRC.
+*/
+static uint32_t update_slice8(uint32_t crc, const unsigned char *data, size_t n)
+{
+	for(; n > 0 && ((uintptr_t)data & 7) != 0; n--)
+		crc = table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+
+	for(; n >= 8; n -= 8, data += 8)
+	{
+		uint32_t low = (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24) ^ crc;
+		uint32_t high = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+		crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+		      table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+	}
+
+	while(n-- > 0)
+		crc = table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static int always_supported(void)
+{
+	return 1;
+}
+
+/* CRC register moved past the zero bytes of a shift table */
+static inline uint32_t shift_crc(const uint32_t shift[4][256], uint32_t crc)
+{
+	return shift[0][crc & 0xFF] ^ shift[1][(crc >> 8) & 0xFF] ^ shift[2][(crc >> 16) & 0xFF] ^ shift[3][crc >> 24];
+}
+
+#ifdef CRC32C_X86
+
+/*
+SSE4.2
+*Description: The crc32 instruction, 8 bytes at a time. It has a latency
+of 3 cycles but one completes per cycle, so large buffers are run as three
+independent streams of CRC32C_STREAM bytes whose CRCs are then joined with
+the shift tables; the loop then keeps up with memory.
+*/
+__attribute__((target("sse4.2")))
+static uint32_t update_sse42(uint32_t crc, const unsigned char *data, size_t n)
+{
+	for(; n > 0 && ((uintptr_t)data & 7) != 0; n--)
+		crc = _mm_crc32_u8(crc, *data++);
+
+#ifdef __x86_64__
+	for(; n >= 3 * CRC32C_STREAM; n -= 3 * CRC32C_STREAM, data += 3 * CRC32C_STREAM)
+	{
+		uint64_t crc_a = crc, crc_b = 0, crc_c = 0;
+		for(size_t i = 0; i < CRC32C_STREAM; i += 8)
+		{
+			uint64_t word_a, word_b, word_c;
+			memcpy(&word_a, data + i, 8);
+			memcpy(&word_b, data + CRC32C_STREAM + i, 8);
+			memcpy(&word_c, data + 2 * CRC32C_STREAM + i, 8);
+			crc_a = _mm_crc32_u64(crc_a, word_a);
+			crc_b = _mm_crc32_u64(crc_b, word_b);
+			crc_c = _mm_crc32_u64(crc_c, word_c);
+		}
+		crc = shift_crc(shift_table[1], crc_a) ^ shift_crc(shift_table[0], crc_b) ^ crc_c;
+	}
+
+	uint64_t crc64 = crc;
+	for(; n >= 8; n -= 8, data += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = (uint32_t)crc64;
+#endif
+
+	for(; n >= 4; n -= 4, data += 4)
+	{
+		uint32_t word;
+		memcpy(&word, data, 4);
+		crc = _mm_crc32_u32(crc, word);
+	}
+
+	while(n-- > 0)
+		crc = _mm_crc32_u8(crc, *data++);
+	return crc;
+}
+
+static int sse42_supported(void)
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+
+#endif
+
+/* Implementations in order of preference */
+static const Crc32cImpl impls[] =
+{
+#ifdef CRC32C_X86
+    { "sse42", update_sse42, sse42_supported },
+#endif
+    { "slice8", update_slice8, always_supported },
+};
+
+static const Crc32cImpl *active_impl = &impls[sizeof(impls) / sizeof(impls[0]) - 1];
+
+/*
+CRC32C
+* Input: CRC of the data so far (0 to start), data and its size
+*Output: CRC of the data so far followed by the n bytes
+*/
+uint32_t crc32c(uint32_t crc, const void *data, size_t n)
+{
+	return ~active_impl -> update(~crc, data, n);
+}
+
+/* a * b modulo the polynomial, both bit reversed */
+static uint32_t multiply_mod(uint32_t a, uint32_t b)
+{
+	uint32_t product = 0;
+
+	for(uint32_t m = 1u << 31; m != 0; m >>= 1)
+	{
+		if(a & m)
+			product ^= b;
+		b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return product;
+}
+
+/* x^(8 * n) modulo the polynomial, from the squares in x2n_table */
+static uint32_t zeros_power(size_t n)
+{
+	uint32_t power = 1u << 31;      /* x^0 */
+
+	for(unsigned k = 3; n != 0; n >>= 1, k++)
+	{
+		if(n & 1)
+			power = multiply_mod(x2n_table[k & 31], power);
+	}
+	return power;
+}
+
+/*
+CRC32C combine
+* Input: CRCs of two consecutive pieces and the size of the second one
+*Output: CRC of both pieces
+*Description: Appending size2 bytes multiplies the first CRC by x^(8 * size2),
+as zlib's crc32_combine does.
+*/
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t size2)
+{
+	return multiply_mod(zeros_power(size2), crc1) ^ crc2;
+}
+
+/*
+CRC32C join
+* Input: CRCs and sizes of consecutive pieces, and their count
+*Output: CRC of the pieces one after the other
+*/
+uint32_t crc32c_join(const Crc32cPiece *pieces, size_t count)
+{
+	uint32_t crc = 0;
+
+	for(size_t i = 0; i < count; i++)
+		crc = crc32c_combine(crc, pieces[i].crc, pieces[i].size);
+	return crc;
+}
+
+/*
+Select implementation
+* Input: Implementation name, or NULL to pick the best one the CPU supports
+*Output: 0 on success, -1 if the implementation is unknown or not supported
+*/
+int crc32c_select(const char *name)
+{
+#ifdef CRC32C_X86
+	__builtin_cpu_init();
+#endif
+	for(size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+	{
+		if(name != NULL && strcmp(name, impls[i].name) != 0)
+			continue;
+		if(!impls[i].supported())
+			continue;
+
+		active_impl = &impls[i];
+		return 0;
+	}
+	return -1;
+}
+
+const char *crc32c_name(void)
+{
+	return active_impl -> name;
+}
+
+/* Build the tables and pick the implementation once before main runs */
+__attribute__((constructor))
+static void crc32c_init(void)
+{
+	for(int b = 0; b < 256; b++)
+	{
+		uint32_t crc = b;
+		for(int i = 0; i < 8; i++)
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		table[0][b] = crc;
+	}
+	for(int b = 0; b < 256; b++)
+	{
+		for(int k = 1; k < 8; k++)
+			table[k][b] = table[0][table[k - 1][b] & 0xFF] ^ (table[k - 1][b] >> 8);
+	}
+
+	x2n_table[0] = 1u << 30;        /* x^1 */
+	for(int k = 1; k < 32; k++)
+		x2n_table[k] = multiply_mod(x2n_table[k - 1], x2n_table[k - 1]);
+
+	for(int s = 0; s < 2; s++)
+	{
+		uint32_t power = zeros_power((s + 1) * CRC32C_STREAM);
+		for(int k = 0; k < 4; k++)
+		{
+			for(uint32_t b = 0; b < 256; b++)
+				shift_table[s][k][b] = multiply_mod(power, b << (8 * k));
+		}
+	}
+
+	crc32c_select(NULL);
+}
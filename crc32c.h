@@ -0,0 +1,39 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli polynomial, as in iSCSI and ext4) of the
+ * secret data, stored in the stego header so that the decoder
+ * detects corrupt payloads. The SSE4.2 crc32 instruction is
+ * used when the CPU has it, slicing-by-8 tables otherwise; the
+ * implementation is picked once at runtime like the LSB kernels.
+ * Like zlib's crc32, a CRC is started from 0 and extended with
+ * crc32c(crc, data, n) piece by piece.
+ */
+
+/* CRC of a piece of data computed on its own, see crc32c_join */
+typedef struct _Crc32cPiece
+{
+    uint32_t crc;
+    size_t size;
+} Crc32cPiece;
+
+/* Extend crc with n bytes */
+uint32_t crc32c(uint32_t crc, const void *data, size_t n);
+
+/* CRC of two consecutive pieces from their CRCs, the second one size2 bytes long */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t size2);
+
+/* CRC of count consecutive pieces, such as the stripes of a parallel run */
+uint32_t crc32c_join(const Crc32cPiece *pieces, size_t count);
+
+/* Force an implementation by name ("slice8", "sse42"), NULL for auto */
+int crc32c_select(const char *name);
+
+/* Name of the implementation in use */
+const char *crc32c_name(void);
+
+#endif
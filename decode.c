@@ -1,10 +1,22 @@
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include "decode.h"
 #include "types.h"
 #include "common.h"
+#include "stego_io.h"
+#include "lsb.h"
+#include "thread_pool.h"
+#include "lz.h"
+#include "scatter.h"
+#include "crc32c.h"
+#include "container.h"
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* Function Definitions */
 
@@ -25,6 +37,7 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
     else
         return d_failure;
 	
+   decInfo->output_named = (argv[3] != NULL);
    if(argv[3] != NULL)
     {
         decInfo->decoded_fname = argv[3]; //Sets decoded secret filename if provided
@@ -38,11 +51,15 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 /* Open files 
 *Input: Stego image and decoded secret file
 *Output: Opens above files for decoding 
-*Description: Opens stego image for reading and the output file (decoded_secret.txt) for writing 
-the decoded data.
+*Description: Opens stego image for reading. The output file (decoded_secret.txt) is opened
+for writing once the header tells whether the image holds a single secret or a container.
 */
 Status open_files_for_decoding(DecodeInfo *decInfo)
 {
+    // In-memory decodings have their buffers set up by the caller
+    if (decInfo->in_memory)
+        return d_success;
+
     // Stego Image file
     decInfo->fptr_d_stego_image = fopen(decInfo->d_stego_image_fname, "rb"); 
     
@@ -54,19 +71,118 @@ Status open_files_for_decoding(DecodeInfo *decInfo)
         return d_failure;
     }
 
-    // Decoded Secret file
-    decInfo->fptr_decoded = fopen(decInfo->decoded_fname, "wb");
-    
-    // Do Error handling
+    // Map the stego image when possible, stdio is the fallback
+    decInfo->stego_map = NULL;
+    decInfo->map_size = 0;
+    decInfo->image_pos = 0;
+    map_file_for_reading(decInfo->fptr_d_stego_image, &decInfo->stego_map, &decInfo->map_size);
+
+    return d_success;
+}
+
+/* Open decoded file
+*Input: DecodeInfo structure and the name of an output file
+*Output: fptr_decoded open for writing
+*/
+static Status open_decoded_file(DecodeInfo *decInfo, const char *fname)
+{
+    decInfo->fptr_decoded = fopen(fname, "wb");
     if (decInfo->fptr_decoded == NULL)
     {
         perror("fopen");
-        fprintf(stderr, "ERROR: Unable to open file %s\n", decInfo->decoded_fname);
+        fprintf(stderr, "ERROR: Unable to open file %s\n", fname);
         return d_failure;
     }
     return d_success;
 }
 
+/* Close files for decoding
+*Input: DecodeInfo structure
+*Output: Unmaps the stego image and closes every file that is open
+*Description: Leaves the structure ready for the next decoding, the buffers
+kept across decodings are not freed.
+*/
+void close_files_for_decoding(DecodeInfo *decInfo)
+{
+    unmap_file(decInfo->stego_map, decInfo->map_size);
+    decInfo->stego_map = NULL;
+
+    if (decInfo->fptr_d_stego_image != NULL)
+        fclose(decInfo->fptr_d_stego_image);
+    if (decInfo->fptr_decoded != NULL)
+        fclose(decInfo->fptr_decoded);
+    decInfo->fptr_d_stego_image = NULL;
+    decInfo->fptr_decoded = NULL;
+}
+
+/* Release decode info
+*Input: DecodeInfo structure
+*Output: Frees the buffers kept across decodings
+*/
+void release_decode_info(DecodeInfo *decInfo)
+{
+    arena_free(&decInfo->arena);
+    decInfo->d_data = NULL;
+    decInfo->span_buffer = NULL;
+    decInfo->span_buffer_size = 0;
+}
+
+/* Get stego bytes
+*Input: DecodeInfo structure, scratch buffer and number of carrier bytes
+*Output: Pointer to the next n carrier bytes of the stego image, NULL if the image is too short
+*Description: The carriers are looked up in the file span that holds them (see bmp.h).
+With a mapped stego image the span is in the mapping, otherwise it is read from the
+stream. A span without gaps is returned as is (straight into the mapping), one with
+row padding or alpha bytes is gathered into the buffer.
+*/
+char *get_stego_bytes(DecodeInfo *decInfo, char *buffer, size_t n)
+{
+    BmpInfo *bmp = &decInfo->bmp;
+    size_t first = bmp_carriers_before(bmp, decInfo->image_pos);
+    unsigned char *span;
+
+    if (first + n > bmp_capacity(bmp))
+        return NULL;
+
+    size_t span_size = bmp_carrier_end(bmp, first + n) - decInfo->image_pos;
+
+    if (decInfo->stego_map != NULL)
+    {
+        if (decInfo->image_pos + span_size > decInfo->map_size)
+            return NULL;
+        span = decInfo->stego_map + decInfo->image_pos;
+    }
+    else
+    {
+        if (span_size == n)
+            span = (unsigned char *)buffer;
+        else
+        {
+            if (span_size > decInfo->span_buffer_size)
+            {
+                // The smaller span is released with the arena
+                unsigned char *grown = arena_alloc(&decInfo->arena, span_size);
+                if (grown == NULL)
+                    return NULL;
+                decInfo->span_buffer = grown;
+                decInfo->span_buffer_size = span_size;
+            }
+            span = decInfo->span_buffer;
+        }
+
+        if (fread(span, 1, span_size, decInfo->fptr_d_stego_image) != span_size)
+            return NULL;
+        stats_count_io(io_read, span_size);
+    }
+
+    decInfo->image_pos += span_size;
+    if (span_size == n)
+        return (char *)span;
+
+    bmp_gather(bmp, first, n, span, (unsigned char *)buffer);
+    return buffer;
+}
+
 /* Decode Magic String
 *Input: DecodeInfo structure
 *Output: Status - d_success if decoding is performed successfully or else d_failure
@@ -75,8 +191,19 @@ to extract the magic string, which indicates the start of the hidden data.
 */
 Status decode_magic_string(DecodeInfo *decInfo)
 {
-        //Seek to the offset after BMP Header(54 bytes)
-	fseek(decInfo -> fptr_d_stego_image, 54, SEEK_SET);
+        //Parse the BMP headers, the hidden data starts at the pixel array
+	Status status;
+	if(decInfo -> stego_map != NULL)
+		status = bmp_parse_header(decInfo -> stego_map, (decInfo -> map_size < BMP_MAX_HEADER_SIZE) ? decInfo -> map_size : BMP_MAX_HEADER_SIZE, &decInfo -> bmp);
+	else
+		//Reads forward only, so pipes work too
+		status = bmp_read_header(decInfo -> fptr_d_stego_image, &decInfo -> bmp);
+	if(status != e_success)
+	{
+		fprintf(stderr, "Error: %s is not an uncompressed 24 or 32 bit BMP image\n", decInfo -> d_stego_image_fname);
+		return d_failure;
+	}
+	decInfo -> image_pos = decInfo -> bmp.data_offset;
         
      	//Decode data from image based on the length of MAGIC STRING
 	decode_data_from_image(strlen(MAGIC_STRING), decInfo);
@@ -94,11 +221,11 @@ Description: Reads the specified number of bytes from the stego image file
 and decodes them into the hidden data. This function manages memory allocation for the decoded
 data and processes each byte.
  */
-Status decode_data_from_image(int size, DecodeInfo *decInfo)
+Status decode_data_from_image(size_t size, DecodeInfo *decInfo)
 {
 
-      //Allocate memory for decoded datam including a null terminator.
-      decInfo -> d_data = (char *)calloc((size +1), 1);
+      //Allocate memory for decoded datam including a null terminator, from the arena of the decoding
+      decInfo -> d_data = arena_alloc(&decInfo -> arena, size + 1);
 
       //Do error handling
       if(decInfo -> d_data == NULL)
@@ -107,22 +234,23 @@ Status decode_data_from_image(int size, DecodeInfo *decInfo)
 		return d_failure;
 	}
 
-       for (int i = 0; i < size; i++)
+       for (size_t i = 0; i < size; i += MAX_SECRET_BUF_SIZE)
        {
+	//Decode up to MAX_SECRET_BUF_SIZE bytes per pass
+	size_t chunk = (size - i < MAX_SECRET_BUF_SIZE) ? size - i : MAX_SECRET_BUF_SIZE;
 
-	//Reads 8 bytes of data from stego.bmp
-        size_t byte_read = fread(decInfo -> decode_image_data, 1, 8 , decInfo -> fptr_d_stego_image); 
+	//Reads 8 bytes of data from stego.bmp for every decoded byte
+        char *image_bytes = get_stego_bytes(decInfo, decInfo -> decode_image_data, 8 * chunk); 
 	
 	//Do error handling 
-	if(byte_read != 8)
+	if(image_bytes == NULL)
 	{
 		fprintf(stderr, "Error: Insufficient data read from stego image.\n"); 
-		free(decInfo -> d_data);
 		return d_failure;
 	}
 
-	//Decode each byte using the LSB method
-	decInfo -> d_data[i] = decode_byte_from_lsb(decInfo -> d_data[i], decInfo -> decode_image_data);
+	//Decode the bytes using the LSB method
+	decode_bytes_from_lsb(image_bytes, chunk, decInfo -> d_data + i);
        }
 	
 	//Null terminate the decoded string
@@ -131,9 +259,6 @@ Status decode_data_from_image(int size, DecodeInfo *decInfo)
 	//Check if the decoded data matches expected values.
 	if((strcmp(decInfo -> d_data, MAGIC_STRING) == 0) || (strcmp(decInfo -> d_data, ".txt") == 0))
 		return d_success;
-	
-	//Free memory if no match
-	free(decInfo -> d_data);
 
 	return d_failure;
 
@@ -168,20 +293,27 @@ Output: Decoded integer size
 Description: Decodes an integer size value by reading the LSB from a buffer.
 This is crucialfor understanding how much data to expect in subsequent reads.
 */
-int decode_size_from_LSB(char *buffer)
+uint decode_size_from_LSB(char *buffer)
 {
 
-   int decoded_size = 0;
+   unsigned char size_bytes[4];
    
-   //Loop through each bit position to reconstruct or decode the integer
-   for(int bit_position = 0; bit_position < 32; bit_position++)
-   {
-	/*Extracts the LSB from the buffer and shifts it to its proper position in the integer,
-	using a bitwise OR (|) to combine the bits */
-	decoded_size |= ((buffer[bit_position] & 0x01) << (31 - bit_position));
-   }
+   //Each size byte is spread over the LSBs of 8 buffer bytes, most significant first
+   decode_bytes_from_lsb(buffer, 4, (char *)size_bytes);
+
+   //Combine the bytes to reconstruct the integer
+   return ((uint)size_bytes[0] << 24) | (size_bytes[1] << 16) | (size_bytes[2] << 8) | size_bytes[3];
+}
 
-   return decoded_size;//Return the decoded size
+/* Decode size field
+*Input: HEADER_SIZE_CARRIERS(version) buffer bytes and the header version
+Output: The size, 32 bits up to version 0 and 64 bits (high half first) from version 1
+*/
+uint64_t decode_size_field(char *buffer, uint version)
+{
+   if (HEADER_SIZE_CARRIERS(version) == 32)
+	return decode_size_from_LSB(buffer);
+   return (uint64_t)decode_size_from_LSB(buffer) << 32 | decode_size_from_LSB(buffer + 32);
 }
 
 
@@ -195,22 +327,45 @@ interpret these bits correctly
 Status decode_secret_file_extn_size(DecodeInfo *decInfo)
 {
    //Buffer to hold the raw bytes read from the stego image
-   char buffer[32];
+   char str[32];
    
    //Read 32 bytes from the stego image
-   size_t bytes_read = fread(buffer, 1, 32, decInfo->fptr_d_stego_image);
-   printf("Bytes read: %zu\n", bytes_read);
+   char *buffer = get_stego_bytes(decInfo, str, 32);
 
    //Do error handling
-   if(bytes_read != 32)
+   if(buffer == NULL)
    {
 	fprintf(stderr, "Error: Failed to read 32 bytes for secret file extension size\n");
 	return d_failure;
    }
 
    //Decode the size of the secret file extension from the buffer using LSB method
-   decInfo -> secret_file_size = decode_size_from_LSB(buffer);
-   printf("Decoded secret file extension size: %d bytes\n", decInfo->secret_file_size);
+   uint field = decode_size_from_LSB(buffer);
+   if(!HEADER_SUPPORTED(field))
+   {
+	fprintf(stderr, "Error: Stego image uses options this version does not support\n");
+	return d_failure;
+   }
+
+   //The option bits above the size select the depth of the secret data
+   decInfo -> secret_file_size = field & HEADER_EXTN_SIZE_MASK;
+   decInfo -> header_version = field >> HEADER_VERSION_SHIFT;
+   decInfo -> bits_per_pixel = ((field >> HEADER_DEPTH_SHIFT) & HEADER_DEPTH_MASK) + 1;
+   decInfo -> compressed = (field & HEADER_COMPRESSED) != 0;
+   decInfo -> scattered = (field & HEADER_SCATTERED) != 0;
+   decInfo -> has_crc = (field & HEADER_CRC) != 0;
+   decInfo -> encrypted = (field & HEADER_ENCRYPTED) != 0;
+   decInfo -> container = (field & HEADER_CONTAINER) != 0;
+   STAGE_MSG(decInfo, "Decoded secret file extension size: %zu bytes\n", decInfo->secret_file_size);
+   STAGE_MSG(decInfo, "Secret data uses %u bit(s) per image byte\n", decInfo->bits_per_pixel);
+   if(decInfo -> compressed)
+	STAGE_MSG(decInfo, "Secret data is compressed\n");
+   if(decInfo -> scattered)
+	STAGE_MSG(decInfo, "Secret data is scattered\n");
+   if(decInfo -> encrypted)
+	STAGE_MSG(decInfo, "Secret data is encrypted\n");
+   if(decInfo -> container)
+	STAGE_MSG(decInfo, "Secret data is a container of files\n");
   
  return d_success;
 
@@ -224,13 +379,17 @@ reading the number of bytes that represent the extension.
 */
 Status decode_secret_file_extn(DecodeInfo *decInfo)
 {
+    // Containers keep the names of their files in the index
+    if (decInfo->container)
+        return (decInfo->secret_file_size == 0) ? d_success : d_failure;
+
     //Define the expected length of the secret file extension
     size_t extn_size = strlen(".txt");
 
     //Call function to decode the secret file extension from stego image
     if(decode_data_from_image(extn_size, decInfo) == d_success)
     {
-	printf("Decoded secret file extension: %s\n", decInfo -> d_data);
+	STAGE_MSG(decInfo, "Decoded secret file extension: %s\n", decInfo -> d_data);
 	return d_success;
     }
 
@@ -244,74 +403,1045 @@ Status decode_secret_file_extn(DecodeInfo *decInfo)
 *Input: DecodeInfo Structure
 Output: Decodes the secret file size
 Description: Reads the secret file size encoded in the LSB of the steog image
-by extracting the specified number of bits(32) that represent the size.
+by extracting the specified number of bits (32, 64 from header version 1) that represent the size.
 */
 Status decode_secret_file_size(DecodeInfo *decInfo)
 {
     //Buffer to hold the size data read from stego image
-    char str[32];
+    char buffer[HEADER_SIZE_CARRIERS(HEADER_VERSION)];
+    size_t carriers = HEADER_SIZE_CARRIERS(decInfo->header_version);
 
-    //Read 32 bytes for file size
-    size_t bytes_read = fread(str, 1, 32, decInfo->fptr_d_stego_image);
+    //Read 32 or 64 bytes for file size
+    char *str = get_stego_bytes(decInfo, buffer, carriers);
     
     //Do error handling
-    if(bytes_read != 32)
+    if(str == NULL)
     {
-	fprintf(stderr, "Error: Failed to read 32 bytes for secret file size\n");
+	fprintf(stderr, "Error: Failed to read %zu bytes for secret file size\n", carriers);
 	return d_failure;
     }
      
     //Call function to decode the file from read bytes using LSB method
-    decInfo -> secret_file_size = decode_size_from_LSB(str);
-    printf("Decoded secret file size: %d bytes\n", decInfo->secret_file_size);
+    uint64_t size = decode_size_field(str, decInfo->header_version);
+    decInfo -> secret_file_size = size;
+    if (decInfo -> secret_file_size != size)
+    {
+	fprintf(stderr, "Error: Secret data of %llu bytes is too large for this system\n", (unsigned long long)size);
+	return d_failure;
+    }
+    STAGE_MSG(decInfo, "Decoded secret file size: %zu bytes\n", decInfo->secret_file_size);
 
     return d_success;
    
 }
 
+/* Decode secret file cipher
+*Input: DecodeInfo Structure
+Output: Key of encrypted secret data, derived from the passphrase and the salt of the image
+Description: The key check value that follows the salt rejects a wrong passphrase
+before any secret data is decoded.
+*/
+Status decode_secret_file_cipher(DecodeInfo *decInfo)
+{
+    unsigned char salt[CHACHA20_SALT_SIZE];
+    char buffer[32];
+
+    if (!decInfo->encrypted)
+        return d_success;
+    if (decInfo->cipher_passphrase == NULL)
+    {
+        fprintf(stderr, "Error: Secret data is encrypted, its passphrase is needed to decode it\n");
+        return d_failure;
+    }
+
+    char *str = get_stego_bytes(decInfo, decInfo->decode_image_data, 8 * CHACHA20_SALT_SIZE);
+    if (str == NULL)
+    {
+        fprintf(stderr, "Error: Failed to read %d bytes for the salt\n", 8 * CHACHA20_SALT_SIZE);
+        return d_failure;
+    }
+    decode_bytes_from_lsb(str, CHACHA20_SALT_SIZE, (char *)salt);
+
+    str = get_stego_bytes(decInfo, buffer, 32);
+    if (str == NULL)
+    {
+        fprintf(stderr, "Error: Failed to read 32 bytes for the key check value\n");
+        return d_failure;
+    }
+
+    chacha20_key_from_passphrase(&decInfo->cipher, decInfo->cipher_passphrase, salt);
+    if (chacha20_key_check(&decInfo->cipher) != (uint)decode_size_from_LSB(str))
+    {
+        fprintf(stderr, "Error: Wrong passphrase for the secret data in %s\n", decInfo->d_stego_image_fname);
+        return d_failure;
+    }
+    return d_success;
+}
+
+/* Decode secret file CRC
+*Input: DecodeInfo Structure
+Output: Decodes the CRC32C of the secret data
+Description: Images of older versions have no CRC field, their data is not checked.
+*/
+Status decode_secret_file_crc(DecodeInfo *decInfo)
+{
+    char buffer[32];
+
+    if (!decInfo->has_crc)
+        return d_success;
+
+    char *str = get_stego_bytes(decInfo, buffer, 32);
+    if (str == NULL)
+    {
+        fprintf(stderr, "Error: Failed to read 32 bytes for secret file CRC\n");
+        return d_failure;
+    }
+
+    decInfo->payload_crc = decode_size_from_LSB(str);
+    STAGE_MSG(decInfo, "Decoded secret file CRC32C: %08x\n", decInfo->payload_crc);
+    return d_success;
+}
+
+/* Check payload CRC
+*Input: DecodeInfo Structure and the CRC of the decoded secret data
+Output: d_success when it is the CRC of the header, or the image has none
+Description: The output of a corrupt image is dropped: in-memory output is
+emptied and the output file removed, as for the files of a container, so a
+missing file means a rejected payload.
+*/
+static Status check_payload_crc(DecodeInfo *decInfo, uint crc)
+{
+    if (!decInfo->has_crc || crc == decInfo->payload_crc)
+        return d_success;
+
+    fprintf(stderr, "Error: Secret data in %s is corrupt (CRC32C %08x, expected %08x)\n",
+            decInfo->d_stego_image_fname, crc, decInfo->payload_crc);
+    decInfo->output_size = 0;
+    if (!decInfo->in_memory && decInfo->fptr_decoded != NULL)
+    {
+        // Only regular files, an output such as /dev/stdout stays
+        struct stat st;
+        int regular = fstat(fileno(decInfo->fptr_decoded), &st) == 0 && S_ISREG(st.st_mode);
+        fclose(decInfo->fptr_decoded);
+        decInfo->fptr_decoded = NULL;
+        if (regular)
+            remove(decInfo->decoded_fname);
+    }
+    return d_failure;
+}
+
+/* Reserve output
+*Input: DecodeInfo Structure and a number of bytes
+Output: d_success when the in-memory output has room for n more bytes
+Description: Growable outputs double until they do.
+*/
+static Status reserve_output(DecodeInfo *decInfo, size_t n)
+{
+    if (n <= decInfo->output_capacity - decInfo->output_size)
+        return d_success;
+    if (!decInfo->output_grow || n > SIZE_MAX / 2 - decInfo->output_size)
+        return d_failure;
+
+    size_t capacity = decInfo->output_capacity ? decInfo->output_capacity : DECODE_CHUNK_SIZE;
+    while (capacity - decInfo->output_size < n)
+        capacity *= 2;
+    char *grown = realloc(decInfo->output, capacity);
+    if (grown == NULL)
+        return d_failure;
+    decInfo->output = grown;
+    decInfo->output_capacity = capacity;
+    return d_success;
+}
+
+/* Write decoded data
+*Input: DecodeInfo Structure, decoded secret bytes and their count
+Output: e_success once the bytes are written to the output file
+Description: Sink of the decompressor, also used directly for uncompressed data.
+In-memory decodings append to the output buffer.
+*/
+static Status write_decoded_data(void *arg, const char *data, size_t n)
+{
+    DecodeInfo *decInfo = arg;
+
+    if (decInfo->in_memory)
+    {
+        if (reserve_output(decInfo, n) != d_success)
+            return e_failure;
+        memcpy(decInfo->output + decInfo->output_size, data, n);
+        decInfo->output_size += n;
+        return e_success;
+    }
+
+    if (fwrite(data, sizeof(char), n, decInfo->fptr_decoded) != n)
+        return e_failure;
+    stats_count_io(io_write, n);
+    return e_success;
+}
+
+/* Seek stego carrier
+*Input: DecodeInfo Structure and a carrier index
+Output: get_stego_bytes continues at that carrier, d_failure when a stream cannot get there
+Description: Mapped images just move image_pos and streams seek. Pipes only go forward,
+the bytes in between are read and dropped.
+*/
+static Status seek_stego_carrier(DecodeInfo *decInfo, size_t carrier)
+{
+    size_t pos = bmp_carrier_end(&decInfo->bmp, carrier);
+
+    if (decInfo->stego_map == NULL && pos != decInfo->image_pos &&
+        fseeko(decInfo->fptr_d_stego_image, pos, SEEK_SET) != 0)
+    {
+        if (pos < decInfo->image_pos)
+            return d_failure;
+        for (size_t skip = pos - decInfo->image_pos; skip > 0;)
+        {
+            size_t n = (skip < sizeof(decInfo->decode_image_data)) ? skip : sizeof(decInfo->decode_image_data);
+            if (fread(decInfo->decode_image_data, 1, n, decInfo->fptr_d_stego_image) != n)
+                return d_failure;
+            stats_count_io(io_read, n);
+            skip -= n;
+        }
+    }
+    decInfo->image_pos = pos;
+    return d_success;
+}
+
+/* Decode payload range
+*Input: DecodeInfo Structure with payload_carrier set, payload offset, number of bytes and a sink
+Output: Payload bytes [offset, offset + n), decrypted, go to sink in pieces
+Description: The carriers of a payload byte follow from the header. Consecutive data is
+read from the depth group holding offset, lsb_image_bytes(group start, depth) carriers
+past the first data carrier, scattered data from the tiles whose ranges meet the range;
+the last tile stays decoded in range_data for the next range. Only those carriers are
+read, and streams that cannot seek need the ranges in order.
+*/
+static Status decode_payload_range(DecodeInfo *decInfo, size_t offset, size_t n, LzSink sink, void *arg)
+{
+    int depth = decInfo->bits_per_pixel ? decInfo->bits_per_pixel : 1;
+    size_t end = offset + n;
+
+    if (decInfo->range_data == NULL)
+    {
+        decInfo->range_data = arena_alloc(&decInfo->arena, DECODE_CHUNK_SIZE);
+        decInfo->range_image = arena_alloc(&decInfo->arena, 8 * DECODE_CHUNK_SIZE);
+        decInfo->range_scratch = decInfo->scattered ? arena_alloc(&decInfo->arena, sizeof(ScatterScratch)) : NULL;
+        decInfo->range_tile = SIZE_MAX;
+        if (!decInfo->range_data || !decInfo->range_image || (decInfo->scattered && !decInfo->range_scratch))
+        {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            decInfo->range_data = NULL;
+            return d_failure;
+        }
+    }
+
+    if (decInfo->scattered)
+    {
+        ScatterMap *map = &decInfo->scatter;
+        size_t start, stop, low = 0, high = map->num_tiles;
+
+        // Tiles hold consecutive ranges, find the first one that ends past offset
+        while (low < high)
+        {
+            size_t middle = low + (high - low) / 2;
+            scatter_tile_range(map, middle, &start, &stop);
+            if (stop <= offset)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+        for (size_t tile = low; tile < map->num_tiles && offset < end; tile++)
+        {
+            scatter_tile_range(map, tile, &start, &stop);
+            if (tile != decInfo->range_tile)
+            {
+                char *carriers;
+                if (seek_stego_carrier(decInfo, decInfo->payload_carrier + tile * map->tile_size) != d_success ||
+                    (carriers = get_stego_bytes(decInfo, decInfo->range_image, map->tile_size)) == NULL)
+                {
+                    fprintf(stderr, "Error: Failed to read from stego image\n");
+                    return d_failure;
+                }
+                scatter_decode_tile(map, tile, (unsigned char *)carriers, decInfo->range_data, decInfo->range_scratch);
+                if (decInfo->encrypted)
+                    chacha20_payload_xor(&decInfo->cipher, start, decInfo->range_data, decInfo->range_data, stop - start);
+                decInfo->range_tile = tile;
+            }
+
+            size_t take = ((stop < end) ? stop : end) - offset;
+            if (take > 0 && sink(arg, decInfo->range_data + (offset - start), take) != e_success)
+                return d_failure;
+            offset += take;
+        }
+        return (offset == end) ? d_success : d_failure;
+    }
+
+    size_t chunk_limit = LSB_ROUND_CHUNK(DECODE_CHUNK_SIZE, depth);
+    size_t i = offset - offset % LSB_GROUP_BYTES(depth);
+    if (n > 0 && seek_stego_carrier(decInfo, decInfo->payload_carrier + lsb_image_bytes(i, depth)) != d_success)
+    {
+        fprintf(stderr, "Error: Failed to read from stego image\n");
+        return d_failure;
+    }
+
+    for (; i < end; i += chunk_limit)
+    {
+        size_t chunk = (end - i < chunk_limit) ? end - i : chunk_limit;
+        char *image_bytes = get_stego_bytes(decInfo, decInfo->range_image, lsb_image_bytes(chunk, depth));
+        if (image_bytes == NULL)
+        {
+            fprintf(stderr, "Error: Failed to read from stego image\n");
+            return d_failure;
+        }
+
+        decode_bytes_from_lsb_depth(image_bytes, chunk, decInfo->range_data, depth);
+        if (decInfo->encrypted)
+            chacha20_payload_xor(&decInfo->cipher, i, decInfo->range_data, decInfo->range_data, chunk);
+
+        size_t skip = (i < offset) ? offset - i : 0;
+        if (sink(arg, decInfo->range_data + skip, chunk - skip) != e_success)
+            return d_failure;
+    }
+    return d_success;
+}
+
+/* Copy range data, sink appending the bytes to the buffer *arg points into */
+static Status copy_range_data(void *arg, const char *data, size_t n)
+{
+    char **cursor = arg;
+
+    memcpy(*cursor, data, n);
+    *cursor += n;
+    return e_success;
+}
+
+/* Output of a slice of the secret: the first skip bytes are dropped and left bytes written */
+typedef struct _SliceOutput
+{
+    DecodeInfo *decInfo;
+    size_t skip;
+    size_t left;
+    LzDecoder lz;
+} SliceOutput;
+
+/* Write slice data, sink of the decompressor keeping the bytes of the slice */
+static Status write_slice_data(void *arg, const char *data, size_t n)
+{
+    SliceOutput *slice = arg;
+    size_t skip = (n < slice->skip) ? n : slice->skip;
+
+    slice->skip -= skip;
+    n -= skip;
+    if (n > slice->left)
+        n = slice->left;
+    slice->left -= n;
+    return (n > 0) ? write_decoded_data(slice->decInfo, data + skip, n) : e_success;
+}
+
+/* Feed slice data, sink of the stored bytes of a compressed slice */
+static Status feed_slice_data(void *arg, const char *data, size_t n)
+{
+    SliceOutput *slice = arg;
+
+    return lz_decoder_feed(&slice->lz, data, n, write_slice_data, slice);
+}
+
+/* Decode secret slice
+*Input: DecodeInfo Structure with the slice set, payload offset and size of the stored bytes,
+whether they are compressed
+Output: Bytes [slice_offset, slice_offset + slice_length) of the secret in the output, fewer
+when the secret ends before
+Description: Uncompressed bytes are decoded from their own carriers. Compressed data has no
+offsets of its own, it is decompressed from its start and the decoding stops once the slice
+is complete, so the head of a secret stays cheap. Only part of the data is read, the CRC
+cannot be checked.
+*/
+static Status decode_secret_slice(DecodeInfo *decInfo, size_t base, size_t stored_size, int compressed)
+{
+    int depth = decInfo->bits_per_pixel ? decInfo->bits_per_pixel : 1;
+    size_t offset = decInfo->slice_offset, length = decInfo->slice_length;
+
+    if (!compressed)
+    {
+        if (offset > stored_size)
+            offset = stored_size;
+        if (length > stored_size - offset)
+            length = stored_size - offset;
+        if (decode_payload_range(decInfo, base + offset, length, write_decoded_data, decInfo) != d_success)
+            return d_failure;
+        STAGE_MSG(decInfo, "Decoded %zu bytes from offset %zu\n", length, offset);
+        return d_success;
+    }
+
+    SliceOutput slice = { .decInfo = decInfo, .skip = offset, .left = length };
+    unsigned char *lz_block = arena_alloc(&decInfo->arena, LZ_BLOCK_SIZE);
+    unsigned char *lz_output = arena_alloc(&decInfo->arena, LZ_BLOCK_SIZE);
+    if (lz_block == NULL || lz_output == NULL)
+    {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return d_failure;
+    }
+    lz_decoder_init(&slice.lz, lz_block, lz_output);
+
+    size_t piece = LSB_ROUND_CHUNK(DECODE_CHUNK_SIZE, depth), i;
+    for (i = 0; i < stored_size && slice.left > 0; i += piece)
+    {
+        if (piece > stored_size - i)
+            piece = stored_size - i;
+        if (decode_payload_range(decInfo, base + i, piece, feed_slice_data, &slice) != d_success)
+            return d_failure;
+    }
+    if (i >= stored_size && lz_decoder_finish(&slice.lz) != e_success)
+    {
+        fprintf(stderr, "Error: Compressed data in the stego image is truncated\n");
+        return d_failure;
+    }
+    STAGE_MSG(decInfo, "Decoded %zu bytes from offset %zu\n", length - slice.left, offset);
+    return d_success;
+}
+
+/* Output of one file of a container */
+typedef struct _MemberOutput
+{
+    DecodeInfo *decInfo;
+    int compressed;
+    uint crc;               /* of the stored bytes */
+    uint64_t size;          /* bytes written */
+    LzDecoder lz;
+} MemberOutput;
+
+/* Write member file, sink of the file's bytes */
+static Status write_member_file(void *arg, const char *data, size_t n)
+{
+    MemberOutput *member = arg;
+
+    member->size += n;
+    return write_decoded_data(member->decInfo, data, n);
+}
+
+/* Write member data, sink of the stored bytes, decompressed when the file is compressed */
+static Status write_member_data(void *arg, const char *data, size_t n)
+{
+    MemberOutput *member = arg;
+
+    member->crc = crc32c(member->crc, data, n);
+    if (member->compressed)
+        return lz_decoder_feed(&member->lz, data, n, write_member_file, member);
+    return write_member_file(member, data, n);
+}
+
+/* Extract container file
+*Input: DecodeInfo Structure, entry of the file, output directory and LZ_BLOCK_SIZE buffers
+Output: The file in the output directory under its name
+Description: Decodes the stored bytes of the file alone. A file whose CRC or size
+does not match its entry is removed, so a corrupt file never looks complete.
+*/
+static Status extract_container_file(DecodeInfo *decInfo, const ContainerEntry *entry, const char *dir,
+                                     unsigned char *lz_block, unsigned char *lz_output)
+{
+    char path[PATH_MAX];
+    MemberOutput member = { .decInfo = decInfo, .compressed = (entry->flags & CONTAINER_COMPRESSED) != 0 };
+
+    if (snprintf(path, sizeof(path), "%s/%s", dir, entry->name) >= (int)sizeof(path))
+    {
+        fprintf(stderr, "ERROR: Unable to open file %s/%s\n", dir, entry->name);
+        return d_failure;
+    }
+    if (open_decoded_file(decInfo, path) != d_success)
+        return d_failure;
+    if (member.compressed)
+        lz_decoder_init(&member.lz, lz_block, lz_output);
+
+    // A slice of the file is not checked, its CRC covers the whole file
+    Status status;
+    if (decInfo->slice)
+        status = decode_secret_slice(decInfo, entry->offset, entry->stored_size, member.compressed);
+    else
+        status = decode_payload_range(decInfo, entry->offset, entry->stored_size, write_member_data, &member);
+    if (status != d_success)
+        fprintf(stderr, "Error: Failed to extract %s\n", entry->name);
+    else if (!decInfo->slice && member.crc != entry->crc)
+    {
+        fprintf(stderr, "Error: %s in %s is corrupt (CRC32C %08x, expected %08x)\n",
+                entry->name, decInfo->d_stego_image_fname, member.crc, entry->crc);
+        status = d_failure;
+    }
+    else if (!decInfo->slice && ((member.compressed && lz_decoder_finish(&member.lz) != e_success) || member.size != entry->size))
+    {
+        fprintf(stderr, "Error: %s in %s is truncated\n", entry->name, decInfo->d_stego_image_fname);
+        status = d_failure;
+    }
+
+    if (fclose(decInfo->fptr_decoded) != 0 && status == d_success)
+    {
+        fprintf(stderr, "Error: Failed to write to %s\n", path);
+        status = d_failure;
+    }
+    decInfo->fptr_decoded = NULL;
+    if (status != d_success)
+        remove(path);
+    else if (!decInfo->slice)
+        STAGE_MSG(decInfo, "Extracted %s, %llu bytes\n", path, (unsigned long long)entry->size);
+    return status;
+}
+
+/* Decode container files
+*Input: Size of the payload and DecodeInfo Structure after the header stages
+Output: The files of the container (or the one named member_name) in the output directory,
+or their list
+Description: Only the index and the stored bytes of the files asked for are decoded, so
+extracting one file costs its own carriers whatever comes before it. The files are
+extracted in index order, which is payload order, so pipes work too. Every file is
+checked against the CRC of its entry and the index against its own CRC.
+*/
+static Status decode_container_files(size_t size, DecodeInfo *decInfo)
+{
+    unsigned char header[CONTAINER_HEADER_SIZE];
+    char *cursor = (char *)header;
+    uint32_t count, index_size;
+    const char *dir = decInfo->output_named ? decInfo->decoded_fname : ".";
+
+    if (decInfo->in_memory)
+    {
+        fprintf(stderr, "Error: %s holds a container, its files are extracted with -d\n", decInfo->d_stego_image_fname);
+        return d_failure;
+    }
+
+    if (size < CONTAINER_HEADER_SIZE ||
+        decode_payload_range(decInfo, 0, CONTAINER_HEADER_SIZE, copy_range_data, &cursor) != d_success ||
+        container_parse_header(header, &count, &index_size) != e_success || index_size > size)
+    {
+        fprintf(stderr, "Error: The container index in %s is corrupt\n", decInfo->d_stego_image_fname);
+        return d_failure;
+    }
+
+    unsigned char *index = arena_alloc(&decInfo->arena, index_size);
+    ContainerEntry *entries = arena_alloc(&decInfo->arena, count * sizeof(ContainerEntry));
+    if (index == NULL || entries == NULL)
+    {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return d_failure;
+    }
+    memcpy(index, header, CONTAINER_HEADER_SIZE);
+    cursor = (char *)index + CONTAINER_HEADER_SIZE;
+    if (decode_payload_range(decInfo, CONTAINER_HEADER_SIZE, index_size - CONTAINER_HEADER_SIZE, copy_range_data, &cursor) != d_success ||
+        container_parse_index(index, index_size, size, entries, count) != e_success)
+    {
+        fprintf(stderr, "Error: The container index in %s is corrupt\n", decInfo->d_stego_image_fname);
+        return d_failure;
+    }
+    STAGE_MSG(decInfo, "Decoded the index of %u files\n", count);
+
+    if (decInfo->slice && decInfo->member_name == NULL)
+    {
+        fprintf(stderr, "Error: %s holds a container, a slice is taken of one of its files (-f)\n", decInfo->d_stego_image_fname);
+        return d_failure;
+    }
+
+    if (decInfo->list_only)
+    {
+        for (uint32_t i = 0; i < count; i++)
+            printf("%s: %llu bytes%s\n", entries[i].name, (unsigned long long)entries[i].size,
+                   (entries[i].flags & CONTAINER_COMPRESSED) ? ", compressed" : "");
+        return d_success;
+    }
+
+    unsigned char *lz_block = arena_alloc(&decInfo->arena, LZ_BLOCK_SIZE);
+    unsigned char *lz_output = arena_alloc(&decInfo->arena, LZ_BLOCK_SIZE);
+    if (lz_block == NULL || lz_output == NULL)
+    {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return d_failure;
+    }
+
+    if (decInfo->member_name != NULL)
+    {
+        const ContainerEntry *entry = container_find(entries, count, decInfo->member_name);
+        if (entry == NULL)
+        {
+            fprintf(stderr, "Error: %s holds no file named %s\n", decInfo->d_stego_image_fname, decInfo->member_name);
+            return d_failure;
+        }
+        return extract_container_file(decInfo, entry, dir, lz_block, lz_output);
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (extract_container_file(decInfo, &entries[i], dir, lz_block, lz_output) != d_success)
+            return d_failure;
+    }
+    return d_success;
+}
+
 /* Decode secret file data 
 *Input: Size of secret file data to be decoded and DecodeInfo Structure
 Output: Decodes the secret file data
-Description: Retrives the actual secret data embedded in the stego image by reading
-8 bits and decoding them from their LSB. 
+Description: Retrives the actual secret data embedded in the stego image in chunks of
+DECODE_CHUNK_SIZE bytes (whole depth groups): the stego bytes of a chunk are decoded from
+their low bits into a fixed output buffer which is written out before the next chunk,
+so memory use does not depend on the size of the secret. Scattered data is decoded
+tile by tile instead, each tile giving the slice of the secret it holds. The CRC of the
+data is checked before the last chunk is written, so the output of a corrupt image is
+never complete. Encrypted chunks are decrypted in place once their CRC is taken, while
+they are still in the cache.
 */
-Status decode_secret_file_data(int size, DecodeInfo *decInfo)
+Status decode_secret_file_data(size_t size, DecodeInfo *decInfo)
 {
-    // Allocate memory for the secret data, including error handling
-    char *decoded_data = (char *)malloc(size);
-    if (!decoded_data)
+    struct stat st, out_st;
+    LzDecoder lz;
+    int depth = decInfo->bits_per_pixel ? decInfo->bits_per_pixel : 1;
+
+    // The layout of scattered data follows from the key, the size and the carriers left
+    if (decInfo->scattered)
+    {
+        if (decInfo->passphrase == NULL)
+        {
+            fprintf(stderr, "Error: Secret data is scattered, its passphrase is needed to decode it\n");
+            return d_failure;
+        }
+        if (scatter_init(&decInfo->scatter, scatter_key(decInfo->passphrase),
+                                     bmp_capacity(&decInfo->bmp) - bmp_carriers_before(&decInfo->bmp, decInfo->image_pos),
+                                     size, depth) != e_success)
+        {
+            fprintf(stderr, "Error: Secret data does not fit in %s\n", decInfo->d_stego_image_fname);
+            return d_failure;
+        }
+    }
+
+    // A size beyond the carriers left is a corrupt header, compared in payload bytes so it cannot overflow
+    decInfo->payload_carrier = bmp_carriers_before(&decInfo->bmp, decInfo->image_pos);
+    if (!decInfo->scattered && size > lsb_payload_capacity(bmp_capacity(&decInfo->bmp) - decInfo->payload_carrier, depth))
+    {
+        fprintf(stderr, "Error: Secret data does not fit in %s\n", decInfo->d_stego_image_fname);
+        return d_failure;
+    }
+
+    // Containers are decoded file by file from their index
+    if (decInfo->container)
+        return decode_container_files(size, decInfo);
+
+    // The output file is opened once the header says what the image holds
+    if (!decInfo->in_memory && open_decoded_file(decInfo, decInfo->decoded_fname) != d_success)
+        return d_failure;
+
+    // A slice is decoded from the carriers of its own bytes
+    if (decInfo->slice)
+        return decode_secret_slice(decInfo, 0, size, decInfo->compressed);
+
+    // Stripes can be decoded in parallel when both files allow positional I/O, compressed
+    // data has no fixed output offsets and always goes through the sequential loop
+    if (decInfo->num_threads > 1 && !decInfo->compressed && (decInfo->in_memory ||
+        (fstat(fileno(decInfo->fptr_d_stego_image), &st) == 0 && S_ISREG(st.st_mode) &&
+         fstat(fileno(decInfo->fptr_decoded), &out_st) == 0 && S_ISREG(out_st.st_mode))))
+        return decode_secret_file_data_parallel(size, decInfo);
+
+    // Fixed size buffers for the decoded data, the raw (stdio) or gathered carrier bytes
+    // and the blocks of the decompressor, from the arena of the decoding
+    char *decoded_data = arena_alloc(&decInfo->arena, DECODE_CHUNK_SIZE);
+    char *image_buffer = arena_alloc(&decInfo->arena, 8 * DECODE_CHUNK_SIZE);
+    unsigned char *lz_block = decInfo->compressed ? arena_alloc(&decInfo->arena, LZ_BLOCK_SIZE) : NULL;
+    unsigned char *lz_output = decInfo->compressed ? arena_alloc(&decInfo->arena, LZ_BLOCK_SIZE) : NULL;
+    ScatterScratch *scratch = decInfo->scattered ? arena_alloc(&decInfo->arena, sizeof(ScatterScratch)) : NULL;
+    if (!decoded_data || !image_buffer || (decInfo->compressed && (!lz_block || !lz_output)) ||
+        (decInfo->scattered && !scratch))
     {
         fprintf(stderr, "Error: Memory allocation failed\n");
         return d_failure;
     }
+    if (decInfo->compressed)
+        lz_decoder_init(&lz, lz_block, lz_output);
+    Status status = d_success;
 
-    // Buffer to hold the raw data read from the stego image
-    char buffer[8];
-    size_t bytes_read;
+    // Mapped pages before the current position are no longer needed
+    size_t released = 0;
+    size_t chunk_limit = LSB_ROUND_CHUNK(DECODE_CHUNK_SIZE, depth);
+    uint crc = 0;
 
-    // Read the data in chunks of 8 bytes and decode in one go
-    for (int i = 0; i < size; i++)
+    for (size_t i = 0, tile = 0; i < size; tile++)
     {
-        // Read 8 bytes from the stego image into the buffer
-        bytes_read = fread(buffer, sizeof(char), sizeof(buffer), decInfo->fptr_d_stego_image);
-        if (bytes_read < sizeof(buffer) && ferror(decInfo->fptr_d_stego_image))
+        size_t chunk;
+        char *image_bytes;
+
+        // Get the stego bytes that carry the chunk (or tile) and decode them into the output buffer
+        if (decInfo->scattered)
+        {
+            size_t start, end;
+            scatter_tile_range(&decInfo->scatter, tile, &start, &end);
+            chunk = end - start;
+            image_bytes = get_stego_bytes(decInfo, image_buffer, decInfo->scatter.tile_size);
+            if (image_bytes != NULL)
+                scatter_decode_tile(&decInfo->scatter, tile, (unsigned char *)image_bytes, decoded_data, scratch);
+        }
+        else
+        {
+            chunk = (size - i < chunk_limit) ? size - i : chunk_limit;
+            image_bytes = get_stego_bytes(decInfo, image_buffer, lsb_image_bytes(chunk, depth));
+            if (image_bytes != NULL)
+                decode_bytes_from_lsb_depth(image_bytes, chunk, decoded_data, depth);
+        }
+        if (image_bytes == NULL)
         {
             fprintf(stderr, "Error: Failed to read from stego image\n");
-            free(decoded_data);
-            return d_failure;
+            status = d_failure;
+            break;
+        }
+
+        // The CRC is checked before the last chunk reaches the output
+        if (decInfo->has_crc)
+            crc = crc32c(crc, decoded_data, chunk);
+        if (i + chunk == size && check_payload_crc(decInfo, crc) != d_success)
+        {
+            status = d_failure;
+            break;
         }
+        if (decInfo->encrypted)
+            chacha20_payload_xor(&decInfo->cipher, i, decoded_data, decoded_data, chunk);
 
-        // Decode the byte using LSB method and store it directly in the decoded data 
-        decoded_data[i] = decode_byte_from_lsb(0, buffer);
+        // Write the decoded chunk to the output file, through the decompressor if needed
+        if (chunk > 0 && (decInfo->compressed ? lz_decoder_feed(&lz, decoded_data, chunk, write_decoded_data, decInfo)
+                                              : write_decoded_data(decInfo, decoded_data, chunk)) != e_success)
+        {
+            fprintf(stderr, "Error: Failed to write to %s\n", decInfo->decoded_fname);
+            status = d_failure;
+            break;
+        }
+        i += chunk;
+
+        if (!decInfo->in_memory)
+            release_mapped_pages(decInfo->stego_map, &released, decInfo->image_pos);
+    }
+
+    if (status == d_success && size == 0 && check_payload_crc(decInfo, crc) != d_success)
+        status = d_failure;
+
+    if (decInfo->compressed && status == d_success && lz_decoder_finish(&lz) != e_success)
+    {
+        fprintf(stderr, "Error: Compressed data in the stego image is truncated\n");
+        status = d_failure;
+    }
+
+    return status; 
+}
+
+
+/* Buffers of one decoding thread, handed from stripe to stripe */
+typedef struct _StripeScratch
+{
+    char *decoded_data;
+    unsigned char *span_buffer;
+    char *image_buffer;
+    ScatterScratch *scatter;        /* scattered data only */
+    struct _StripeScratch *next;
+} StripeScratch;
+
+/* State of one decode_secret_file_data_parallel call shared by its stripes */
+typedef struct _StripeRun
+{
+    DecodeInfo *decInfo;
+    pthread_mutex_t lock;
+    StripeScratch *free_scratch;    /* one set per thread, minus those of running stripes */
+    Crc32cPiece *pieces;            /* CRC of every stripe */
+    char *tail;                     /* last chunk of an output file, written once the CRC is checked */
+    size_t tail_offset;
+    size_t tail_size;
+} StripeRun;
+
+/* Take a set of stripe buffers, no more stripes run at once than there are sets */
+static StripeScratch *take_scratch(StripeRun *run)
+{
+    pthread_mutex_lock(&run->lock);
+    StripeScratch *scratch = run->free_scratch;
+    if (scratch != NULL)
+        run->free_scratch = scratch->next;
+    pthread_mutex_unlock(&run->lock);
+    return scratch;
+}
+
+/* Hand a set of stripe buffers to the next stripe */
+static void return_scratch(StripeRun *run, StripeScratch *scratch)
+{
+    pthread_mutex_lock(&run->lock);
+    scratch->next = run->free_scratch;
+    run->free_scratch = scratch;
+    pthread_mutex_unlock(&run->lock);
+}
+
+/* Release the mapped pages of the carriers [first, end), which a stripe has decoded */
+static void release_stripe_pages(DecodeInfo *decInfo, size_t first, size_t end)
+{
+    if (decInfo->stego_map != NULL && !decInfo->in_memory)
+    {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t released = (bmp_carrier_end(&decInfo->bmp, first) + page_size - 1) & ~(page_size - 1);
+        release_mapped_pages(decInfo->stego_map, &released, bmp_carrier_end(&decInfo->bmp, end));
+    }
+}
+
+/* Decode secret stripe
+*Input: DecodeInfo Structure (with data_pos set) and stripe index
+Output: Decodes one stripe of secret bytes starting at index * stripe size
+Description: Stripes and chunks are whole depth groups, so a chunk starting at secret
+byte i is stored from carrier lsb_image_bytes(i, depth) past the first data carrier and
+every stripe is read from the mapping (or with pread) and written with pwrite at its own
+offset of the output file, independently of the other stripes. Spans with row padding
+or alpha bytes are gathered into a dense buffer first. The stripe's CRC goes to its
+piece, encrypted chunks are decrypted in place and the last chunk of the secret is
+kept in the tail.
+*/
+static Status decode_secret_stripe(void *arg, size_t index)
+{
+    StripeRun *run = arg;
+    DecodeInfo *decInfo = run->decInfo;
+    int depth = decInfo->bits_per_pixel ? decInfo->bits_per_pixel : 1;
+    size_t stripe = LSB_ROUND_CHUNK(DECODE_STRIPE_SIZE, depth);
+    size_t chunk_limit = LSB_ROUND_CHUNK(DECODE_CHUNK_SIZE, depth);
+    size_t start = index * stripe;
+    size_t end = (start + stripe < decInfo->secret_file_size) ? start + stripe : decInfo->secret_file_size;
+    BmpInfo *bmp = &decInfo->bmp;
+    size_t base = bmp_carriers_before(bmp, decInfo->image_pos);
+    uint crc = 0;
+    Status status = d_success;
+
+    // No more stripes run at once than there are threads, so a set of buffers is free
+    StripeScratch *scratch = take_scratch(run);
+    if (scratch == NULL)
+        return e_failure;
+
+    // Raw spans are read with pread, dense carriers are gathered from spans with gaps
+    char *decoded_data = scratch->decoded_data;
+    unsigned char *span_buffer = scratch->span_buffer;
+    char *image_buffer = scratch->image_buffer;
+
+    for (size_t i = start; i < end && status == d_success; i += chunk_limit)
+    {
+        size_t chunk = (end - i < chunk_limit) ? end - i : chunk_limit;
+        size_t first = base + lsb_image_bytes(i, depth);
+        size_t count = lsb_image_bytes(chunk, depth);
+        size_t pos = bmp_carrier_end(bmp, first);
+        size_t span_size = bmp_carrier_end(bmp, first + count) - pos;
+        unsigned char *span = span_buffer;
+
+        if (decInfo->stego_map != NULL)
+            span = decInfo->stego_map + pos;
+        else if (read_file_at(fileno(decInfo->fptr_d_stego_image), (char *)span_buffer, span_size, pos) != e_success)
+        {
+            status = d_failure;
+            break;
+        }
+
+        char *image_bytes = (char *)span;
+        if (span_size != count)
+        {
+            bmp_gather(bmp, first, count, span, (unsigned char *)image_buffer);
+            image_bytes = image_buffer;
+        }
+
+        // In-memory output is decoded straight to its place
+        char *decoded = decInfo->in_memory ? decInfo->output + i : decoded_data;
+        decode_bytes_from_lsb_depth(image_bytes, chunk, decoded, depth);
+        crc = crc32c(crc, decoded, chunk);
+        if (decInfo->encrypted)
+            chacha20_payload_xor(&decInfo->cipher, i, decoded, decoded, chunk);
+        if (decInfo->in_memory)
+            continue;
+
+        if (i + chunk == decInfo->secret_file_size)
+        {
+            memcpy(run->tail, decoded_data, chunk);
+            run->tail_offset = i;
+            run->tail_size = chunk;
+        }
+        else if (write_file_at(fileno(decInfo->fptr_decoded), decoded_data, chunk, i) != e_success)
+            status = d_failure;
+    }
+    run->pieces[index].crc = crc;
+    run->pieces[index].size = end - start;
+
+    // Mapped pages of this stripe are no longer needed, caller buffers are left alone
+    release_stripe_pages(decInfo, base + lsb_image_bytes(start, depth), base + lsb_image_bytes(end, depth));
+    return_scratch(run, scratch);
+
+    // The thread pool expects encoder style status values
+    return (status == d_success) ? e_success : e_failure;
+}
+
+/* Decode scattered stripe
+*Input: DecodeInfo Structure (with the scatter map set) and stripe index
+Output: Decodes the tiles of one stripe of SCATTER_STRIPE_TILES tiles
+Description: Tile t starts at carrier t * tile_size past the first data carrier and
+holds the secret bytes given by scatter_tile_range, which are written with pwrite at
+their offset of the output file. Tiles without secret bytes are not read. As with
+consecutive stripes, the CRC goes to the stripe's piece and the last tile of the
+secret is kept in the tail.
+*/
+static Status decode_scattered_stripe(void *arg, size_t index)
+{
+    StripeRun *run = arg;
+    DecodeInfo *decInfo = run->decInfo;
+    ScatterMap *map = &decInfo->scatter;
+    BmpInfo *bmp = &decInfo->bmp;
+    size_t base = bmp_carriers_before(bmp, decInfo->image_pos);
+    size_t first_tile = index * SCATTER_STRIPE_TILES;
+    size_t end_tile = (first_tile + SCATTER_STRIPE_TILES < map->num_tiles) ? first_tile + SCATTER_STRIPE_TILES : map->num_tiles;
+    Crc32cPiece piece = { 0, 0 };
+    Status status = d_success;
+
+    StripeScratch *scratch = take_scratch(run);
+    if (scratch == NULL)
+        return e_failure;
+
+    for (size_t tile = first_tile; tile < end_tile && status == d_success; tile++)
+    {
+        size_t start, end;
+        scatter_tile_range(map, tile, &start, &end);
+        if (start == end)
+            continue;
+
+        size_t first = base + tile * map->tile_size;
+        size_t pos = bmp_carrier_end(bmp, first);
+        size_t span_size = bmp_carrier_end(bmp, first + map->tile_size) - pos;
+        unsigned char *span = scratch->span_buffer;
+
+        if (decInfo->stego_map != NULL)
+            span = decInfo->stego_map + pos;
+        else if (read_file_at(fileno(decInfo->fptr_d_stego_image), (char *)span, span_size, pos) != e_success)
+        {
+            status = d_failure;
+            break;
+        }
+
+        unsigned char *carriers = span;
+        if (span_size != map->tile_size)
+        {
+            bmp_gather(bmp, first, map->tile_size, span, (unsigned char *)scratch->image_buffer);
+            carriers = (unsigned char *)scratch->image_buffer;
+        }
+
+        // In-memory output is decoded straight to its place
+        char *decoded = decInfo->in_memory ? decInfo->output + start : scratch->decoded_data;
+        scatter_decode_tile(map, tile, carriers, decoded, scratch->scatter);
+        piece.crc = crc32c(piece.crc, decoded, end - start);
+        piece.size += end - start;
+        if (decInfo->encrypted)
+            chacha20_payload_xor(&decInfo->cipher, start, decoded, decoded, end - start);
+        if (decInfo->in_memory)
+            continue;
+
+        if (end == map->size)
+        {
+            memcpy(run->tail, decoded, end - start);
+            run->tail_offset = start;
+            run->tail_size = end - start;
+        }
+        else if (write_file_at(fileno(decInfo->fptr_decoded), decoded, end - start, start) != e_success)
+            status = d_failure;
+    }
+    run->pieces[index] = piece;
+
+    release_stripe_pages(decInfo, base + first_tile * map->tile_size, base + end_tile * map->tile_size);
+    return_scratch(run, scratch);
+    return (status == d_success) ? e_success : e_failure;
+}
+
+/* Decode secret file data in parallel
+*Input: Size of secret file data and DecodeInfo Structure
+Output: Decodes the secret file data
+Description: The offset of every secret byte is known once the size is decoded, so the
+payload is split into DECODE_STRIPE_SIZE stripes decoded by num_threads threads, each
+writing its own range of the output file. Scattered data is split into stripes of
+SCATTER_STRIPE_TILES tiles. The CRCs of the stripes are joined and checked before the
+last chunk is written.
+*/
+Status decode_secret_file_data_parallel(size_t size, DecodeInfo *decInfo)
+{
+    int depth = decInfo->bits_per_pixel ? decInfo->bits_per_pixel : 1;
+    size_t stripe = LSB_ROUND_CHUNK(DECODE_STRIPE_SIZE, depth);
+
+    // Check the whole payload is there before starting the workers
+    size_t image_size = decInfo->map_size;
+    if (decInfo->stego_map == NULL)
+    {
+        struct stat st;
+        if (fstat(fileno(decInfo->fptr_d_stego_image), &st) != 0)
+            return d_failure;
+        image_size = st.st_size;
+    }
+    size_t last = bmp_carriers_before(&decInfo->bmp, decInfo->image_pos) + (decInfo->scattered ?
+                  decInfo->scatter.num_tiles * decInfo->scatter.tile_size : lsb_image_bytes(size, depth));
+    if (last > bmp_capacity(&decInfo->bmp) || bmp_carrier_end(&decInfo->bmp, last) > image_size)
+    {
+        fprintf(stderr, "Error: Failed to read from stego image\n");
+        return d_failure;
+    }
+
+    decInfo->secret_file_size = size;
+    if (decInfo->in_memory ? reserve_output(decInfo, size) != d_success :
+        (fflush(decInfo->fptr_decoded) != 0 || ftruncate(fileno(decInfo->fptr_decoded), size) != 0))
+    {
+        fprintf(stderr, "Error: Failed to write to %s\n", decInfo->decoded_fname);
+        return d_failure;
+    }
+
+    // One set of stripe buffers per thread, from the arena of the decoding
+    BmpInfo *bmp = &decInfo->bmp;
+    int dense = (bmp->pixel_bytes == 4 || bmp->row_stride != bmp->row_carriers);
+    size_t num_stripes = decInfo->scattered ? (decInfo->scatter.num_tiles + SCATTER_STRIPE_TILES - 1) / SCATTER_STRIPE_TILES
+                                            : ((size_t)size + stripe - 1) / stripe;
+    StripeRun run = { decInfo, PTHREAD_MUTEX_INITIALIZER, NULL, NULL, NULL, 0, 0 };
+    run.pieces = arena_alloc(&decInfo->arena, (num_stripes + 1) * sizeof(Crc32cPiece));
+    run.tail = decInfo->in_memory ? NULL : arena_alloc(&decInfo->arena, DECODE_CHUNK_SIZE);
+    if (run.pieces == NULL || (!decInfo->in_memory && run.tail == NULL))
+    {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return d_failure;
+    }
+    for (int t = 0; t < decInfo->num_threads && (size_t)t < num_stripes; t++)
+    {
+        StripeScratch *scratch = arena_alloc(&decInfo->arena, sizeof(StripeScratch));
+        if (scratch != NULL)
+        {
+            memset(scratch, 0, sizeof(*scratch));
+            if (!decInfo->in_memory)
+                scratch->decoded_data = arena_alloc(&decInfo->arena, DECODE_CHUNK_SIZE);
+            if (decInfo->stego_map == NULL)
+                scratch->span_buffer = arena_alloc(&decInfo->arena, bmp_span_limit(bmp, 8 * DECODE_CHUNK_SIZE));
+            if (dense)
+                scratch->image_buffer = arena_alloc(&decInfo->arena, 8 * DECODE_CHUNK_SIZE);
+            if (decInfo->scattered)
+                scratch->scatter = arena_alloc(&decInfo->arena, sizeof(ScatterScratch));
+        }
+        if (scratch == NULL || (!decInfo->in_memory && !scratch->decoded_data) ||
+            (decInfo->stego_map == NULL && !scratch->span_buffer) || (dense && !scratch->image_buffer) ||
+            (decInfo->scattered && !scratch->scatter))
+        {
+            fprintf(stderr, "Error: Memory allocation failed\n");
+            return d_failure;
+        }
+        scratch->next = run.free_scratch;
+        run.free_scratch = scratch;
     }
 
-    // Write the decoded secret data to the output file
-    fwrite(decoded_data, sizeof(char), size, decInfo->fptr_decoded);
+    Status status = run_parallel(decInfo->num_threads, num_stripes, decInfo->scattered ? decode_scattered_stripe : decode_secret_stripe, &run);
+    pthread_mutex_destroy(&run.lock);
+    if (status != e_success)
+    {
+        fprintf(stderr, "Error: Failed to decode %s\n", decInfo->decoded_fname);
+        return d_failure;
+    }
 
-    // Free the allocated memory for secret data
-    free(decoded_data);
+    // A corrupt payload never gets its last chunk, its output file is removed
+    if (check_payload_crc(decInfo, crc32c_join(run.pieces, num_stripes)) != d_success)
+        return d_failure;
+    if (run.tail_size > 0 && write_file_at(fileno(decInfo->fptr_decoded), run.tail, run.tail_size, run.tail_offset) != e_success)
+    {
+        fprintf(stderr, "Error: Failed to write to %s\n", decInfo->decoded_fname);
+        return d_failure;
+    }
 
-    return d_success; 
+    decInfo->image_pos = bmp_carrier_end(&decInfo->bmp, last);
+    if (decInfo->in_memory)
+        decInfo->output_size = size;
+    return d_success;
 }
 
 
@@ -323,34 +1453,64 @@ and finally retrive the embedded secret file messages.
 */
 Status do_decoding(DecodeInfo *decInfo)
 {
+    //Everything the previous decoding allocated is released at once
+    arena_reset(&decInfo->arena);
+    decInfo->d_data = NULL;
+    decInfo->span_buffer = NULL;
+    decInfo->span_buffer_size = 0;
+    decInfo->range_data = NULL;
+    decInfo->range_image = NULL;
+    decInfo->range_scratch = NULL;
+
     //Calling functions for decoding
-    if (open_files_for_decoding(decInfo) == d_success)
+    if (RUN_STAGE(decInfo, "open_files", open_files_for_decoding(decInfo)) == d_success)
     {
-        printf("Successfully opened all the files\n");
+        STAGE_MSG(decInfo, "Successfully opened all the files\n");
 	
-        if (decode_magic_string(decInfo) == d_success)
+        if (RUN_STAGE(decInfo, "decode_magic_string", decode_magic_string(decInfo)) == d_success)
         {
-            printf("Magic string decoded successfully\n");
+            STAGE_MSG(decInfo, "Magic string decoded successfully\n");
 	     
-            if (decode_secret_file_extn_size(decInfo) == d_success)
+            if (RUN_STAGE(decInfo, "decode_secret_file_extn_size", decode_secret_file_extn_size(decInfo)) == d_success)
             {
-                printf("Decoded secret file extension size successfully\n");
+                STAGE_MSG(decInfo, "Decoded secret file extension size successfully\n");
 
-                if (decode_secret_file_extn(decInfo) == d_success)
+                if (RUN_STAGE(decInfo, "decode_secret_file_extn", decode_secret_file_extn(decInfo)) == d_success)
                 {
-                    printf("Decoded secret file extension successfully\n");
+                    STAGE_MSG(decInfo, "Decoded secret file extension successfully\n");
 
-                    if (decode_secret_file_size(decInfo) == d_success)
+                    if (RUN_STAGE(decInfo, "decode_secret_file_size", decode_secret_file_size(decInfo)) == d_success)
                     {
-                        printf("Decoded secret file size successfully\n");
+                        STAGE_MSG(decInfo, "Decoded secret file size successfully\n");
 
-                        if (decode_secret_file_data(decInfo -> secret_file_size, decInfo) == d_success)
+                        if (RUN_STAGE(decInfo, "decode_secret_file_cipher", decode_secret_file_cipher(decInfo)) == d_success)
                         {
-                            printf("Decoded secret file data successfully\n");
+                            if (decInfo->encrypted)
+                                STAGE_MSG(decInfo, "Derived the key of the secret data successfully\n");
+
+                            if (RUN_STAGE(decInfo, "decode_secret_file_crc", decode_secret_file_crc(decInfo)) == d_success)
+                            {
+                                STAGE_MSG(decInfo, "Decoded secret file CRC successfully\n");
+
+                                if (RUN_STAGE(decInfo, "decode_secret_file_data", decode_secret_file_data(decInfo -> secret_file_size, decInfo)) == d_success)
+                                {
+                                    STAGE_MSG(decInfo, "Decoded secret file data successfully\n");
+                                }
+                                else
+                                {
+                                    printf("ERROR: Failed to decode secret file data\n");
+                                    return d_failure;
+                                }
+                            }
+                            else
+                            {
+                                printf("ERROR: Failed to decode secret file CRC\n");
+                                return d_failure;
+                            }
                         }
                         else
                         {
-                            printf("ERROR: Failed to decode secret file data\n");
+                            printf("ERROR: Failed to derive the key of the secret data\n");
                             return d_failure;
                         }
                     }
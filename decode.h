@@ -2,6 +2,11 @@
 #define DECODE_H
 
 #include "types.h" // Contains user defined types
+#include "stats.h"
+#include "bmp.h"
+#include "arena.h"
+#include "scatter.h"
+#include "chacha20.h"
 #include <string.h>
 
 /* 
@@ -11,9 +16,14 @@
  * also stored
  */
 
-#define MAX_SECRET_BUF_SIZE 1
+#define MAX_SECRET_BUF_SIZE 1024
 #define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
 
+/* Secret file data is decoded and written in chunks of this size */
+#define DECODE_CHUNK_SIZE (64 * 1024)
+
+/* Secret bytes per stripe of the multi-threaded decoder */
+#define DECODE_STRIPE_SIZE (1024 * 1024)
 
 typedef struct _DecodeInfo
 {
@@ -22,14 +32,66 @@ typedef struct _DecodeInfo
     FILE *fptr_d_stego_image;
     char decode_image_data[MAX_IMAGE_BUF_SIZE];
     char *d_data;
-   
+
+    /* Memory mapped stego image (NULL when falling back to stdio) */
+    unsigned char *stego_map;
+    size_t map_size;
+    size_t image_pos;
+    BmpInfo bmp;
 
     /* Output File Info */
     char *decoded_fname;
     FILE *fptr_decoded;
 
     /* Secret File Info */
-    int secret_file_size;
+    size_t secret_file_size;
+    uint header_version;    /* 1 for a 64 bit size field, from the header (see common.h) */
+    uint bits_per_pixel;    /* LSBs per image byte of the secret data, from the header */
+    int compressed;         /* Secret data is an LZ stream, from the header */
+    int scattered;          /* Secret data is scattered with a key, from the header */
+    int has_crc;            /* The header holds a CRC32C of the secret data */
+    uint payload_crc;       /* that CRC, checked before the end of the data is written */
+    int encrypted;          /* Secret data is encrypted, from the header */
+    ChaCha20Key cipher;     /* key of encrypted secret data */
+    int container;          /* Secret data is a container of files (container.h), from the header */
+    ScatterMap scatter;     /* layout of the scattered secret data */
+
+    /* In-memory decoding (stego.h): no files are opened, stego_map is the
+     * caller's image and the secret goes to output (output_capacity bytes) */
+    int in_memory;
+    char *output;
+    size_t output_capacity;
+    size_t output_size;
+    int output_grow;        /* output is reallocated as needed, the caller frees it */
+
+    /* Decoding options */
+    int num_threads;
+    int quiet;
+    const char *passphrase; /* key of scattered secret data, NULL when not given */
+    const char *cipher_passphrase; /* passphrase of encrypted secret data, NULL when not given */
+    const char *member_name; /* extract only this file of a container, NULL for all of them */
+    int list_only;          /* list the files of a container rather than extracting them */
+    int output_named;       /* decoded_fname was given, the directory of container files then */
+    int slice;              /* decode only slice_length bytes of the secret from slice_offset on */
+    size_t slice_offset;
+    size_t slice_length;    /* SIZE_MAX for the rest of the secret */
+
+    /* Per stage statistics, NULL when not collected */
+    RunStats *stats;
+
+    /* Memory of one decoding (header fields, chunk, stripe and decompressor
+     * buffers), released at the start of the next one and kept for it */
+    Arena arena;
+    unsigned char *span_buffer;     /* stdio spans with padding or alpha bytes */
+    size_t span_buffer_size;
+
+    /* Decoding of payload ranges: carriers in front of the payload, buffers
+     * from the arena and the scattered tile held in range_data */
+    size_t payload_carrier;
+    char *range_data;
+    char *range_image;
+    ScatterScratch *range_scratch;
+    size_t range_tile;
    
    
    
@@ -45,6 +107,15 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo);
 /* Get File pointers for i/p and o/p files */
 Status open_files_for_decoding(DecodeInfo *decInfo);
 
+/* Close the files and mapping of one decoding */
+void close_files_for_decoding(DecodeInfo *decInfo);
+
+/* Free the buffers kept across decodings */
+void release_decode_info(DecodeInfo *decInfo);
+
+/* Get the next n bytes of stego image data */
+char *get_stego_bytes(DecodeInfo *decInfo, char *buffer, size_t n);
+
 /* Decode Magic String */
 Status decode_magic_string(DecodeInfo *decInfo);
 
@@ -57,17 +128,29 @@ Status decode_secret_file_extn(DecodeInfo *decInfo);
 /* Decode secret file size */
 Status decode_secret_file_size(DecodeInfo *decInfo);
 
+/* Decode the salt of encrypted secret data and derive its key */
+Status decode_secret_file_cipher(DecodeInfo *decInfo);
+
+/* Decode the CRC32C of the secret file data */
+Status decode_secret_file_crc(DecodeInfo *decInfo);
+
 /* Decode secret file data */
-Status decode_secret_file_data(int size, DecodeInfo *decInfo);
+Status decode_secret_file_data(size_t size, DecodeInfo *decInfo);
+
+/* Decode secret file data with num_threads threads */
+Status decode_secret_file_data_parallel(size_t size, DecodeInfo *decInfo);
 
 /* Decode function, which does the real decoding */
-Status decode_data_from_image(int size, DecodeInfo *decInfo);
+Status decode_data_from_image(size_t size, DecodeInfo *decInfo);
 
 /* Decode a byte from LSB of image data array */
 char decode_byte_from_lsb(char data, char *image_buffer);
 
 /* Decode the integer from the LSB */
-int decode_size_from_LSB(char *buffer);
+uint decode_size_from_LSB(char *buffer);
+
+/* Decode the 32 or 64 bit size field of a header version */
+uint64_t decode_size_field(char *buffer, uint version);
 
 /* Perform the decoding */
 Status do_decoding(DecodeInfo *decInfo);
@@ -1,33 +1,39 @@
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "encode.h"
 #include "common.h"
 #include "types.h"
+#include "stego_io.h"
+#include "lsb.h"
+#include "thread_pool.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "container.h"
 
 /* Function Definitions */
 
 /* Get image size
- * Input: Image file ptr
- * Output: width * height * bytes per pixel (3 in our case)
- * Description: In BMP Image, width is stored in offset 18,
- * and height after that. size is 4 bytes
+ * Input: Image file ptr, BmpInfo to fill
+ * Output: width * height * 3, the number of carrier bytes, 0 for unsupported images.
+ * The count is a size_t, images of more than 4G carriers included
+ * Description: Parses the BMP headers (24 or 32 bit, bottom-up or
+ * top-down, any DIB header version). Row padding and alpha bytes
+ * are not counted, they are never modified.
  */
-uint get_image_size_for_bmp(FILE *fptr_image)
+size_t get_image_size_for_bmp(FILE *fptr_image, BmpInfo *bmp)
 {
-    uint width, height;
-    // Seek to 18th byte
-    fseek(fptr_image, 18, SEEK_SET);
+    // Seek to the start of the file
+    fseek(fptr_image, 0, SEEK_SET);
 
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-    printf("width = %u\n", width);
-
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
-    printf("height = %u\n", height);
+    // Read the file and DIB headers
+    if (bmp_read_header(fptr_image, bmp) != e_success)
+        return 0;
 
     // Return image capacity
-    return width * height * 3;
+    return bmp_capacity(bmp);
 }
 
 /* 
@@ -39,6 +45,10 @@ uint get_image_size_for_bmp(FILE *fptr_image)
  */
 Status open_files(EncodeInfo *encInfo)
 {
+    // In-memory encodings have their buffers set up by the caller
+    if (encInfo->in_memory)
+        return e_success;
+
     // Src Image file
     encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "rb");
     // Do Error handling
@@ -61,8 +71,10 @@ Status open_files(EncodeInfo *encInfo)
     	return e_failure;
     }
 
-    // Stego Image file
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "wb");
+    // Stego Image file, readable as well when it is a regular file so that it can be mapped
+    struct stat st;
+    int regular = (stat(encInfo->stego_image_fname, &st) != 0 || S_ISREG(st.st_mode));
+    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, regular ? "wb+" : "wb");
     // Do Error handling
     if (encInfo->fptr_stego_image == NULL)
     {
@@ -72,10 +84,252 @@ Status open_files(EncodeInfo *encInfo)
     	return e_failure;
     }
 
+    // Map both images when possible, stdio is the fallback
+    map_image_files(encInfo);
+
     // No failure return e_success
     return e_success;
 }
 
+/*
+Close files
+* Input: EncodeInfo structure
+*Output: Unmaps the images and closes every file that is open
+*Description: Leaves the structure ready for the next encoding, the
+buffers kept across encodings are not freed.
+*/
+void close_files(EncodeInfo *encInfo)
+{
+	unmap_file(encInfo -> src_map, encInfo -> map_size);
+	unmap_file(encInfo -> stego_map, encInfo -> map_size);
+	encInfo -> src_map = NULL;
+	encInfo -> stego_map = NULL;
+
+	if(encInfo -> fptr_src_image != NULL)
+		fclose(encInfo -> fptr_src_image);
+	if(encInfo -> fptr_secret != NULL)
+		fclose(encInfo -> fptr_secret);
+	if(encInfo -> fptr_stego_image != NULL)
+		fclose(encInfo -> fptr_stego_image);
+	encInfo -> fptr_src_image = NULL;
+	encInfo -> fptr_secret = NULL;
+	encInfo -> fptr_stego_image = NULL;
+	free(encInfo -> src_headers);
+	encInfo -> src_headers = NULL;
+}
+
+/*
+Release encode info
+* Input: EncodeInfo structure
+*Output: Frees the buffers kept across encodings
+*/
+void release_encode_info(EncodeInfo *encInfo)
+{
+	free(encInfo -> secret_buffer);
+	free(encInfo -> span_buffer);
+	free(encInfo -> packed_buffer);
+	free(encInfo -> scatter_scratch);
+	encInfo -> secret_buffer = NULL;
+	encInfo -> span_buffer = NULL;
+	encInfo -> span_buffer_size = 0;
+	encInfo -> packed_buffer = NULL;
+	encInfo -> packed_buffer_size = 0;
+	encInfo -> scatter_scratch = NULL;
+}
+
+/*
+Map image files
+* Input: EncodeInfo structure with the src and stego images opened
+*Output: src_map and stego_map set, or both NULL to use stdio
+*Description: Maps the source image read-only and sizes the stego image
+to the same length and maps it writable. Falls back to the FILE pointers
+when either file is not a regular file or cannot be mapped.
+The stego image is first cloned from the source when the filesystem
+supports reflinks; in_place is then set and only the carriers that
+change are written, the headers and the rest of the image stay shared.
+*/
+Status map_image_files(EncodeInfo *encInfo)
+{
+	encInfo -> src_map = NULL;
+	encInfo -> stego_map = NULL;
+	encInfo -> map_size = 0;
+	encInfo -> image_pos = 0;
+	encInfo -> in_place = 0;
+
+	if(map_file_for_reading(encInfo -> fptr_src_image, &encInfo -> src_map, &encInfo -> map_size) != e_success)
+		return e_failure;
+
+	//Clone before mapping, the mapping then sees the cover bytes
+	if(clone_file(fileno(encInfo -> fptr_src_image), fileno(encInfo -> fptr_stego_image), encInfo -> map_size) == e_success)
+		encInfo -> in_place = 1;
+
+	if(map_file_for_writing(encInfo -> fptr_stego_image, encInfo -> map_size, &encInfo -> stego_map) != e_success)
+	{
+		unmap_file(encInfo -> src_map, encInfo -> map_size);
+		encInfo -> src_map = NULL;
+		encInfo -> map_size = 0;
+		encInfo -> in_place = 0;
+		return e_failure;
+	}
+
+	return e_success;
+}
+
+/*
+Get image bytes
+* Input: EncodeInfo structure, scratch buffer and number of carrier bytes
+*Output: Pointer to the next n carrier bytes, NULL if the image is too short
+*Description: The carriers are looked up in the file span that holds them
+(see bmp.h). With mapped images the source span is copied into the stego
+mapping (a cloned stego image already holds it), otherwise it is read from
+the source image. When the span is
+exactly the n carriers (24 bit rows without padding) it is returned as is
+and the LSB functions modify it in place, otherwise the carriers are
+gathered into the buffer and put_image_bytes scatters them back.
+*/
+char *get_image_bytes(EncodeInfo *encInfo, char *buffer, size_t n)
+{
+	BmpInfo *bmp = &encInfo -> bmp;
+	size_t first = bmp_carriers_before(bmp, encInfo -> image_pos);
+
+	if(first + n > bmp_capacity(bmp))
+		return NULL;
+
+	size_t span_size = bmp_carrier_end(bmp, first + n) - encInfo -> image_pos;
+	unsigned char *span;
+
+	if(encInfo -> stego_map != NULL)
+	{
+		if(encInfo -> image_pos + span_size > encInfo -> map_size)
+			return NULL;
+
+		span = encInfo -> stego_map + encInfo -> image_pos;
+		if(!encInfo -> in_place)
+			memcpy(span, encInfo -> src_map + encInfo -> image_pos, span_size);
+	}
+	else
+	{
+		//A span with gaps is read into a buffer of its own
+		if(span_size == n)
+			span = (unsigned char *)buffer;
+		else
+		{
+			if(span_size > encInfo -> span_buffer_size)
+			{
+				unsigned char *grown = realloc(encInfo -> span_buffer, span_size);
+				if(grown == NULL)
+					return NULL;
+				encInfo -> span_buffer = grown;
+				encInfo -> span_buffer_size = span_size;
+			}
+			span = encInfo -> span_buffer;
+		}
+
+		if(fread(span, 1, span_size, encInfo -> fptr_src_image) != span_size)
+			return NULL;
+		stats_count_io(io_read, span_size);
+	}
+
+	encInfo -> span = span;
+	encInfo -> span_size = span_size;
+	encInfo -> span_first = first;
+
+	if(span_size == n)
+		return (char *)span;
+
+	bmp_gather(bmp, first, n, span, (unsigned char *)buffer);
+	return buffer;
+}
+
+/*
+Put image bytes
+* Input: EncodeInfo structure, bytes returned by get_image_bytes and their count
+*Output: e_success or e_failure on write errors
+*Description: Gathered carriers are scattered back into their span. With
+mapped images the span is already in place and only the position advances.
+Otherwise the span is written to the stego image.
+*/
+Status put_image_bytes(EncodeInfo *encInfo, char *image_bytes, size_t n)
+{
+	if((unsigned char *)image_bytes != encInfo -> span)
+		bmp_scatter(&encInfo -> bmp, encInfo -> span_first, n, (unsigned char *)image_bytes, encInfo -> span);
+
+	if(encInfo -> stego_map == NULL)
+	{
+		if(fwrite(encInfo -> span, 1, encInfo -> span_size, encInfo -> fptr_stego_image) != encInfo -> span_size)
+			return e_failure;
+		stats_count_io(io_write, encInfo -> span_size);
+	}
+
+	encInfo -> image_pos += encInfo -> span_size;
+	return e_success;
+}
+
+/*
+Copy image bytes
+* Input: EncodeInfo structure and number of bytes (COPY_TO_EOF for the rest of the image)
+*Output: e_success or e_failure on I/O errors
+*Description: Copies unmodified image bytes from the current position with
+copy_file_data, so the kernel moves the data whenever it can. Both the
+mapped and the stdio positions are advanced past the copied bytes.
+A cloned stego image already shares them, only the position moves.
+Covers read from a pipe are streamed through stdio instead.
+In-memory encodings copy between the buffers.
+*/
+Status copy_image_bytes(EncodeInfo *encInfo, size_t n)
+{
+	off_t offset;
+
+	if(encInfo -> in_place || encInfo -> in_memory)
+	{
+		if(n == COPY_TO_EOF || encInfo -> image_pos + n > encInfo -> map_size)
+			n = encInfo -> map_size - encInfo -> image_pos;
+		if(!encInfo -> in_place)
+			memcpy(encInfo -> stego_map + encInfo -> image_pos, encInfo -> src_map + encInfo -> image_pos, n);
+		encInfo -> image_pos += n;
+		return e_success;
+	}
+
+	//Covers read from a pipe are copied in order through stdio
+	if(encInfo -> src_headers != NULL)
+	{
+		size_t copied;
+		Status status = copy_stream_data(encInfo -> fptr_src_image, encInfo -> fptr_stego_image, n, &copied);
+		encInfo -> image_pos += copied;
+		return status;
+	}
+
+	int src_fd = fileno(encInfo -> fptr_src_image);
+	int stego_fd = fileno(encInfo -> fptr_stego_image);
+
+	if(encInfo -> stego_map != NULL)
+	{
+		//Write through the file descriptor at the mapped position
+		offset = encInfo -> image_pos;
+		if(lseek(stego_fd, offset, SEEK_SET) != offset)
+			return e_failure;
+	}
+	else
+	{
+		//Pending stdio output must reach the file before the copy
+		offset = ftello(encInfo -> fptr_src_image);
+		if(offset < 0 || fflush(encInfo -> fptr_stego_image) != 0)
+			return e_failure;
+	}
+
+	if(copy_file_data(src_fd, offset, stego_fd, n) != e_success)
+		return e_failure;
+
+	if(n == COPY_TO_EOF)
+		n = (encInfo -> stego_map != NULL) ? encInfo -> map_size - offset : (size_t)(lseek(src_fd, 0, SEEK_END) - offset);
+
+	encInfo -> image_pos = offset + n;
+	if(encInfo -> stego_map == NULL)
+		fseeko(encInfo -> fptr_src_image, offset + n, SEEK_SET);
+
+	return e_success;
+}
+
 
 /*
 Read and Validate command line arguments
@@ -91,7 +345,8 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 	}
 	else
 		return e_failure;
-	if(argv[3] != NULL && strcmp(strstr(argv[3], "."), ".txt") == 0)
+	//Containers take files of any type
+	if(argv[3] != NULL && (encInfo -> container || (strstr(argv[3], ".") != NULL && strcmp(strstr(argv[3], "."), ".txt") == 0)))
 	{
 		encInfo -> secret_fname = argv[3]; //Set secret file filename
 	}
@@ -103,10 +358,124 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 	}
 	else
 		encInfo -> stego_image_fname = "stego.bmp";  //Default name if not provided
+	if(encInfo -> bits_per_pixel > LSB_MAX_DEPTH)
+	{
+		fprintf(stderr, "ERROR: Depth must be between 1 and %d bits\n", LSB_MAX_DEPTH);
+		return e_failure;
+	}
 
 return e_success;
 }
 
+/*
+Pack secret files
+* Input: EncodeInfo structure with the secret file open
+*Output: fptr_secret refers to the container of the files, e_failure on I/O errors
+*Description: When container is set the secret file and more_files are packed
+into an anonymous temporary file behind their index (see container.h), which
+then takes the place of the secret file like a compressed secret does.
+*/
+Status pack_secret_files(EncodeInfo *encInfo)
+{
+	off_t size;
+
+	if(!encInfo -> container)
+		return e_success;
+	if(encInfo -> in_memory)
+	{
+		fprintf(stderr, "ERROR: Containers are made from files\n");
+		return e_failure;
+	}
+
+	char **files = malloc((encInfo -> num_more_files + 1) * sizeof(char *));
+	FILE *fptr_packed = tmpfile();
+	if(files == NULL || fptr_packed == NULL)
+	{
+		perror("tmpfile");
+		free(files);
+		if(fptr_packed != NULL)
+			fclose(fptr_packed);
+		return e_failure;
+	}
+	files[0] = encInfo -> secret_fname;
+	for(int i = 0; i < encInfo -> num_more_files; i++)
+		files[i + 1] = encInfo -> more_files[i];
+
+	Status status = container_pack(files, encInfo -> num_more_files + 1, encInfo -> compress, fptr_packed, &size);
+	free(files);
+	if(status != e_success)
+	{
+		fclose(fptr_packed);
+		return e_failure;
+	}
+
+	//The temporary file is deleted when close_files closes it
+	fclose(encInfo -> fptr_secret);
+	encInfo -> fptr_secret = fptr_packed;
+	STAGE_MSG(encInfo, "Packed %d files into a container of %lld bytes\n", encInfo -> num_more_files + 1, (long long)size);
+	return e_success;
+}
+
+/*
+Compress secret file
+* Input: EncodeInfo structure with the secret file open
+*Output: fptr_secret refers to the compressed secret, e_failure on I/O errors
+*Description: When compress is set the secret is compressed block by block
+into an anonymous temporary file, which then takes the place of the
+secret file: capacity check and embedding (sequential or striped)
+simply see a smaller secret. In-memory secrets are compressed into
+packed_buffer instead. The files of a container are compressed one by
+one when it is packed, so that each can be extracted on its own.
+*/
+Status compress_secret_file(EncodeInfo *encInfo)
+{
+	off_t size, compressed_size;
+
+	if(!encInfo -> compress || encInfo -> container)
+		return e_success;
+
+	if(encInfo -> in_memory)
+	{
+		size_t bound = LZ_COMPRESS_BOUND((size_t)encInfo -> size_secret_file);
+		if(bound > encInfo -> packed_buffer_size)
+		{
+			unsigned char *grown = realloc(encInfo -> packed_buffer, bound);
+			if(grown == NULL)
+				return e_failure;
+			encInfo -> packed_buffer = grown;
+			encInfo -> packed_buffer_size = bound;
+		}
+
+		size_t secret_size = encInfo -> size_secret_file;
+		encInfo -> size_secret_file = lz_compress_buffer((const unsigned char *)encInfo -> secret_bytes, secret_size, encInfo -> packed_buffer);
+		encInfo -> secret_bytes = (const char *)encInfo -> packed_buffer;
+		STAGE_MSG(encInfo, "Compressed secret file from %zu to %zu bytes\n", secret_size, encInfo -> size_secret_file);
+		return e_success;
+	}
+
+	FILE *fptr_packed = tmpfile();
+	if(fptr_packed == NULL)
+	{
+		perror("tmpfile");
+		return e_failure;
+	}
+
+	size = get_file_size(encInfo -> fptr_secret);
+	fseek(encInfo -> fptr_secret, 0, SEEK_SET);
+	if(lz_compress_file(encInfo -> fptr_secret, size, fptr_packed, &compressed_size) != e_success || fflush(fptr_packed) != 0)
+	{
+		fprintf(stderr, "ERROR: Failed to compress %s\n", encInfo -> secret_fname);
+		fclose(fptr_packed);
+		return e_failure;
+	}
+
+	//The temporary file is deleted when close_files closes it
+	fclose(encInfo -> fptr_secret);
+	encInfo -> fptr_secret = fptr_packed;
+	STAGE_MSG(encInfo, "Compressed secret file from %lld to %lld bytes\n", (long long)size, (long long)compressed_size);
+	return e_success;
+}
+
 /* 
 Check capacity
 Input: EncodeInfo Structure
@@ -116,13 +485,44 @@ Description: Check if the image can hold the secret data
 Status check_capacity(EncodeInfo *encInfo)
 {
 	//Size of source image (beautiful.bmp)
-	encInfo -> image_capacity = get_image_size_for_bmp(encInfo -> fptr_src_image);  
+	if(encInfo -> in_memory)
+		encInfo -> image_capacity = (bmp_parse_header(encInfo -> src_map, (encInfo -> map_size < BMP_MAX_HEADER_SIZE) ? encInfo -> map_size : BMP_MAX_HEADER_SIZE, &encInfo -> bmp) == e_success) ? bmp_capacity(&encInfo -> bmp) : 0;
+	else if(ftello(encInfo -> fptr_src_image) < 0)
+		//Covers that cannot seek (pipes) are read once, their headers are kept for copy_bmp_header
+		encInfo -> image_capacity = (bmp_read_header_bytes(encInfo -> fptr_src_image, &encInfo -> bmp, &encInfo -> src_headers) == e_success) ? bmp_capacity(&encInfo -> bmp) : 0;
+	else
+		encInfo -> image_capacity = get_image_size_for_bmp(encInfo -> fptr_src_image, &encInfo -> bmp);  
+	if(encInfo -> image_capacity == 0)
+	{
+		fprintf(stderr, "ERROR: %s is not an uncompressed 24 or 32 bit BMP image\n", encInfo -> src_image_fname);
+		return e_failure;
+	}
+	STAGE_MSG(encInfo, "Image capacity = %zu bytes\n", encInfo -> image_capacity);
 
-	//Size of secret file (secret.txt)
-	encInfo -> size_secret_file = get_file_size(encInfo -> fptr_secret);  
+	//Size of secret file (secret.txt), in-memory secrets come with their size
+	if(!encInfo -> in_memory)
+	{
+		off_t file_size = get_file_size(encInfo -> fptr_secret);
+		if(file_size < 0)
+			return e_failure;
+		encInfo -> size_secret_file = file_size;
+	}
 	
-	//Check capacity
-	if(encInfo -> image_capacity > (54 + 16 + 32 + 32 + 32 + (encInfo -> size_secret_file * 8))) 
+	//Header fields use 1 bit per carrier byte, the secret data the selected depth;
+	//the extension is empty for containers, so it must be counted as encoded
+	size_t header_bytes = 8 * strlen(MAGIC_STRING) + 32 + 8 * strlen(encInfo -> extn_secret_file) + HEADER_SIZE_CARRIERS(HEADER_VERSION) + 32;
+	if(encInfo -> cipher_passphrase != NULL)
+		header_bytes += 8 * CHACHA20_SALT_SIZE + 32;
+	if(encInfo -> image_capacity < header_bytes)
+		return e_failure;
+
+	//Scattered data needs whole groups in every tile of the carriers after the header
+	if(encInfo -> passphrase != NULL)
+		return scatter_init(&encInfo -> scatter, scatter_key(encInfo -> passphrase), encInfo -> image_capacity - header_bytes,
+				    encInfo -> size_secret_file, get_embed_depth(encInfo));
+
+	//Check capacity, the BMP headers are not part of it; compared in payload bytes, so it cannot overflow
+	if(encInfo -> size_secret_file <= lsb_payload_capacity(encInfo -> image_capacity - header_bytes, get_embed_depth(encInfo))) 
 		return e_success;
 	else
 		return e_failure;
@@ -133,41 +533,56 @@ Get File Size
 * Input: FILE pointer to secret file
 *Output: Size of the file in bytes
 *Description: Moves the file pointer to the end of the file,
-and then uses ftell to get the current position, which is the file size.
+and then uses ftello to get the current position, which is the file size.
+The size is an off_t, files of more than 4 GB included.
 */
 
-uint get_file_size(FILE *fptr_secret)
+off_t get_file_size(FILE *fptr_secret)
 {
 	//Move to end of the file
-	fseek(fptr_secret, 0, SEEK_END); 
+	fseeko(fptr_secret, 0, SEEK_END); 
 
 	//Get the size of the file
-	ftell(fptr_secret);
+	return ftello(fptr_secret);
 
 }
 
 /*
 Copy BMP Header
-* Input: FILE pointer for the source and stego images
+* Input: EncodeInfo structure
 *Output: Copies the BMP header from the source image to the stego image
-*Description: Reads the first 54 bytes (BMP header) from the
-source image and writes them to the stego image. 
+*Description: Copies everything in front of the pixel array (file and
+DIB headers, masks, color table) from the source image to the stego image. 
+The headers of a cover read from a pipe come from check_capacity.
 */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_stego_image)
+Status copy_bmp_header(EncodeInfo *encInfo)
 {
-	//Buffer to hold the header (54 bytes for BMP)
-	char headerstr[54];
+	//Covers read from a pipe are past their headers, check_capacity kept them
+	if(encInfo -> src_headers != NULL)
+	{
+		encInfo -> image_pos = encInfo -> bmp.data_offset;
+		if(fwrite(encInfo -> src_headers, 1, encInfo -> bmp.data_offset, encInfo -> fptr_stego_image) != encInfo -> bmp.data_offset)
+		{
+			fprintf(stderr, "Error: Failed to copy the BMP header\n");
+			return e_failure;
+		}
+		stats_count_io(io_write, encInfo -> bmp.data_offset);
+		return e_success;
+	}
 
 	//Move to the start of the source image 
-	fseek(fptr_src_image, 0, SEEK_SET);
-
-	//Reader header into the buffer
-	fread(headerstr, 1, 54, fptr_src_image);
+	if(!encInfo -> in_memory)
+		fseek(encInfo -> fptr_src_image, 0, SEEK_SET);
+	encInfo -> image_pos = 0;
 
-	//Write the header to the stego image
-	fwrite(headerstr,1, 54, fptr_stego_image);
+	//Copy the headers up to the pixel array to the stego image
+	if(copy_image_bytes(encInfo, encInfo -> bmp.data_offset) != e_success)
+	{
+		fprintf(stderr, "Error: Failed to copy the BMP header\n");
+		return e_failure;
+	}
 
-return e_success;
+	return e_success;
 }
 
 
@@ -187,33 +602,96 @@ Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
 
 
 /*
-Encode data to image
-* Input: Data to encode, size of the data, and EncodeInfo structure
+Encode data to image at depth
+* Input: Data to encode, size of the data, depth and EncodeInfo structure
 *Output: e_success or e_failure based on encoding success
-*Description: Encodes each byte of data into the LSBs of the image buffer. 
+*Description: Encodes the data into the low depth bits of the image bytes,
+MAX_SECRET_BUF_SIZE bytes (rounded to whole depth groups) per pass.
 */
-Status encode_data_to_image(const char *data, int size, EncodeInfo *encInfo)
+static Status encode_depth_to_image(const char *data, size_t size, int depth, EncodeInfo *encInfo)
 {
-	for(int i =0; i < size; i++)
+	size_t pass = LSB_ROUND_CHUNK(MAX_SECRET_BUF_SIZE, depth);
+
+	for(size_t i = 0; i < size; i += pass)
 	{
-	//Read 8 bytes of image data(RGB pixel data) one at a time encoding
-	size_t bytes_read = fread(encInfo -> image_data, 1, 8, encInfo -> fptr_src_image);
+	size_t chunk = (size - i < pass) ? size - i : pass;
+	size_t n = lsb_image_bytes(chunk, depth);
+
+	//Get the image data(BGR carrier bytes) that carries the chunk
+	char *image_bytes = get_image_bytes(encInfo, encInfo -> image_data, n);
    	
 	//Do error handling
-   	if(bytes_read != 8)
+   	if(image_bytes == NULL)
    	{
-		fprintf(stderr, "Error: Failed to read 8 bytes of data from beautiful.bmp\n");
+		fprintf(stderr, "Error: Failed to read %zu bytes of data from %s\n", n, encInfo -> src_image_fname);
 		return e_failure;
    	}
 
-	//Call function to encode 1 byte of data into the LSBs
-	encode_byte_to_lsb(data[i], encInfo -> image_data); 
+	//Call function to encode the data into the LSBs
+	encode_bytes_to_lsb_depth(data + i, chunk, image_bytes, depth); 
 
 	//write the encoded bytes back to stego.bmp
-	fwrite(encInfo -> image_data, 1, 8, encInfo -> fptr_stego_image);
+	if(put_image_bytes(encInfo, image_bytes, n) != e_success)
+		return e_failure;
 	}
 	return e_success;	
+}
+
+/*
+Encode data to image
+* Input: Data to encode, size of the data, and EncodeInfo structure
+*Output: e_success or e_failure based on encoding success
+*Description: Encodes each byte of data into the LSBs of 8 image bytes,
+the layout of every header field.
+*/
+Status encode_data_to_image(const char *data, size_t size, EncodeInfo *encInfo)
+{
+	return encode_depth_to_image(data, size, 1, encInfo);
+}
+
+/*
+Encode payload to image
+* Input: Secret data, its size and EncodeInfo structure
+*Output: e_success or e_failure based on encoding success
+*Description: Encodes the secret data at the depth chosen in bits_per_pixel
+and adds it to payload_crc. Pieces of one secret must be multiples of
+LSB_GROUP_BYTES, except the last, and come in order. Encrypted data is
+encrypted piece by piece into secret_data right before it is encoded, and
+the CRC covers what is embedded.
+*/
+Status encode_payload_to_image(const char *data, size_t size, EncodeInfo *encInfo)
+{
+	int depth = get_embed_depth(encInfo);
+
+	if(encInfo -> cipher_passphrase == NULL)
+	{
+		encInfo -> payload_crc = crc32c(encInfo -> payload_crc, data, size);
+		return encode_depth_to_image(data, size, depth, encInfo);
+	}
+
+	//Encrypted pieces stay in the L1 cache until the LSB kernel reads them
+	size_t piece = LSB_ROUND_CHUNK(MAX_SECRET_BUF_SIZE, depth);
+	for(size_t i = 0; i < size; i += piece)
+	{
+		size_t n = (size - i < piece) ? size - i : piece;
+
+		chacha20_payload_xor(&encInfo -> cipher, encInfo -> payload_pos, data + i, encInfo -> secret_data, n);
+		encInfo -> payload_pos += n;
+		encInfo -> payload_crc = crc32c(encInfo -> payload_crc, encInfo -> secret_data, n);
+		if(encode_depth_to_image(encInfo -> secret_data, n, depth, encInfo) != e_success)
+			return e_failure;
+	}
+	return e_success;
+}
 
+/*
+Get embed depth
+* Input: EncodeInfo structure
+*Output: Bits per image byte used for the secret data, 1 when bits_per_pixel is not set
+*/
+int get_embed_depth(const EncodeInfo *encInfo)
+{
+	return encInfo -> bits_per_pixel ? encInfo -> bits_per_pixel : 1;
 }
 
 /*
@@ -242,35 +720,44 @@ Encode secret file extension size
 * Input: Size of the secret file extension and EncodeInfo structure
 *Output: Encodes the size into the LSBs of the BMP image
 *Description: Reads 32 bytes from the source image and encodes the 
-secret file extension size into the LSBs of these bytes. 
+secret file extension size into the LSBs of these bytes. The option
+bits above the size (see common.h) record the depth of the data.
 */
 Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
 {
 	
-	char str[32];
+	char buffer[32];
 	
 	//Read 32 bytes from the source image to encode the size
-	size_t bytes_read = fread(str, 1, 32,  encInfo -> fptr_src_image);
+	char *str = get_image_bytes(encInfo, buffer, 32);
    	
 	//Do error handling
-   	if(bytes_read != 32)
+   	if(str == NULL)
    	{
 		fprintf(stderr, "Error: Failed to read 32 bytes for secret file extension size\n");
 		return e_failure;
    	}
 
-	//Call function to encode the size into LSBs
-	encode_size_to_LSB(size, str);
+	//Options share the field with the size
+	uint field = size | (get_embed_depth(encInfo) - 1) << HEADER_DEPTH_SHIFT | HEADER_CRC | HEADER_VERSION << HEADER_VERSION_SHIFT;
+	if(encInfo -> compress)
+		field |= HEADER_COMPRESSED;
+	if(encInfo -> passphrase != NULL)
+		field |= HEADER_SCATTERED;
+	if(encInfo -> cipher_passphrase != NULL)
+		field |= HEADER_ENCRYPTED;
+	if(encInfo -> container)
+		field |= HEADER_CONTAINER;
 
-	if(encode_size_to_LSB(size, str) != e_success)
+	//Call function to encode the size into LSBs
+	if(encode_size_to_LSB(field, str) != e_success)
 	{
 		fprintf(stderr,"ERROR: Failed to encode size to LSB\n");
 		return e_failure;
 	}
 	
 	//Write the encoded size to the stego image
-	fwrite(str, 1, 32,  encInfo -> fptr_stego_image);
-	return e_success;
+	return put_image_bytes(encInfo, str, 32);
 }
 
 
@@ -308,14 +795,11 @@ to hide the size.
 */
 Status encode_size_to_LSB(unsigned int size, char *image_buffer)
 {
-	for(int i = 0; i < 32; i++)
-	{	
+	//Most significant byte first, same bit order as the data bytes
+	char size_bytes[4] = { size >> 24, size >> 16, size >> 8, size };
 
-	//'image_buffer[i] & 0xFE' - clears the LSB (set to zero)
-	//'(size >> (31 - i)) & 1)' - extracts the i-th bit from size to be stored
-	// '|' (bitwise OR) sets the LSB to new value
-		image_buffer[i] = (image_buffer[i] & 0xFE | ((size >> (31 - i)) & 1));
-	}
+	//Each size byte goes to the LSBs of 8 image bytes
+	encode_bytes_to_lsb(size_bytes, 4, image_buffer);
 
 	return e_success;
 }
@@ -324,122 +808,612 @@ Status encode_size_to_LSB(unsigned int size, char *image_buffer)
 Encode secret file size
 * Input: Size of the secret file and EncodeInfo Structure
 *Output: Encodes the secret file size into the stego image
-*Description: Reads the 32 bytes from the source image(beautiful.bmp) and encodes 
-the size of the secret file into the LSBs of these bytes.
+*Description: Reads the 64 bytes from the source image(beautiful.bmp) and encodes 
+the 64 bit size of the secret file (header version 1) into the LSBs of these bytes,
+high 32 bits first.
 */
-Status encode_secret_file_size(long int file_size, EncodeInfo *encInfo)
+Status encode_secret_file_size(size_t file_size, EncodeInfo *encInfo)
 {
 	
-	char str[32];
+	char buffer[HEADER_SIZE_CARRIERS(HEADER_VERSION)];
+	uint64_t size = file_size;
 
-	//Read 32 bytes from source image to encode file size
-	fread(str, 1, 32, encInfo -> fptr_src_image);
+	//Read 64 bytes from source image to encode file size
+	char *str = get_image_bytes(encInfo, buffer, sizeof(buffer));
+	if(str == NULL)
+	{
+		fprintf(stderr, "Error: Failed to read %zu bytes for secret file size\n", sizeof(buffer));
+		return e_failure;
+	}
 
 	//Call function to encode the size into the string using LSB method
-	encode_size_to_LSB(file_size, str);
+	encode_size_to_LSB(size >> 32, str);
+	encode_size_to_LSB(size, str + 32);
 
 	//Write the encoded file size back to the stego image
-	fwrite(str, 1, 32, encInfo -> fptr_stego_image);
+	return put_image_bytes(encInfo, str, sizeof(buffer));
+}
 
+/*
+Encode 32 bit field
+* Input: Value, name of the field for errors and EncodeInfo structure
+*Output: Encodes the value into the next 32 image bytes
+*/
+static Status encode_32bit_field(uint value, const char *name, EncodeInfo *encInfo)
+{
+	char buffer[32];
+
+	char *str = get_image_bytes(encInfo, buffer, 32);
+	if(str == NULL)
+	{
+		fprintf(stderr, "Error: Failed to read 32 bytes for secret file %s\n", name);
+		return e_failure;
+	}
+
+	encode_size_to_LSB(value, str);
+	return put_image_bytes(encInfo, str, 32);
+}
+
+/*
+Encode secret file cipher
+* Input: EncodeInfo structure
+*Output: Encodes the salt and the key check value of encrypted secret data
+*Description: Every image gets a random salt, so one passphrase gives a
+different key in every image. The key check value lets the decoder reject
+a wrong passphrase before it extracts anything.
+*/
+Status encode_secret_file_cipher(EncodeInfo *encInfo)
+{
+	unsigned char salt[CHACHA20_SALT_SIZE];
+
+	if(encInfo -> cipher_passphrase == NULL)
+		return e_success;
+
+	if(chacha20_new_salt(salt) != e_success)
+	{
+		fprintf(stderr, "ERROR: Failed to get random bytes for the salt\n");
+		return e_failure;
+	}
+	chacha20_key_from_passphrase(&encInfo -> cipher, encInfo -> cipher_passphrase, salt);
+
+	if(encode_data_to_image((char *)salt, CHACHA20_SALT_SIZE, encInfo) != e_success)
+	{
+		fprintf(stderr, "ERROR: Failed to encode the salt\n");
+		return e_failure;
+	}
+	return encode_32bit_field(chacha20_key_check(&encInfo -> cipher), "key check", encInfo);
+}
+
+/*
+Compute secret file CRC
+* Input: EncodeInfo structure with the secret file open
+*Output: CRC32C of the secret file in header_crc, e_failure on read errors
+*Description: Reads the secret once more, from the page cache in practice.
+Encrypted secrets are encrypted for the CRC as they will be embedded.
+*/
+static Status compute_secret_file_crc(EncodeInfo *encInfo)
+{
+	size_t n;
+
+	if(encInfo -> secret_buffer == NULL && (encInfo -> secret_buffer = malloc(SECRET_CHUNK_SIZE)) == NULL)
+		return e_failure;
+
+	fseek(encInfo -> fptr_secret, 0, SEEK_SET);
+	encInfo -> header_crc = 0;
+	for(size_t i = 0; i < encInfo -> size_secret_file; i += n)
+	{
+		n = (encInfo -> size_secret_file - i < SECRET_CHUNK_SIZE) ? encInfo -> size_secret_file - i : SECRET_CHUNK_SIZE;
+		if(fread(encInfo -> secret_buffer, 1, n, encInfo -> fptr_secret) != n)
+		{
+			fprintf(stderr, "ERROR: Failed to read %s\n", encInfo -> secret_fname);
+			return e_failure;
+		}
+		stats_count_io(io_read, n);
+		if(encInfo -> cipher_passphrase != NULL)
+			chacha20_payload_xor(&encInfo -> cipher, i, encInfo -> secret_buffer, encInfo -> secret_buffer, n);
+		encInfo -> header_crc = crc32c(encInfo -> header_crc, encInfo -> secret_buffer, n);
+	}
 	return e_success;
 }
 
 /*
-Encode secret file data
+Encode secret file CRC
+* Input: EncodeInfo structure
+*Output: Encodes the CRC32C of the secret data into the stego image
+*Description: The CRC is computed while the data is embedded. Mapped (and
+in-memory) stego images get a placeholder whose offset is kept, and the
+field is filled in once the data is embedded. Images written through
+stdio cannot go back, their CRC is computed from the secret file first.
+*/
+Status encode_secret_file_crc(EncodeInfo *encInfo)
+{
+	encInfo -> crc_field_pos = 0;
+	encInfo -> header_crc = 0;
+
+	if(encInfo -> stego_map != NULL)
+		encInfo -> crc_field_pos = encInfo -> image_pos;
+	else if(compute_secret_file_crc(encInfo) != e_success)
+		return e_failure;
+
+	return encode_32bit_field(encInfo -> header_crc, "CRC", encInfo);
+}
+
+/*
+Embed secret file data
 * Input: EncodeInfo structure
 *Output: Encodes the secret file data into the stego image
-*Description: Reads the entire secret file and encodes its content
-into the stego image using LSB method.
+*Description: Streams the secret file through two SECRET_CHUNK_SIZE
+buffers: a reader thread fills one while the other is encoded into
+the stego image using LSB method, so memory use does not depend on
+the size of the secret file.
 */
-Status encode_secret_file_data(EncodeInfo *encInfo)
+static Status embed_secret_file_data(EncodeInfo *encInfo)
 {
+	ChunkReader reader;
+	char *chunk;
+	long chunk_size;
+
+	//Scattered data goes tile by tile over the whole image
+	if(encInfo -> passphrase != NULL)
+		return encode_secret_file_data_scattered(encInfo);
+
+	//Stripes can be encoded in parallel when both images are mapped
+	if(encInfo -> num_threads > 1 && encInfo -> stego_map != NULL)
+		return encode_secret_file_data_parallel(encInfo);
+
+	//An in-memory secret is encoded where it is
+	if(encInfo -> in_memory)
+		return encode_payload_to_image(encInfo -> secret_bytes, encInfo -> size_secret_file, encInfo);
+
 	//Move to the start of the secret file
 	fseek(encInfo -> fptr_secret, 0, SEEK_SET); 
 
-	//String to hold secret file data, size is determined by the secret file size
-	char str[encInfo -> size_secret_file]; 
+	//A secret that fits in one chunk is read directly into the reusable buffer
+	if(encInfo -> size_secret_file <= SECRET_CHUNK_SIZE)
+	{
+		if(encInfo -> secret_buffer == NULL && (encInfo -> secret_buffer = malloc(SECRET_CHUNK_SIZE)) == NULL)
+			return e_failure;
 
-	//Read the entire secret fule data into the string
-	fread(str, 1, encInfo -> size_secret_file, encInfo -> fptr_secret); 
+		if(fread(encInfo -> secret_buffer, 1, encInfo -> size_secret_file, encInfo -> fptr_secret) != encInfo -> size_secret_file)
+		{
+			fprintf(stderr, "ERROR: Failed to read %s\n", encInfo -> secret_fname);
+			return e_failure;
+		}
+		stats_count_io(io_read, encInfo -> size_secret_file);
+		return encode_payload_to_image(encInfo -> secret_buffer, encInfo -> size_secret_file, encInfo);
+	}
+
+	//Start reading the secret file data in chunks
+	//Chunks are whole depth groups so they encode back to back
+	size_t chunk_limit = LSB_ROUND_CHUNK(SECRET_CHUNK_SIZE, get_embed_depth(encInfo));
+	if(chunk_reader_start(&reader, encInfo -> fptr_secret, encInfo -> size_secret_file, chunk_limit) != e_success)
+	{
+		fprintf(stderr, "ERROR: Unable to start reading %s\n", encInfo -> secret_fname);
+		return e_failure;
+	}
+
+	//Encode each chunk while the next one is being read
+	Status status = e_success;
+	while(status == e_success && (chunk_size = chunk_reader_next(&reader, &chunk)) > 0)
+		status = encode_payload_to_image(chunk, chunk_size, encInfo);
 
-	//Call function to encode the secret file data into the image
-	encode_data_to_image(str, strlen(str), encInfo);
+	chunk_reader_stop(&reader);
 
-	return e_success; 
+	if(status == e_success && chunk_size != 0)
+	{
+		fprintf(stderr, "ERROR: Failed to read %s\n", encInfo -> secret_fname);
+		return e_failure;
+	}
+	return status; 
 }
 
 /*
-Copy remaining image data from source to stego image
+Encode secret file data
 * Input: EncodeInfo structure
-*Output: Success status
-*Description: Copy the remaining image data from beautiful.bmp
-to stego image.
+*Output: Encodes the secret file data into the stego image
+*Description: Embeds the data and then completes the CRC field: a placeholder
+is overwritten with the CRC of the data embedded, a CRC computed beforehand
+must match it, or the secret file changed in between.
 */
-Status copy_remaining_img_data(EncodeInfo *encInfo)
+Status encode_secret_file_data(EncodeInfo *encInfo)
 {
-	char ch;
+	encInfo -> payload_crc = 0;
+	encInfo -> payload_pos = 0;
+	if(embed_secret_file_data(encInfo) != e_success)
+		return e_failure;
 
-	//Read and copy the rest of the image data byte by byte
-	while(fread(&ch, 1, 1, encInfo -> fptr_src_image) > 0)
+	if(encInfo -> crc_field_pos == 0)
 	{
-		fwrite(&ch, 1, 1, encInfo -> fptr_stego_image);
+		if(encInfo -> payload_crc == encInfo -> header_crc)
+			return e_success;
+		fprintf(stderr, "ERROR: %s changed while it was being encoded\n", encInfo -> secret_fname);
+		return e_failure;
 	}
 
-        
+	size_t image_pos = encInfo -> image_pos;
+	encInfo -> image_pos = encInfo -> crc_field_pos;
+	Status status = encode_32bit_field(encInfo -> payload_crc, "CRC", encInfo);
+	encInfo -> image_pos = image_pos;
+	return status;
+}
+
+/*
+Encode secret stripe
+* Input: EncodeInfo structure and stripe index
+*Output: Encodes one stripe of secret bytes starting at index * stripe size
+*Description: Stripes and chunks are whole depth groups, so secret byte i
+of a chunk start goes to carrier lsb_image_bytes(i, depth) past the first
+data carrier and stripes are independent. The secret is read with pread
+(in-memory secrets are used where they are), encrypted into the chunk when
+it is encrypted, and the carrier span of each
+chunk is modified in the stego mapping, through a dense buffer when the
+span has padding or alpha bytes.
+*/
+static Status encode_secret_stripe(void *arg, size_t index)
+{
+	EncodeInfo *encInfo = arg;
+	BmpInfo *bmp = &encInfo -> bmp;
+	int depth = get_embed_depth(encInfo);
+	size_t stripe = LSB_ROUND_CHUNK(STRIPE_SIZE, depth);
+	size_t chunk_limit = LSB_ROUND_CHUNK(SECRET_CHUNK_SIZE, depth);
+	size_t start = index * stripe;
+	size_t end = (start + stripe < encInfo -> size_secret_file) ? start + stripe : encInfo -> size_secret_file;
+	size_t base = bmp_carriers_before(bmp, encInfo -> image_pos);
+	unsigned char *dense = NULL;
+	uint crc = 0;
+	Status status = e_success;
+
+	//Secret files are read into the chunk, encrypted data is encrypted into it
+	char *chunk = NULL;
+	if((!encInfo -> in_memory || encInfo -> cipher_passphrase != NULL) && (chunk = malloc(SECRET_CHUNK_SIZE)) == NULL)
+		return e_failure;
+
+	for(size_t i = start; i < end; i += chunk_limit)
+	{
+		size_t n = (end - i < chunk_limit) ? end - i : chunk_limit;
+		size_t first = base + lsb_image_bytes(i, depth);
+		size_t count = lsb_image_bytes(n, depth);
+		size_t pos = bmp_carrier_end(bmp, first);
+		size_t span_size = bmp_carrier_end(bmp, first + count) - pos;
+		unsigned char *span = encInfo -> stego_map + pos;
+
+		const char *data = encInfo -> in_memory ? encInfo -> secret_bytes + i : chunk;
+		if(!encInfo -> in_memory && read_file_at(fileno(encInfo -> fptr_secret), chunk, n, i) != e_success)
+		{
+			status = e_failure;
+			break;
+		}
+		if(encInfo -> cipher_passphrase != NULL)
+		{
+			chacha20_payload_xor(&encInfo -> cipher, i, data, chunk, n);
+			data = chunk;
+		}
+		crc = crc32c(crc, data, n);
+
+		//Copy the cover bytes (unless cloned) and encode the chunk into them
+		if(!encInfo -> in_place)
+			memcpy(span, encInfo -> src_map + pos, span_size);
+		if(span_size == count)
+		{
+			encode_bytes_to_lsb_depth(data, n, (char *)span, depth);
+			continue;
+		}
+
+		if(dense == NULL && (dense = malloc(lsb_image_bytes(chunk_limit, depth))) == NULL)
+		{
+			status = e_failure;
+			break;
+		}
+		bmp_gather(bmp, first, count, span, dense);
+		encode_bytes_to_lsb_depth(data, n, (char *)dense, depth);
+		bmp_scatter(bmp, first, count, dense, span);
+	}
+
+	encInfo -> crc_pieces[index].crc = crc;
+	encInfo -> crc_pieces[index].size = end - start;
+	free(dense);
+	free(chunk);
+	return status;
+}
+
+/*
+Encode secret file data in parallel
+* Input: EncodeInfo structure with mapped images
+*Output: Encodes the secret file data into the stego image
+*Description: Splits the secret into STRIPE_SIZE stripes which
+num_threads threads encode independently. The result is byte for
+byte the same as the single threaded encoder. Every stripe computes
+the CRC of its own bytes, the CRCs are then joined into payload_crc.
+*/
+Status encode_secret_file_data_parallel(EncodeInfo *encInfo)
+{
+	size_t size = encInfo -> size_secret_file;
+	int depth = get_embed_depth(encInfo);
+	size_t stripe = LSB_ROUND_CHUNK(STRIPE_SIZE, depth);
+	size_t last = bmp_carriers_before(&encInfo -> bmp, encInfo -> image_pos) + lsb_image_bytes(size, depth);
+
+	if(last > bmp_capacity(&encInfo -> bmp) || bmp_carrier_end(&encInfo -> bmp, last) > encInfo -> map_size)
+	{
+		fprintf(stderr, "ERROR: %s is too small for %s\n", encInfo -> src_image_fname, encInfo -> secret_fname);
+		return e_failure;
+	}
+
+	size_t num_stripes = (size + stripe - 1) / stripe;
+	if((encInfo -> crc_pieces = calloc(num_stripes + 1, sizeof(Crc32cPiece))) == NULL)
+		return e_failure;
+
+	Status status = run_parallel(encInfo -> num_threads, num_stripes, encode_secret_stripe, encInfo);
+	encInfo -> payload_crc = crc32c_join(encInfo -> crc_pieces, num_stripes);
+	free(encInfo -> crc_pieces);
+	encInfo -> crc_pieces = NULL;
+	if(status != e_success)
+	{
+		fprintf(stderr, "ERROR: Failed to read %s\n", encInfo -> secret_fname);
+		return e_failure;
+	}
+
+	encInfo -> image_pos = bmp_carrier_end(&encInfo -> bmp, last);
 	return e_success;
 }
 
+/*
+Encode scattered stripe
+* Input: EncodeInfo structure and stripe index
+*Output: Encodes the tiles of one stripe of SCATTER_STRIPE_TILES tiles
+*Description: Tile t starts at carrier t * tile_size past the first data
+carrier and holds the secret bytes given by scatter_tile_range, so stripes
+are independent. The span of each tile is copied into the stego mapping
+(unless cloned) and encoded there, through the dense carriers of the
+scratch area when the span has padding or alpha bytes.
+*/
+static Status encode_scattered_stripe(void *arg, size_t index)
+{
+	EncodeInfo *encInfo = arg;
+	BmpInfo *bmp = &encInfo -> bmp;
+	ScatterMap *map = &encInfo -> scatter;
+	size_t base = bmp_carriers_before(bmp, encInfo -> image_pos);
+	size_t end_tile = (index + 1) * SCATTER_STRIPE_TILES;
+	Crc32cPiece piece = { 0, 0 };
+	Status status = e_success;
+
+	if(end_tile > map -> num_tiles)
+		end_tile = map -> num_tiles;
+
+	ScatterScratch *scratch = malloc(sizeof(ScatterScratch));
+	int copy = !encInfo -> in_memory || encInfo -> cipher_passphrase != NULL;
+	char *chunk = copy ? malloc(SCATTER_TILE) : NULL;
+	if(scratch == NULL || (chunk == NULL && copy))
+	{
+		free(scratch);
+		free(chunk);
+		return e_failure;
+	}
+
+	for(size_t tile = index * SCATTER_STRIPE_TILES; tile < end_tile; tile++)
+	{
+		size_t start, end;
+		size_t first = base + tile * map -> tile_size;
+		size_t pos = bmp_carrier_end(bmp, first);
+		size_t span_size = bmp_carrier_end(bmp, first + map -> tile_size) - pos;
+		unsigned char *span = encInfo -> stego_map + pos;
+
+		scatter_tile_range(map, tile, &start, &end);
+		const char *data = encInfo -> in_memory ? encInfo -> secret_bytes + start : chunk;
+		if(!encInfo -> in_memory && read_file_at(fileno(encInfo -> fptr_secret), chunk, end - start, start) != e_success)
+		{
+			status = e_failure;
+			break;
+		}
+		if(encInfo -> cipher_passphrase != NULL)
+		{
+			chacha20_payload_xor(&encInfo -> cipher, start, data, chunk, end - start);
+			data = chunk;
+		}
+		piece.crc = crc32c(piece.crc, data, end - start);
+		piece.size += end - start;
+
+		//Copy the cover bytes (unless cloned) and encode the tile into them
+		if(!encInfo -> in_place)
+			memcpy(span, encInfo -> src_map + pos, span_size);
+		if(span_size == map -> tile_size)
+		{
+			scatter_encode_tile(map, tile, data, span, scratch);
+			continue;
+		}
+
+		bmp_gather(bmp, first, map -> tile_size, span, scratch -> carriers);
+		scatter_encode_tile(map, tile, data, scratch -> carriers, scratch);
+		bmp_scatter(bmp, first, map -> tile_size, scratch -> carriers, span);
+	}
+
+	encInfo -> crc_pieces[index] = piece;
+	free(scratch);
+	free(chunk);
+	return status;
+}
+
+/*
+Encode secret file data scattered
+* Input: EncodeInfo structure with the scatter map set by check_capacity
+*Output: Encodes the secret file data over the tiles of the image
+*Description: Tiles are taken in file order through get_image_bytes and
+put_image_bytes like the chunks of the consecutive layout, each with the
+slice of the secret it holds, read sequentially. With mapped images and
+several threads, stripes of tiles are encoded in parallel instead; the
+result is the same.
+*/
+Status encode_secret_file_data_scattered(EncodeInfo *encInfo)
+{
+	ScatterMap *map = &encInfo -> scatter;
+	size_t last = bmp_carriers_before(&encInfo -> bmp, encInfo -> image_pos) + map -> num_tiles * map -> tile_size;
+
+	if(encInfo -> num_threads > 1 && encInfo -> stego_map != NULL)
+	{
+		if(bmp_carrier_end(&encInfo -> bmp, last) > encInfo -> map_size)
+		{
+			fprintf(stderr, "ERROR: %s is too small for %s\n", encInfo -> src_image_fname, encInfo -> secret_fname);
+			return e_failure;
+		}
+
+		size_t num_stripes = (map -> num_tiles + SCATTER_STRIPE_TILES - 1) / SCATTER_STRIPE_TILES;
+		if((encInfo -> crc_pieces = calloc(num_stripes + 1, sizeof(Crc32cPiece))) == NULL)
+			return e_failure;
+
+		Status status = run_parallel(encInfo -> num_threads, num_stripes, encode_scattered_stripe, encInfo);
+		encInfo -> payload_crc = crc32c_join(encInfo -> crc_pieces, num_stripes);
+		free(encInfo -> crc_pieces);
+		encInfo -> crc_pieces = NULL;
+		if(status != e_success)
+		{
+			fprintf(stderr, "ERROR: Failed to read %s\n", encInfo -> secret_fname);
+			return e_failure;
+		}
+
+		encInfo -> image_pos = bmp_carrier_end(&encInfo -> bmp, last);
+		return e_success;
+	}
+
+	if(encInfo -> scatter_scratch == NULL && (encInfo -> scatter_scratch = malloc(sizeof(ScatterScratch))) == NULL)
+		return e_failure;
+	if((!encInfo -> in_memory || encInfo -> cipher_passphrase != NULL) && encInfo -> secret_buffer == NULL &&
+	   (encInfo -> secret_buffer = malloc(SECRET_CHUNK_SIZE)) == NULL)
+		return e_failure;
+	if(!encInfo -> in_memory)
+		fseek(encInfo -> fptr_secret, 0, SEEK_SET);
+
+	for(size_t tile = 0; tile < map -> num_tiles; tile++)
+	{
+		size_t start, end;
+		scatter_tile_range(map, tile, &start, &end);
+
+		//Every tile holds at most SCATTER_TILE / 2 secret bytes
+		const char *data = encInfo -> in_memory ? encInfo -> secret_bytes + start : encInfo -> secret_buffer;
+		if(!encInfo -> in_memory)
+		{
+			if(fread(encInfo -> secret_buffer, 1, end - start, encInfo -> fptr_secret) != end - start)
+			{
+				fprintf(stderr, "ERROR: Failed to read %s\n", encInfo -> secret_fname);
+				return e_failure;
+			}
+			stats_count_io(io_read, end - start);
+		}
+		if(encInfo -> cipher_passphrase != NULL)
+		{
+			chacha20_payload_xor(&encInfo -> cipher, start, data, encInfo -> secret_buffer, end - start);
+			data = encInfo -> secret_buffer;
+		}
+		encInfo -> payload_crc = crc32c(encInfo -> payload_crc, data, end - start);
+
+		char *carriers = get_image_bytes(encInfo, (char *)encInfo -> scatter_scratch -> carriers, map -> tile_size);
+		if(carriers == NULL)
+		{
+			fprintf(stderr, "Error: Failed to read %zu bytes of data from %s\n", map -> tile_size, encInfo -> src_image_fname);
+			return e_failure;
+		}
+
+		scatter_encode_tile(map, tile, data, (unsigned char *)carriers, encInfo -> scatter_scratch);
+
+		if(put_image_bytes(encInfo, carriers, map -> tile_size) != e_success)
+			return e_failure;
+	}
+	return e_success;
+}
+
+/*
+Copy remaining image data from source to stego image
+* Input: EncodeInfo structure
+*Output: Success status
+*Description: Copy the remaining image data from beautiful.bmp
+to stego image without passing it through user space.
+*/
+Status copy_remaining_img_data(EncodeInfo *encInfo)
+{
+	//Copy the rest of the image data up to the end of the file
+	return copy_image_bytes(encInfo, COPY_TO_EOF);
+}
+
 
 /*Perform the encoding
 * Input: EncodeInfo structure
 *Output: Executes a series of encoding operations
 *Description: Opens the necessary files, checks capacity, 
 copies the BMP header, encodes the magic string, secret file size,
-extension, and data and finally copies the remaining image data.
+extension, salt, CRC and data and finally copies the remaining image data.
 
 */
 
 Status do_encoding(EncodeInfo *encInfo)
 {
 	//Calling functions for encoding
-	if(open_files(encInfo) == e_success)
+	if(RUN_STAGE(encInfo, "open_files", open_files(encInfo)) == e_success)
 	{
-		printf("Successfully opened all the files\n");
-		if(check_capacity(encInfo) == e_success)
+		STAGE_MSG(encInfo, "Successfully opened all the files\n");
+		if(RUN_STAGE(encInfo, "pack_secret_files", pack_secret_files(encInfo)) != e_success)
+		{
+			printf("ERROR : Failed to pack the secret files\n");
+			return e_failure;
+		}
+		if(RUN_STAGE(encInfo, "compress_secret_file", compress_secret_file(encInfo)) != e_success)
+		{
+			printf("ERROR : Failed to compress the secret file\n");
+			return e_failure;
+		}
+		//Containers keep the names of their files in the index
+		strcpy(encInfo -> extn_secret_file, encInfo -> container ? "" : strstr(encInfo -> secret_fname, "."));
+		if(RUN_STAGE(encInfo, "check_capacity", check_capacity(encInfo)) == e_success)
 		{
-			printf("Check capacity is successful\n");
-			if(copy_bmp_header(encInfo ->fptr_src_image, encInfo -> fptr_stego_image) == e_success)
+			STAGE_MSG(encInfo, "Check capacity is successful\n");
+			if(RUN_STAGE(encInfo, "copy_bmp_header", copy_bmp_header(encInfo)) == e_success)
 			{
-				printf("Copy bmp header is successful\n");
-				if(encode_magic_string(MAGIC_STRING, encInfo) == e_success)
+				STAGE_MSG(encInfo, "Copy bmp header is successful\n");
+				if(RUN_STAGE(encInfo, "encode_magic_string", encode_magic_string(MAGIC_STRING, encInfo)) == e_success)
 				{
-					printf("Magic string encoded successfully\n");
-					strcpy(encInfo -> extn_secret_file, strstr(encInfo -> secret_fname, "."));
-					if(encode_secret_file_extn_size(strlen(encInfo -> extn_secret_file), encInfo) == e_success)
+					STAGE_MSG(encInfo, "Magic string encoded successfully\n");
+					if(RUN_STAGE(encInfo, "encode_secret_file_extn_size", encode_secret_file_extn_size(strlen(encInfo -> extn_secret_file), encInfo)) == e_success)
 					{
-						printf("Encoding secret file extension size is successful\n");
-						if(encode_secret_file_extn(encInfo -> extn_secret_file, encInfo) == e_success)
+						STAGE_MSG(encInfo, "Encoding secret file extension size is successful\n");
+						if(RUN_STAGE(encInfo, "encode_secret_file_extn", encode_secret_file_extn(encInfo -> extn_secret_file, encInfo)) == e_success)
 						{
-							printf("Encoded secret file extension successfully\n");
-							if(encode_secret_file_size(encInfo -> size_secret_file, encInfo) == e_success)
+							STAGE_MSG(encInfo, "Encoded secret file extension successfully\n");
+							if(RUN_STAGE(encInfo, "encode_secret_file_size", encode_secret_file_size(encInfo -> size_secret_file, encInfo)) == e_success)
 							{
-								printf("Encoded secret file size successfully\n");
-								if(encode_secret_file_data(encInfo) == e_success)
+								STAGE_MSG(encInfo, "Encoded secret file size successfully\n");
+								if(RUN_STAGE(encInfo, "encode_secret_file_cipher", encode_secret_file_cipher(encInfo)) == e_success)
 								{
-									printf("Encoded secret file data successfully\n");
-									if(copy_remaining_img_data(encInfo) == e_success)
+									if(encInfo -> cipher_passphrase != NULL)
+										STAGE_MSG(encInfo, "Encoded secret file salt successfully\n");
+									if(RUN_STAGE(encInfo, "encode_secret_file_crc", encode_secret_file_crc(encInfo)) == e_success)
 									{
-										printf("Copied remaining bytes successfully\n");	
+										STAGE_MSG(encInfo, "Encoded secret file CRC successfully\n");
+										if(RUN_STAGE(encInfo, "encode_secret_file_data", encode_secret_file_data(encInfo)) == e_success)
+										{
+											STAGE_MSG(encInfo, "Encoded secret file data successfully\n");
+											if(RUN_STAGE(encInfo, "copy_remaining_img_data", copy_remaining_img_data(encInfo)) == e_success)
+											{
+												STAGE_MSG(encInfo, "Copied remaining bytes successfully\n");
+											}
+											else
+											{
+												printf("Failed to copy remaining bytes\n");
+												return e_failure;
+											}
+										}
+										else
+										{
+											printf("ERROR : Failed to encode secret file data\n");
+											return e_failure;
+										}
 									}
 									else
 									{
-										printf("Failed to copy remaining bytes\n");
+										printf("ERROR : Failed to encode secret file CRC\n");
 										return e_failure;
 									}
 								}
 								else
 								{
-									printf("ERROR : Failed to encode secret file data\n");
+									printf("ERROR : Failed to encode secret file salt\n");
+									return e_failure;
 								}
 							}
 							else
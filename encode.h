@@ -2,7 +2,13 @@
 #define ENCODE_H
 
 #include "types.h" // Contains user defined types
+#include "stats.h"
+#include "bmp.h"
+#include "scatter.h"
+#include "crc32c.h"
+#include "chacha20.h"
 #include <string.h>
+#include <sys/types.h>
 
 /* 
  * Structure to store information required for
@@ -11,30 +17,93 @@
  * also stored
  */
 
-#define MAX_SECRET_BUF_SIZE 1
+#define MAX_SECRET_BUF_SIZE 1024
 #define MAX_IMAGE_BUF_SIZE (MAX_SECRET_BUF_SIZE * 8)
 #define MAX_FILE_SUFFIX 4
 
+/* Secret file data is read and encoded in chunks of this size */
+#define SECRET_CHUNK_SIZE (64 * 1024)
+
+/* Secret bytes per stripe of the multi-threaded encoder */
+#define STRIPE_SIZE (1024 * 1024)
+
 typedef struct _EncodeInfo
 {
     /* Source Image info */
     char *src_image_fname;
     FILE *fptr_src_image;
-    uint image_capacity;
-    uint bits_per_pixel;
+    unsigned char *src_headers; /* headers of a cover read from a pipe, kept for copy_bmp_header */
+    size_t image_capacity;  /* carrier bytes */
+    uint bits_per_pixel;    /* LSBs per image byte used for the secret data, 0 means 1 */
     char image_data[MAX_IMAGE_BUF_SIZE];
+    BmpInfo bmp;
 
     /* Secret File Info */
     char *secret_fname;
     FILE *fptr_secret;
-    char extn_secret_file[MAX_FILE_SUFFIX];
+    char extn_secret_file[MAX_FILE_SUFFIX + 1];
     char secret_data[MAX_SECRET_BUF_SIZE];
-    long size_secret_file;
+    size_t size_secret_file;
 
     /* Stego Image Info */
     char *stego_image_fname;
     FILE *fptr_stego_image;
 
+    /* Memory mapped images (NULL when falling back to stdio) */
+    unsigned char *src_map;
+    unsigned char *stego_map;
+    size_t map_size;
+    size_t image_pos;
+    int in_place;           /* stego image is a clone of the source, only the payload is written */
+
+    /* File span of the carriers handed out by get_image_bytes */
+    unsigned char *span;
+    size_t span_size;
+    size_t span_first;
+
+    /* In-memory encoding (stego.h): no files are opened, src_map and
+     * stego_map are caller buffers and the secret is secret_bytes */
+    int in_memory;
+    const char *secret_bytes;
+
+    /* Encoding options */
+    int num_threads;
+    int quiet;
+    int compress;
+    const char *passphrase; /* scatter the secret data with this key (scatter.h), NULL for consecutive carriers */
+    ScatterMap scatter;     /* layout of the scattered secret data, set by check_capacity */
+    int container;          /* embed a container of files (container.h), the secret file first */
+    char **more_files;      /* files of the container after the secret file */
+    int num_more_files;
+
+    /* CRC32C of the secret data (crc32c.h) */
+    uint payload_crc;       /* accumulated while the data is embedded */
+    uint header_crc;        /* value of the CRC field */
+    size_t crc_field_pos;   /* offset of a CRC field written before its value was known, 0 if none */
+    Crc32cPiece *crc_pieces; /* CRC of every stripe of a parallel encoder */
+
+    /* Encryption of the secret data (chacha20.h) */
+    const char *cipher_passphrase; /* encrypt the secret data with this passphrase, NULL to embed it as is */
+    ChaCha20Key cipher;     /* key derived from the passphrase and the salt of the image */
+    size_t payload_pos;     /* secret bytes embedded so far by the sequential encoder */
+
+    /* Per stage statistics, NULL when not collected */
+    RunStats *stats;
+
+    /* Buffer kept across jobs for secrets of up to SECRET_CHUNK_SIZE bytes */
+    char *secret_buffer;
+
+    /* Buffer kept across jobs for stdio spans with padding or alpha bytes */
+    unsigned char *span_buffer;
+    size_t span_buffer_size;
+
+    /* Buffer kept across in-memory encodings for the compressed secret */
+    unsigned char *packed_buffer;
+    size_t packed_buffer_size;
+
+    /* Work area kept across scattered encodings */
+    ScatterScratch *scatter_scratch;
+
 } EncodeInfo;
 
 
@@ -52,17 +121,41 @@ Status do_encoding(EncodeInfo *encInfo);
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Replace the secret file by the container of the files when container is set */
+Status pack_secret_files(EncodeInfo *encInfo);
+
+/* Replace the secret file by its compressed stream when compress is set */
+Status compress_secret_file(EncodeInfo *encInfo);
+
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
-/* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
+/* Parse the BMP headers and get the number of carrier bytes */
+size_t get_image_size_for_bmp(FILE *fptr_image, BmpInfo *bmp);
 
 /* Get file size */
-uint get_file_size(FILE *fptr);
+off_t get_file_size(FILE *fptr);
+
+/* Close the files and mappings of one encoding */
+void close_files(EncodeInfo *encInfo);
+
+/* Free the buffers kept across encodings */
+void release_encode_info(EncodeInfo *encInfo);
+
+/* Map src and stego images when both are regular files */
+Status map_image_files(EncodeInfo *encInfo);
 
 /* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_stego_image);
+Status copy_bmp_header(EncodeInfo *encInfo);
+
+/* Get the next n carrier bytes of image data ready to be modified */
+char *get_image_bytes(EncodeInfo *encInfo, char *buffer, size_t n);
+
+/* Store n modified carrier bytes to the stego image */
+Status put_image_bytes(EncodeInfo *encInfo, char *image_bytes, size_t n);
+
+/* Copy n unmodified bytes of image data to the stego image */
+Status copy_image_bytes(EncodeInfo *encInfo, size_t n);
 
 
 /* Store Magic String */
@@ -75,13 +168,31 @@ Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 
 /* Encode secret file size */
-Status encode_secret_file_size(long int file_size, EncodeInfo *encInfo);
+Status encode_secret_file_size(size_t file_size, EncodeInfo *encInfo);
+
+/* Encode the salt and key check of encrypted secret data */
+Status encode_secret_file_cipher(EncodeInfo *encInfo);
+
+/* Encode the CRC32C of the secret file data */
+Status encode_secret_file_crc(EncodeInfo *encInfo);
 
 /* Encode secret file data*/
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
+/* Encode secret file data with num_threads threads */
+Status encode_secret_file_data_parallel(EncodeInfo *encInfo);
+
+/* Encode secret file data scattered over the tiles of the image */
+Status encode_secret_file_data_scattered(EncodeInfo *encInfo);
+
 /* Encode function, which does the real encoding */
-Status encode_data_to_image(const char *data, int size, EncodeInfo *encInfo);
+Status encode_data_to_image(const char *data, size_t size, EncodeInfo *encInfo);
+
+/* Encode secret data at the depth set in bits_per_pixel */
+Status encode_payload_to_image(const char *data, size_t size, EncodeInfo *encInfo);
+
+/* Depth used for the secret data */
+int get_embed_depth(const EncodeInfo *encInfo);
 
 /* Encode a byte into LSB of image data array */
 Status encode_byte_to_lsb(char data, char *image_buffer);
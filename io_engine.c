@@ -0,0 +1,434 @@
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "io_engine.h"
+#include "stats.h"
+#include "types.h"
+
+/* io_uring without liburing: the system calls and the ring layout of the kernel headers */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+/* IORING_OP_READ and IORING_OP_WRITE came with this feature flag (Linux 5.6) */
+#if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+/* Function Definitions */
+
+/*
+Complete step
+* Input: Request and the result of one transfer (bytes or -errno)
+*Output: 1 once the request is finished, 0 when the rest must be transferred
+*Description: Regular files only return short at the end of file, which
+ends the request with EIO as it asked for bytes that are not there.
+*/
+static int complete_step(IoRequest *request, long result)
+{
+	if(request -> size == 0)
+		return 1;
+	if(result <= 0)
+	{
+		request -> error = (result < 0) ? -result : EIO;
+		return 1;
+	}
+
+	stats_count_io(request -> write ? io_write : io_read, result);
+	request -> done += result;
+	return request -> done == request -> size;
+}
+
+/* Bytes of the next transfer of a request */
+static size_t step_size(const IoRequest *request)
+{
+	size_t n = request -> size - request -> done;
+	return (n < IO_ENGINE_MAX_TRANSFER) ? n : IO_ENGINE_MAX_TRANSFER;
+}
+
+/* Append a request to a list */
+static void append_request(IoRequest **head, IoRequest **tail, IoRequest *request)
+{
+	request -> next = NULL;
+	if(*tail != NULL)
+		(*tail) -> next = request;
+	else
+		*head = request;
+	*tail = request;
+}
+
+/* Remove the first request of a list */
+static IoRequest *pop_request(IoRequest **head, IoRequest **tail)
+{
+	IoRequest *request = *head;
+	if(request != NULL && (*head = request -> next) == NULL)
+		*tail = NULL;
+	return request;
+}
+
+#ifdef HAVE_IO_URING
+
+/*
+Ring init
+* Input: Ring and the number of submission entries
+*Output: Rings mapped, e_failure when io_uring is missing, disabled or too old
+*/
+static Status ring_init(IoRing *ring, unsigned entries)
+{
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof(params));
+	ring -> fd = syscall(__NR_io_uring_setup, entries, &params);
+	if(ring -> fd < 0)
+		return e_failure;
+	if(!(params.features & IORING_FEAT_RW_CUR_POS))
+	{
+		close(ring -> fd);
+		ring -> fd = -1;
+		return e_failure;
+	}
+
+	ring -> entries = params.sq_entries;
+	ring -> sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring -> cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring -> sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	//Both rings share one mapping on kernels with IORING_FEAT_SINGLE_MMAP
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(ring -> cq_ring_size > ring -> sq_ring_size)
+			ring -> sq_ring_size = ring -> cq_ring_size;
+		ring -> cq_ring_size = 0;
+	}
+
+	ring -> sq_ring = mmap(NULL, ring -> sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring -> fd, IORING_OFF_SQ_RING);
+	ring -> cq_ring = ring -> cq_ring_size ? mmap(NULL, ring -> cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                                            ring -> fd, IORING_OFF_CQ_RING) : ring -> sq_ring;
+	ring -> sqes = mmap(NULL, ring -> sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring -> fd, IORING_OFF_SQES);
+	if(ring -> sq_ring == MAP_FAILED || ring -> cq_ring == MAP_FAILED || ring -> sqes == MAP_FAILED)
+	{
+		if(ring -> sq_ring != MAP_FAILED)
+			munmap(ring -> sq_ring, ring -> sq_ring_size);
+		if(ring -> cq_ring_size && ring -> cq_ring != MAP_FAILED)
+			munmap(ring -> cq_ring, ring -> cq_ring_size);
+		if(ring -> sqes != MAP_FAILED)
+			munmap(ring -> sqes, ring -> sqes_size);
+		close(ring -> fd);
+		ring -> fd = -1;
+		return e_failure;
+	}
+
+	ring -> sq_head = (unsigned *)(ring -> sq_ring + params.sq_off.head);
+	ring -> sq_tail = (unsigned *)(ring -> sq_ring + params.sq_off.tail);
+	ring -> sq_mask = (unsigned *)(ring -> sq_ring + params.sq_off.ring_mask);
+	ring -> sq_array = (unsigned *)(ring -> sq_ring + params.sq_off.array);
+	ring -> cq_head = (unsigned *)(ring -> cq_ring + params.cq_off.head);
+	ring -> cq_tail = (unsigned *)(ring -> cq_ring + params.cq_off.tail);
+	ring -> cq_mask = (unsigned *)(ring -> cq_ring + params.cq_off.ring_mask);
+	ring -> cqes = ring -> cq_ring + params.cq_off.cqes;
+	return e_success;
+}
+
+/* Unmap the rings */
+static void ring_free(IoRing *ring)
+{
+	munmap(ring -> sq_ring, ring -> sq_ring_size);
+	if(ring -> cq_ring_size)
+		munmap(ring -> cq_ring, ring -> cq_ring_size);
+	munmap(ring -> sqes, ring -> sqes_size);
+	close(ring -> fd);
+}
+
+/*
+Ring queue
+* Input: Engine, with the lock held and a free entry, and a request
+*Output: Next transfer of the request on the submission ring
+*Description: Entries are used in ring order, so the index array is the identity.
+*/
+static void ring_queue(IoEngine *engine, IoRequest *request)
+{
+	IoRing *ring = &engine -> ring;
+	unsigned tail = *ring -> sq_tail;
+	unsigned index = tail & *ring -> sq_mask;
+	struct io_uring_sqe *sqe = (struct io_uring_sqe *)ring -> sqes + index;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe -> opcode = (request -> size == 0) ? IORING_OP_NOP : request -> write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe -> fd = request -> fd;
+	sqe -> addr = (uintptr_t)(request -> buffer + request -> done);
+	sqe -> len = step_size(request);
+	sqe -> off = request -> offset + request -> done;
+	sqe -> user_data = (uintptr_t)request;
+	ring -> sq_array[index] = index;
+
+	__atomic_store_n(ring -> sq_tail, tail + 1, __ATOMIC_RELEASE);
+	engine -> queued++;
+	engine -> outstanding++;
+}
+
+/*
+Ring enter
+* Input: Engine and the number of completions to wait for (0 or 1)
+*Output: The queued entries passed to the kernel
+*Description: Called without the lock. The entries queued when it is
+taken are claimed; several threads may enter at once, the kernel
+submits in ring order so every claimed entry is submitted once.
+Entries the kernel did not take are claimed again next time.
+*/
+static void ring_enter(IoEngine *engine, unsigned min_complete)
+{
+	pthread_mutex_lock(&engine -> lock);
+	unsigned to_submit = engine -> queued;
+	engine -> queued = 0;
+	pthread_mutex_unlock(&engine -> lock);
+
+	long submitted = syscall(__NR_io_uring_enter, engine -> ring.fd, to_submit, min_complete,
+	                         min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if(submitted < 0)
+		submitted = 0;
+
+	if((unsigned)submitted < to_submit)
+	{
+		pthread_mutex_lock(&engine -> lock);
+		engine -> queued += to_submit - submitted;
+		pthread_mutex_unlock(&engine -> lock);
+	}
+}
+
+/*
+Ring reap
+* Input: Engine, with the lock held
+*Output: A finished request, NULL once the completion ring is empty
+*Description: Requests with bytes left are queued again, and every
+completion frees an entry for a pending request.
+*/
+static IoRequest *ring_reap(IoEngine *engine)
+{
+	IoRing *ring = &engine -> ring;
+	unsigned head = *ring -> cq_head;
+
+	while(head != __atomic_load_n(ring -> cq_tail, __ATOMIC_ACQUIRE))
+	{
+		struct io_uring_cqe *cqe = (struct io_uring_cqe *)ring -> cqes + (head & *ring -> cq_mask);
+		IoRequest *request = (IoRequest *)(uintptr_t)cqe -> user_data;
+		long result = cqe -> res;
+
+		__atomic_store_n(ring -> cq_head, ++head, __ATOMIC_RELEASE);
+		engine -> outstanding--;
+
+		int finished = complete_step(request, result);
+		if(!finished)
+			ring_queue(engine, request);
+		while(engine -> pending_head != NULL && engine -> outstanding < ring -> entries)
+			ring_queue(engine, pop_request(&engine -> pending_head, &engine -> pending_tail));
+		if(finished)
+			return request;
+	}
+	return NULL;
+}
+
+#else
+
+static Status ring_init(IoRing *ring, unsigned entries)
+{
+	(void)ring;
+	(void)entries;
+	return e_failure;
+}
+
+static void ring_free(IoRing *ring) { (void)ring; }
+static void ring_queue(IoEngine *engine, IoRequest *request) { (void)engine; (void)request; }
+static void ring_enter(IoEngine *engine, unsigned min_complete) { (void)engine; (void)min_complete; }
+static IoRequest *ring_reap(IoEngine *engine) { (void)engine; return NULL; }
+
+#endif
+
+/*
+Transfer
+* Input: Request
+*Output: Bytes of one pread or pwrite, -errno on errors
+*/
+static long transfer(IoRequest *request)
+{
+	ssize_t n;
+
+	do
+		n = request -> write ? pwrite(request -> fd, request -> buffer + request -> done, step_size(request), request -> offset + request -> done)
+		                     : pread(request -> fd, request -> buffer + request -> done, step_size(request), request -> offset + request -> done);
+	while(n < 0 && errno == EINTR);
+	return (n < 0) ? -errno : n;
+}
+
+/*
+Pool thread
+* Input: Engine
+*Description: Runs pending requests to completion with blocking
+calls, until the engine stops.
+*/
+static void *pool_thread(void *arg)
+{
+	IoEngine *engine = arg;
+
+	pthread_mutex_lock(&engine -> lock);
+	for(;;)
+	{
+		while(engine -> pending_head == NULL && !engine -> stop)
+			pthread_cond_wait(&engine -> work, &engine -> lock);
+		if(engine -> pending_head == NULL)
+			break;
+
+		IoRequest *request = pop_request(&engine -> pending_head, &engine -> pending_tail);
+		pthread_mutex_unlock(&engine -> lock);
+
+		if(request -> size != 0)
+			while(!complete_step(request, transfer(request)))
+				;
+
+		pthread_mutex_lock(&engine -> lock);
+		append_request(&engine -> done_head, &engine -> done_tail, request);
+		pthread_cond_signal(&engine -> done);
+	}
+	pthread_mutex_unlock(&engine -> lock);
+	return NULL;
+}
+
+/*
+Engine init
+* Input: Engine, backend asked for and the number of requests kept in flight
+*Output: Started engine, e_failure when io_uring was asked for and is
+not available or no pool thread could be started
+*/
+Status io_engine_init(IoEngine *engine, IoBackend backend, unsigned queue_depth)
+{
+	memset(engine, 0, sizeof(*engine));
+	engine -> ring.fd = -1;
+	pthread_mutex_init(&engine -> lock, NULL);
+	pthread_cond_init(&engine -> work, NULL);
+	pthread_cond_init(&engine -> done, NULL);
+
+	if(backend != io_backend_pool && ring_init(&engine -> ring, queue_depth ? queue_depth : 1) == e_success)
+	{
+		engine -> backend = io_backend_uring;
+		return e_success;
+	}
+
+	if(backend != io_backend_uring)
+	{
+		engine -> backend = io_backend_pool;
+		for(; engine -> num_threads < IO_ENGINE_POOL_THREADS; engine -> num_threads++)
+		{
+			if(pthread_create(&engine -> threads[engine -> num_threads], NULL, pool_thread, engine) != 0)
+				break;
+		}
+		if(engine -> num_threads > 0)
+			return e_success;
+	}
+
+	fprintf(stderr, "ERROR: Unable to start the %s I/O engine\n", (backend == io_backend_uring) ? "io_uring" : "thread pool");
+	pthread_mutex_destroy(&engine -> lock);
+	pthread_cond_destroy(&engine -> work);
+	pthread_cond_destroy(&engine -> done);
+	return e_failure;
+}
+
+/*
+Engine submit
+* Input: Engine and a request with fd, write, buffer, size and offset set
+*Output: Request queued, its done and error fields reset
+*/
+void io_engine_submit(IoEngine *engine, IoRequest *request)
+{
+	request -> done = 0;
+	request -> error = 0;
+
+	pthread_mutex_lock(&engine -> lock);
+	if(engine -> backend == io_backend_uring && engine -> pending_head == NULL && engine -> outstanding < engine -> ring.entries)
+		ring_queue(engine, request);
+	else
+	{
+		append_request(&engine -> pending_head, &engine -> pending_tail, request);
+		pthread_cond_signal(&engine -> work);
+	}
+	pthread_mutex_unlock(&engine -> lock);
+}
+
+/*
+Engine flush
+* Input: Engine
+*Description: Pool threads pick requests up as they are submitted,
+io_uring entries wait for a system call.
+*/
+void io_engine_flush(IoEngine *engine)
+{
+	if(engine -> backend == io_backend_uring)
+		ring_enter(engine, 0);
+}
+
+/*
+Engine wait
+* Input: Engine
+*Output: Next finished request, check its error field
+*Description: With io_uring one system call submits the queued entries
+and waits for a completion.
+*/
+IoRequest *io_engine_wait(IoEngine *engine)
+{
+	IoRequest *request;
+
+	pthread_mutex_lock(&engine -> lock);
+	if(engine -> backend == io_backend_uring)
+	{
+		while((request = ring_reap(engine)) == NULL)
+		{
+			pthread_mutex_unlock(&engine -> lock);
+			ring_enter(engine, 1);
+			pthread_mutex_lock(&engine -> lock);
+		}
+	}
+	else
+	{
+		while(engine -> done_head == NULL)
+			pthread_cond_wait(&engine -> done, &engine -> lock);
+		request = pop_request(&engine -> done_head, &engine -> done_tail);
+	}
+	pthread_mutex_unlock(&engine -> lock);
+	return request;
+}
+
+/*
+Engine free
+* Input: Engine with nothing outstanding
+*Output: Threads joined or rings unmapped
+*/
+void io_engine_free(IoEngine *engine)
+{
+	if(engine -> backend == io_backend_uring)
+		ring_free(&engine -> ring);
+	else
+	{
+		pthread_mutex_lock(&engine -> lock);
+		engine -> stop = 1;
+		pthread_cond_broadcast(&engine -> work);
+		pthread_mutex_unlock(&engine -> lock);
+		for(int i = 0; i < engine -> num_threads; i++)
+			pthread_join(engine -> threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&engine -> lock);
+	pthread_cond_destroy(&engine -> work);
+	pthread_cond_destroy(&engine -> done);
+}
+
+/* Name of the backend in use */
+const char *io_engine_name(const IoEngine *engine)
+{
+	return (engine -> backend == io_backend_uring) ? "io_uring" : "thread pool";
+}
@@ -0,0 +1,110 @@
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Asynchronous I/O engine: keeps many positional reads and
+ * writes in flight at once, so that high latency storage is
+ * kept busy while the CPU works on data already read.
+ * io_uring is used when the kernel provides it, otherwise a
+ * pool of threads issuing pread and pwrite. Requests may be
+ * submitted from any thread; their completions are collected
+ * by a single thread with io_engine_wait.
+ */
+
+/* Largest transfer of one system call, longer requests are split */
+#define IO_ENGINE_MAX_TRANSFER (1 << 30)
+
+/* Threads of the pread/pwrite pool */
+#define IO_ENGINE_POOL_THREADS 16
+
+typedef enum
+{
+    io_backend_sync,        /* no engine: stdio and mmap, as for single files */
+    io_backend_auto,        /* io_uring when available, else the pool */
+    io_backend_uring,
+    io_backend_pool
+} IoBackend;
+
+/* One read or write, owned by the caller until it completes */
+typedef struct _IoRequest
+{
+    int fd;
+    int write;              /* pwrite rather than pread */
+    unsigned char *buffer;
+    size_t size;            /* 0 makes a no-op request, completed as soon as possible */
+    off_t offset;
+    size_t done;            /* bytes transferred */
+    int error;              /* errno of a failed transfer, EIO at an early end of file */
+    void *arg;              /* for the caller */
+    struct _IoRequest *next;
+} IoRequest;
+
+/* Submission and completion rings shared with the kernel */
+typedef struct _IoRing
+{
+    int fd;
+    unsigned entries;
+    unsigned char *sq_ring;
+    unsigned char *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    void *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    void *cqes;
+} IoRing;
+
+typedef struct _IoEngine
+{
+    IoBackend backend;      /* io_backend_uring or io_backend_pool once started */
+    pthread_mutex_t lock;
+    pthread_cond_t work;    /* pool: a request is pending or the engine stops */
+    pthread_cond_t done;    /* pool: a request completed */
+
+    /* io_uring */
+    IoRing ring;
+    unsigned queued;        /* entries on the submission ring not yet passed to the kernel */
+    unsigned outstanding;   /* entries queued or in flight, at most ring.entries */
+
+    /* Requests waiting for a ring entry (io_uring) or a thread (pool) */
+    IoRequest *pending_head;
+    IoRequest *pending_tail;
+
+    /* Pool: completed requests, and the threads */
+    IoRequest *done_head;
+    IoRequest *done_tail;
+    pthread_t threads[IO_ENGINE_POOL_THREADS];
+    int num_threads;
+    int stop;
+} IoEngine;
+
+/* Start an engine with room for queue_depth requests in flight */
+Status io_engine_init(IoEngine *engine, IoBackend backend, unsigned queue_depth);
+
+/* Queue a request, io_engine_flush or io_engine_wait passes it to the kernel */
+void io_engine_submit(IoEngine *engine, IoRequest *request);
+
+/* Pass the queued requests to the kernel, for threads that do not wait for completions */
+void io_engine_flush(IoEngine *engine);
+
+/* Wait for a request to complete, fully or with an error; something must be outstanding */
+IoRequest *io_engine_wait(IoEngine *engine);
+
+/* Stop an engine, no request may be outstanding */
+void io_engine_free(IoEngine *engine);
+
+/* Name of the backend in use */
+const char *io_engine_name(const IoEngine *engine);
+
+#endif
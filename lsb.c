@@ -0,0 +1,431 @@
+
+#include <stdint.h>
+#include <string.h>
+#include "lsb.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LSB_X86 1
+#endif
+
+/* Function Definitions */
+
+/* One entry per kernel implementation */
+typedef struct _LsbKernel
+{
+    const char *name;
+    void (*encode)(const unsigned char *data, size_t n, unsigned char *image_buffer);
+    void (*decode)(const unsigned char *image_buffer, size_t n, unsigned char *data);
+    int (*supported)(void);
+} LsbKernel;
+
+/* LSB of every byte in a 64 bit word */
+#define LSB_MASK_64 0x0101010101010101ULL
+
+/*
+Scalar kernels
+*Description: Reference implementation, one bit per iteration exactly
+as encode_byte_to_lsb and decode_byte_from_lsb. Every other kernel
+must produce the same bytes.
+*/
+static void encode_scalar(const unsigned char *data, size_t n, unsigned char *image_buffer)
+{
+	for(size_t j = 0; j < n; j++)
+	{
+		for(int i = 0; i < 8; i++)
+			image_buffer[8 * j + i] = (image_buffer[8 * j + i] & 0xFE) | ((data[j] >> (7 - i)) & 1);
+	}
+}
+
+static void decode_scalar(const unsigned char *image_buffer, size_t n, unsigned char *data)
+{
+	for(size_t j = 0; j < n; j++)
+	{
+		unsigned char byte = 0;
+		for(int i = 0; i < 8; i++)
+			byte = (byte << 1) | (image_buffer[8 * j + i] & 1);
+		data[j] = byte;
+	}
+}
+
+static int always_supported(void)
+{
+	return 1;
+}
+
+#ifdef LSB_X86
+
+/* Reverse the bit order of a byte (bit 7 becomes bit 0) */
+static inline unsigned char reverse_bits(unsigned int b)
+{
+	b = ((b & 0xF0) >> 4) | ((b & 0x0F) << 4);
+	b = ((b & 0xCC) >> 2) | ((b & 0x33) << 2);
+	b = ((b & 0xAA) >> 1) | ((b & 0x55) << 1);
+	return b;
+}
+
+/*
+SSE2 kernels
+*Description: 16 image bytes (2 payload bytes) per iteration. Encoding
+broadcasts each payload byte over 8 lanes and turns the selected bit of
+every lane into 0 or 1. Decoding moves each LSB to the sign bit and
+gathers all 16 with movemask.
+*/
+__attribute__((target("sse2")))
+static void encode_sse2(const unsigned char *data, size_t n, unsigned char *image_buffer)
+{
+	const __m128i bit_select = _mm_set1_epi64x(0x0102040810204080LL);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i keep = _mm_set1_epi8((char)0xFE);
+	size_t j = 0;
+
+	for(; j + 2 <= n; j += 2)
+	{
+		__m128i bytes = _mm_set_epi64x((long long)(data[j + 1] * LSB_MASK_64), (long long)(data[j] * LSB_MASK_64));
+		__m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(bytes, bit_select), bit_select), one);
+		__m128i image = _mm_loadu_si128((const __m128i *)(image_buffer + 8 * j));
+		_mm_storeu_si128((__m128i *)(image_buffer + 8 * j), _mm_or_si128(_mm_and_si128(image, keep), bits));
+	}
+	encode_scalar(data + j, n - j, image_buffer + 8 * j);
+}
+
+__attribute__((target("sse2")))
+static void decode_sse2(const unsigned char *image_buffer, size_t n, unsigned char *data)
+{
+	size_t j = 0;
+
+	for(; j + 2 <= n; j += 2)
+	{
+		__m128i image = _mm_loadu_si128((const __m128i *)(image_buffer + 8 * j));
+		unsigned int mask = _mm_movemask_epi8(_mm_slli_epi64(image, 7));
+		data[j] = reverse_bits(mask & 0xFF);
+		data[j + 1] = reverse_bits(mask >> 8);
+	}
+	decode_scalar(image_buffer + 8 * j, n - j, data + j);
+}
+
+static int sse2_supported(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+/*
+BMI2 kernels
+*Description: pdep deposits the 8 payload bits into the LSB of each byte
+of a 64 bit word, pext gathers them back. The byte swap puts the MSB of
+the payload into the first image byte.
+*/
+__attribute__((target("bmi2")))
+static void encode_bmi2(const unsigned char *data, size_t n, unsigned char *image_buffer)
+{
+	for(size_t j = 0; j < n; j++)
+	{
+		uint64_t image;
+		memcpy(&image, image_buffer + 8 * j, 8);
+		image = (image & ~LSB_MASK_64) | __builtin_bswap64(_pdep_u64(data[j], LSB_MASK_64));
+		memcpy(image_buffer + 8 * j, &image, 8);
+	}
+}
+
+__attribute__((target("bmi2")))
+static void decode_bmi2(const unsigned char *image_buffer, size_t n, unsigned char *data)
+{
+	for(size_t j = 0; j < n; j++)
+	{
+		uint64_t image;
+		memcpy(&image, image_buffer + 8 * j, 8);
+		data[j] = (unsigned char)_pext_u64(__builtin_bswap64(image), LSB_MASK_64);
+	}
+}
+
+static int bmi2_supported(void)
+{
+	return __builtin_cpu_supports("bmi2");
+}
+
+/*
+AVX2 kernels
+*Description: 32 image bytes (4 payload bytes) per iteration. Encoding
+shuffles each payload byte over its 8 lanes and selects one bit per lane.
+Decoding reverses the byte order inside every 8 byte group so that a
+single movemask yields the 4 payload bytes in order.
+*/
+__attribute__((target("avx2")))
+static void encode_avx2(const unsigned char *data, size_t n, unsigned char *image_buffer)
+{
+	const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+	                                        2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+	const __m256i bit_select = _mm256_set1_epi64x(0x0102040810204080LL);
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i keep = _mm256_set1_epi8((char)0xFE);
+	size_t j = 0;
+
+	for(; j + 4 <= n; j += 4)
+	{
+		uint32_t word;
+		memcpy(&word, data + j, 4);
+		__m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32((int)word), spread);
+		__m256i bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(bytes, bit_select), bit_select), one);
+		__m256i image = _mm256_loadu_si256((const __m256i *)(image_buffer + 8 * j));
+		_mm256_storeu_si256((__m256i *)(image_buffer + 8 * j), _mm256_or_si256(_mm256_and_si256(image, keep), bits));
+	}
+	encode_scalar(data + j, n - j, image_buffer + 8 * j);
+}
+
+__attribute__((target("avx2")))
+static void decode_avx2(const unsigned char *image_buffer, size_t n, unsigned char *data)
+{
+	const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+	                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	size_t j = 0;
+
+	for(; j + 4 <= n; j += 4)
+	{
+		__m256i image = _mm256_loadu_si256((const __m256i *)(image_buffer + 8 * j));
+		uint32_t word = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi64(_mm256_shuffle_epi8(image, reverse), 7));
+		memcpy(data + j, &word, 4);
+	}
+	decode_scalar(image_buffer + 8 * j, n - j, data + j);
+}
+
+static int avx2_supported(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+/* Kernels in order of preference */
+static const LsbKernel kernels[] =
+{
+#ifdef LSB_X86
+    { "avx2", encode_avx2, decode_avx2, avx2_supported },
+    { "bmi2", encode_bmi2, decode_bmi2, bmi2_supported },
+    { "sse2", encode_sse2, decode_sse2, sse2_supported },
+#endif
+    { "scalar", encode_scalar, decode_scalar, always_supported },
+};
+
+static const LsbKernel *active_kernel = &kernels[sizeof(kernels) / sizeof(kernels[0]) - 1];
+
+/*
+Select kernel
+* Input: Kernel name, or NULL to pick the best one the CPU supports
+*Output: 0 on success, -1 if the kernel is unknown or not supported
+*/
+int lsb_select_kernel(const char *name)
+{
+#ifdef LSB_X86
+	__builtin_cpu_init();
+#endif
+	for(size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+	{
+		if(name != NULL && strcmp(name, kernels[i].name) != 0)
+			continue;
+		if(!kernels[i].supported())
+			continue;
+
+		active_kernel = &kernels[i];
+		return 0;
+	}
+	return -1;
+}
+
+/* Pick the kernel once before main runs */
+__attribute__((constructor))
+static void lsb_init(void)
+{
+	lsb_select_kernel(NULL);
+}
+
+const char *lsb_kernel_name(void)
+{
+	return active_kernel -> name;
+}
+
+/*
+Encode bytes to LSB
+* Input: Payload bytes, their count and the image buffer (8 bytes per payload byte)
+*Output: LSBs of the image buffer hold the payload
+*/
+void encode_bytes_to_lsb(const char *data, size_t n, char *image_buffer)
+{
+	active_kernel -> encode((const unsigned char *)data, n, (unsigned char *)image_buffer);
+}
+
+/*
+Decode bytes from LSB
+* Input: Image buffer (8 bytes per payload byte), payload byte count and output buffer
+*Output: Payload bytes reconstructed from the LSBs
+*/
+void decode_bytes_from_lsb(const char *image_buffer, size_t n, char *data)
+{
+	active_kernel -> decode((const unsigned char *)image_buffer, n, (unsigned char *)data);
+}
+
+/*
+Image bytes for payload
+* Input: Payload byte count and depth (bits per image byte)
+*Output: Number of image bytes that carry them, the last one may be partly used
+*Description: 8 * n is never formed, so any n whose image bytes fit in a
+size_t gives the right count.
+*/
+size_t lsb_image_bytes(size_t n, int depth)
+{
+	return n / depth * 8 + (8 * (n % depth) + depth - 1) / depth;
+}
+
+/*
+Payload capacity
+* Input: Image byte count and depth
+*Output: Largest n with lsb_image_bytes(n, depth) <= image_bytes, without overflow
+*/
+size_t lsb_payload_capacity(size_t image_bytes, int depth)
+{
+	return image_bytes / 8 * depth + image_bytes % 8 * depth / 8;
+}
+
+/*
+Bit stream at depth
+*Description: Reference for the depth kernels, any depth: the payload bit
+stream is shifted through an accumulator one field at a time. The kernels
+use it for the partial group at the end of a buffer.
+*/
+static void encode_stream(const unsigned char *in, size_t n, unsigned char *out, int depth)
+{
+	unsigned char mask = (1 << depth) - 1;
+	uint32_t bits = 0;
+	int count = 0;
+	for(size_t j = 0; j < n; j++)
+	{
+		bits = (bits << 8) | in[j];
+		for(count += 8; count >= depth; out++)
+		{
+			count -= depth;
+			*out = (*out & ~mask) | ((bits >> count) & mask);
+		}
+	}
+	if(count > 0)
+		*out = (*out & ~mask) | ((bits << (depth - count)) & mask);
+}
+
+static void decode_stream(const unsigned char *in, size_t n, unsigned char *out, int depth)
+{
+	unsigned char mask = (1 << depth) - 1;
+	uint32_t bits = 0;
+	int count = 0;
+	for(size_t j = 0; j < n; j++)
+	{
+		for(; count < 8; count += depth)
+			bits = (bits << depth) | (*in++ & mask);
+		count -= 8;
+		out[j] = bits >> count;
+	}
+}
+
+/*
+Depth kernels
+*Description: A group of depth payload bytes fills exactly 8 image bytes.
+The group loops take the depth as a compile time constant, so each
+instantiation below is straight line code with its shifts and masks
+folded in, and no payload byte is split across loop iterations. The
+kernel for a depth is looked up once per call, never per byte.
+*/
+static inline __attribute__((always_inline)) void encode_groups(const unsigned char *in, size_t n, unsigned char *out, const int depth)
+{
+	const unsigned char mask = (1 << depth) - 1;
+	size_t groups = n / depth;
+
+	for(size_t g = 0; g < groups; g++, in += depth, out += 8)
+	{
+		uint32_t bits = 0;
+#pragma GCC unroll 4
+		for(int i = 0; i < depth; i++)
+			bits = (bits << 8) | in[i];
+#pragma GCC unroll 8
+		for(int i = 0; i < 8; i++)
+			out[i] = (out[i] & ~mask) | ((bits >> (depth * (7 - i))) & mask);
+	}
+	encode_stream(in, n % depth, out, depth);
+}
+
+static inline __attribute__((always_inline)) void decode_groups(const unsigned char *in, size_t n, unsigned char *out, const int depth)
+{
+	const unsigned char mask = (1 << depth) - 1;
+	size_t groups = n / depth;
+
+	for(size_t g = 0; g < groups; g++, in += 8, out += depth)
+	{
+		uint32_t bits = 0;
+#pragma GCC unroll 8
+		for(int i = 0; i < 8; i++)
+			bits = (bits << depth) | (in[i] & mask);
+#pragma GCC unroll 4
+		for(int i = 0; i < depth; i++)
+			out[i] = bits >> (8 * (depth - 1 - i));
+	}
+	decode_stream(in, n % depth, out, depth);
+}
+
+static void encode_depth2(const unsigned char *data, size_t n, unsigned char *image_buffer)
+{
+	encode_groups(data, n, image_buffer, 2);
+}
+
+static void encode_depth3(const unsigned char *data, size_t n, unsigned char *image_buffer)
+{
+	encode_groups(data, n, image_buffer, 3);
+}
+
+static void encode_depth4(const unsigned char *data, size_t n, unsigned char *image_buffer)
+{
+	encode_groups(data, n, image_buffer, 4);
+}
+
+static void decode_depth2(const unsigned char *image_buffer, size_t n, unsigned char *data)
+{
+	decode_groups(image_buffer, n, data, 2);
+}
+
+static void decode_depth3(const unsigned char *image_buffer, size_t n, unsigned char *data)
+{
+	decode_groups(image_buffer, n, data, 3);
+}
+
+static void decode_depth4(const unsigned char *image_buffer, size_t n, unsigned char *data)
+{
+	decode_groups(image_buffer, n, data, 4);
+}
+
+/* Kernels by depth, depth 1 is the active bulk kernel */
+static const LsbKernel depth_kernels[LSB_MAX_DEPTH + 1] =
+{
+	[2] = { "depth2", encode_depth2, decode_depth2, always_supported },
+	[3] = { "depth3", encode_depth3, decode_depth3, always_supported },
+	[4] = { "depth4", encode_depth4, decode_depth4, always_supported },
+};
+
+/*
+Encode bytes to LSB at depth
+* Input: Payload bytes, their count, image buffer and depth from 1 to LSB_MAX_DEPTH
+*Output: The low depth bits of lsb_image_bytes(n, depth) image bytes hold the payload
+*Description: The payload is a bit stream, MSB first, cut into depth bit
+fields stored in consecutive image bytes. Depth 1 is the bulk kernel, the
+other depths have a kernel of their own; a partial last field is zero padded.
+*/
+void encode_bytes_to_lsb_depth(const char *data, size_t n, char *image_buffer, int depth)
+{
+	const LsbKernel *kernel = (depth == 1) ? active_kernel : &depth_kernels[depth];
+	kernel -> encode((const unsigned char *)data, n, (unsigned char *)image_buffer);
+}
+
+/*
+Decode bytes from LSB at depth
+* Input: Image buffer, payload byte count, output buffer and depth from 1 to LSB_MAX_DEPTH
+*Output: Payload bytes rebuilt from the low depth bits of the image bytes
+*/
+void decode_bytes_from_lsb_depth(const char *image_buffer, size_t n, char *data, int depth)
+{
+	const LsbKernel *kernel = (depth == 1) ? active_kernel : &depth_kernels[depth];
+	kernel -> decode((const unsigned char *)image_buffer, n, (unsigned char *)data);
+}
@@ -0,0 +1,54 @@
+#ifndef LSB_H
+#define LSB_H
+
+#include <stddef.h>
+
+/*
+ * Bulk LSB kernels.
+ * Every payload byte is spread MSB first over the LSBs of
+ * 8 consecutive image bytes, exactly like encode_byte_to_lsb
+ * and decode_byte_from_lsb do for a single byte.
+ * The implementation is picked once at runtime from the
+ * CPU features (AVX2, BMI2, SSE2, portable scalar).
+ */
+
+/* Embed n payload bytes into the LSBs of 8 * n image bytes */
+void encode_bytes_to_lsb(const char *data, size_t n, char *image_buffer);
+
+/* Extract n payload bytes from the LSBs of 8 * n image bytes */
+void decode_bytes_from_lsb(const char *image_buffer, size_t n, char *data);
+
+/*
+ * Deeper embedding: depth bits per image byte instead of
+ * one, see encode_bytes_to_lsb_depth for the bit layout.
+ * Every depth has a kernel compiled for it, unrolled over
+ * the depth payload bytes that fill 8 image bytes.
+ */
+#define LSB_MAX_DEPTH 4
+
+/* Payload bytes per whole group of image bytes at a depth, chunks
+ * of a stream encoded piecewise must be multiples of it */
+#define LSB_GROUP_BYTES(depth) ((depth) == 3 ? 3 : 1)
+
+/* Largest multiple of the group size not above n */
+#define LSB_ROUND_CHUNK(n, depth) ((n) - (n) % LSB_GROUP_BYTES(depth))
+
+/* Image bytes needed for n payload bytes at depth bits per image byte */
+size_t lsb_image_bytes(size_t n, int depth);
+
+/* Payload bytes that image_bytes image bytes hold at depth, capacity checks use it rather than lsb_image_bytes so they cannot overflow */
+size_t lsb_payload_capacity(size_t image_bytes, int depth);
+
+/* Embed n payload bytes into the low depth bits of lsb_image_bytes(n, depth) image bytes */
+void encode_bytes_to_lsb_depth(const char *data, size_t n, char *image_buffer, int depth);
+
+/* Extract n payload bytes from the low depth bits of lsb_image_bytes(n, depth) image bytes */
+void decode_bytes_from_lsb_depth(const char *image_buffer, size_t n, char *data, int depth);
+
+/* Force a kernel by name ("scalar", "sse2", "bmi2", "avx2"), NULL for auto */
+int lsb_select_kernel(const char *name);
+
+/* Name of the kernel in use */
+const char *lsb_kernel_name(void);
+
+#endif
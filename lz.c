@@ -0,0 +1,356 @@
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lz.h"
+#include "stats.h"
+#include "types.h"
+
+/* Shortest back reference */
+#define LZ_MIN_MATCH 4
+
+/* Match finder: one position per hash of 4 bytes */
+#define LZ_HASH_BITS 13
+
+/* Literal and match lengths above 14 continue in extra bytes */
+#define LZ_LENGTH_MORE 15
+
+/* Function Definitions */
+
+static inline uint32_t load32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint32_t hash32(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+Put length
+*Description: Continuation bytes of a length whose nibble was 15:
+255 while more follows, then the rest.
+*/
+static int put_length(unsigned char *dst, size_t capacity, size_t *op, size_t length)
+{
+	for(; length >= 255; length -= 255)
+	{
+		if(*op >= capacity)
+			return 0;
+		dst[(*op)++] = 255;
+	}
+	if(*op >= capacity)
+		return 0;
+	dst[(*op)++] = length;
+	return 1;
+}
+
+/*
+Put sequence
+*Description: Token, literals and, when match_length is not 0, the
+offset and match length. Returns 0 when dst is full.
+*/
+static int put_sequence(unsigned char *dst, size_t capacity, size_t *op, const unsigned char *literals,
+                        size_t literal_length, size_t offset, size_t match_length)
+{
+	size_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+
+	if(*op >= capacity)
+		return 0;
+	dst[(*op)++] = ((literal_length < LZ_LENGTH_MORE ? literal_length : LZ_LENGTH_MORE) << 4) |
+	               (match_code < LZ_LENGTH_MORE ? match_code : LZ_LENGTH_MORE);
+
+	if(literal_length >= LZ_LENGTH_MORE && !put_length(dst, capacity, op, literal_length - LZ_LENGTH_MORE))
+		return 0;
+	if(literal_length > capacity - *op)
+		return 0;
+	memcpy(dst + *op, literals, literal_length);
+	*op += literal_length;
+
+	if(match_length == 0)
+		return 1;
+
+	if(capacity - *op < 2)
+		return 0;
+	dst[(*op)++] = offset & 0xFF;
+	dst[(*op)++] = offset >> 8;
+	return match_code < LZ_LENGTH_MORE || put_length(dst, capacity, op, match_code - LZ_LENGTH_MORE);
+}
+
+/*
+Compress block
+* Input: Up to LZ_BLOCK_SIZE bytes, output buffer and its capacity
+*Output: Compressed size, 0 when the result does not fit
+*Description: Greedy parse. Every position is looked up in a hash table of
+the last position with the same 4 bytes; runs without matches are skipped
+faster the longer they get. The block always ends with a sequence of
+literals only.
+*/
+size_t lz_compress_block(const unsigned char *src, size_t n, unsigned char *dst, size_t capacity)
+{
+	uint32_t table[1 << LZ_HASH_BITS];
+	size_t ip = 0, anchor = 0, op = 0;
+
+	memset(table, 0, sizeof(table));
+
+	while(n >= LZ_MIN_MATCH && ip <= n - LZ_MIN_MATCH)
+	{
+		uint32_t sequence = load32(src + ip);
+		uint32_t h = hash32(sequence);
+		size_t ref = table[h];
+
+		//Positions are stored + 1 so that 0 means empty
+		table[h] = ip + 1;
+		if(ref == 0 || load32(src + ref - 1) != sequence)
+		{
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+		ref--;
+
+		size_t length = LZ_MIN_MATCH;
+		while(ip + length < n && src[ref + length] == src[ip + length])
+			length++;
+
+		if(!put_sequence(dst, capacity, &op, src + anchor, ip - anchor, ip - ref, length))
+			return 0;
+		ip += length;
+		anchor = ip;
+	}
+
+	if(!put_sequence(dst, capacity, &op, src + anchor, n - anchor, 0, 0))
+		return 0;
+	return op;
+}
+
+/*
+Get length
+*Description: Adds the continuation bytes of a length, -1 past the end.
+*/
+static int get_length(const unsigned char *src, size_t n, size_t *ip, size_t *length)
+{
+	unsigned char b;
+	do
+	{
+		if(*ip >= n)
+			return -1;
+		b = src[(*ip)++];
+		*length += b;
+	} while(b == 255);
+	return 0;
+}
+
+/*
+Decompress block
+* Input: Compressed block, its size, output buffer and its capacity
+*Output: Decompressed size, -1 when the block is corrupt
+*Description: Every length and offset is checked, a damaged stego image
+cannot write outside dst.
+*/
+long lz_decompress_block(const unsigned char *src, size_t n, unsigned char *dst, size_t capacity)
+{
+	size_t ip = 0, op = 0;
+
+	while(ip < n)
+	{
+		unsigned token = src[ip++];
+		size_t literal_length = token >> 4;
+
+		if(literal_length == LZ_LENGTH_MORE && get_length(src, n, &ip, &literal_length) != 0)
+			return -1;
+		if(literal_length > n - ip || literal_length > capacity - op)
+			return -1;
+		memcpy(dst + op, src + ip, literal_length);
+		ip += literal_length;
+		op += literal_length;
+
+		//The last sequence has no match
+		if(ip == n)
+			break;
+
+		if(n - ip < 2)
+			return -1;
+		size_t offset = src[ip] | (src[ip + 1] << 8);
+		size_t match_length = token & 0xF;
+		ip += 2;
+
+		if(match_length == LZ_LENGTH_MORE && get_length(src, n, &ip, &match_length) != 0)
+			return -1;
+		match_length += LZ_MIN_MATCH;
+		if(offset == 0 || offset > op || match_length > capacity - op)
+			return -1;
+
+		//Byte by byte, the match may overlap the bytes it produces
+		unsigned char *match = dst + op - offset;
+		for(size_t i = 0; i < match_length; i++)
+			dst[op + i] = match[i];
+		op += match_length;
+	}
+
+	return op;
+}
+
+/*
+Pack block
+* Input: Up to LZ_BLOCK_SIZE bytes and room for LZ_BLOCK_HEADER + n bytes
+*Output: Size of the block with its header
+*Description: Blocks that do not shrink are stored.
+*/
+static size_t pack_block(const unsigned char *block, size_t n, unsigned char *packed)
+{
+	uint32_t word;
+	size_t stored = lz_compress_block(block, n, packed + LZ_BLOCK_HEADER, n - 1);
+	if(stored == 0)
+	{
+		memcpy(packed + LZ_BLOCK_HEADER, block, n);
+		stored = n;
+		word = LZ_BLOCK_RAW | n;
+	}
+	else
+		word = stored;
+
+	packed[0] = word >> 24;
+	packed[1] = word >> 16;
+	packed[2] = word >> 8;
+	packed[3] = word;
+	return LZ_BLOCK_HEADER + stored;
+}
+
+/*
+Compress file
+* Input: Input stream with size bytes left, output stream
+*Output: Compressed stream written to out and its size
+*Description: Reads one block at a time, so memory use is two blocks
+whatever the size of the input.
+*/
+Status lz_compress_file(FILE *in, off_t size, FILE *out, off_t *compressed_size)
+{
+	unsigned char *block = malloc(LZ_BLOCK_SIZE);
+	unsigned char *packed = malloc(LZ_BLOCK_HEADER + LZ_BLOCK_SIZE);
+	Status status = (block != NULL && packed != NULL) ? e_success : e_failure;
+
+	*compressed_size = 0;
+	while(status == e_success && size > 0)
+	{
+		size_t n = (size < LZ_BLOCK_SIZE) ? (size_t)size : LZ_BLOCK_SIZE;
+		if(fread(block, 1, n, in) != n)
+		{
+			status = e_failure;
+			break;
+		}
+		stats_count_io(io_read, n);
+
+		size_t length = pack_block(block, n, packed);
+		if(fwrite(packed, 1, length, out) != length)
+			status = e_failure;
+		stats_count_io(io_write, length);
+
+		*compressed_size += length;
+		size -= n;
+	}
+
+	free(block);
+	free(packed);
+	return status;
+}
+
+/*
+Compress buffer
+* Input: n input bytes and an output buffer of LZ_COMPRESS_BOUND(n) bytes
+*Output: Size of the compressed stream
+*Description: The same stream lz_compress_file writes, built in memory.
+*/
+size_t lz_compress_buffer(const unsigned char *src, size_t n, unsigned char *dst)
+{
+	size_t length = 0;
+
+	for(size_t i = 0; i < n; i += LZ_BLOCK_SIZE)
+		length += pack_block(src + i, (n - i < LZ_BLOCK_SIZE) ? n - i : LZ_BLOCK_SIZE, dst + length);
+	return length;
+}
+
+/*
+Decoder init
+* Input: Decoder and two buffers of LZ_BLOCK_SIZE bytes
+*Output: Decoder collecting compressed blocks in block and decompressing to output
+*Description: The buffers stay the caller's, so that they can come from
+an arena or be reused from one stream to the next.
+*/
+void lz_decoder_init(LzDecoder *decoder, unsigned char *block, unsigned char *output)
+{
+	memset(decoder, 0, sizeof(*decoder));
+	decoder -> block = block;
+	decoder -> output = output;
+}
+
+/*
+Decoder feed
+* Input: Decoder, next piece of the stream, sink and its argument
+*Output: e_failure on corrupt blocks or when the sink fails
+*Description: Collects the block header and the block, then hands the
+decompressed block to the sink. Raw blocks go to the sink as they
+arrive, without being collected first.
+*/
+Status lz_decoder_feed(LzDecoder *decoder, const char *data, size_t n, LzSink sink, void *arg)
+{
+	const unsigned char *in = (const unsigned char *)data;
+
+	while(n > 0)
+	{
+		//Block header
+		if(decoder -> header_fill < LZ_BLOCK_HEADER)
+		{
+			decoder -> header[decoder -> header_fill++] = *in++;
+			n--;
+			if(decoder -> header_fill < LZ_BLOCK_HEADER)
+				continue;
+
+			uint32_t word = ((uint32_t)decoder -> header[0] << 24) | (decoder -> header[1] << 16) |
+			                (decoder -> header[2] << 8) | decoder -> header[3];
+			decoder -> raw = (word & LZ_BLOCK_RAW) != 0;
+			decoder -> block_size = word & ~LZ_BLOCK_RAW;
+			decoder -> block_fill = 0;
+			if(decoder -> block_size == 0 || decoder -> block_size > LZ_BLOCK_SIZE)
+				return e_failure;
+			continue;
+		}
+
+		size_t take = decoder -> block_size - decoder -> block_fill;
+		if(take > n)
+			take = n;
+
+		if(decoder -> raw)
+		{
+			if(sink(arg, (const char *)in, take) != e_success)
+				return e_failure;
+		}
+		else
+			memcpy(decoder -> block + decoder -> block_fill, in, take);
+		decoder -> block_fill += take;
+		in += take;
+		n -= take;
+
+		if(decoder -> block_fill < decoder -> block_size)
+			continue;
+
+		//Complete block, the next bytes start a new header
+		decoder -> header_fill = 0;
+		if(decoder -> raw)
+			continue;
+
+		long length = lz_decompress_block(decoder -> block, decoder -> block_size, decoder -> output, LZ_BLOCK_SIZE);
+		if(length < 0 || sink(arg, (const char *)decoder -> output, length) != e_success)
+			return e_failure;
+	}
+
+	return e_success;
+}
+
+/* A stream is complete when it ends between two blocks */
+Status lz_decoder_finish(const LzDecoder *decoder)
+{
+	return (decoder -> header_fill == 0) ? e_success : e_failure;
+}
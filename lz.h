@@ -0,0 +1,66 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Small LZ77 compressor for the secret data (LZ4 style
+ * sequences of literals and back references).
+ * A compressed stream is a list of independent blocks of
+ * up to LZ_BLOCK_SIZE input bytes, each one preceded by a
+ * 32 bit big endian word: bit 31 set for a block stored
+ * as is, bits 0-30 the number of bytes that follow.
+ */
+
+/* Input bytes per block, back references never cross a block */
+#define LZ_BLOCK_SIZE (64 * 1024)
+
+/* Size of the word in front of every block */
+#define LZ_BLOCK_HEADER 4
+
+/* Flag of a block stored without compression */
+#define LZ_BLOCK_RAW 0x80000000U
+
+/* Largest compressed stream of n bytes: every block stored with its header */
+#define LZ_COMPRESS_BOUND(n) ((n) + LZ_BLOCK_HEADER * (((n) + LZ_BLOCK_SIZE - 1) / LZ_BLOCK_SIZE))
+
+/* Callback receiving decompressed data */
+typedef Status (*LzSink)(void *arg, const char *data, size_t n);
+
+/* Streaming decompressor, accepts the stream in pieces of any size */
+typedef struct _LzDecoder
+{
+    unsigned char header[LZ_BLOCK_HEADER];
+    size_t header_fill;
+    size_t block_size;
+    size_t block_fill;
+    int raw;
+    unsigned char *block;
+    unsigned char *output;
+} LzDecoder;
+
+/* Compress n bytes into dst, returns the compressed size or 0 if it needs more than capacity bytes */
+size_t lz_compress_block(const unsigned char *src, size_t n, unsigned char *dst, size_t capacity);
+
+/* Decompress one block, returns its size or -1 on corrupt data */
+long lz_decompress_block(const unsigned char *src, size_t n, unsigned char *dst, size_t capacity);
+
+/* Compress size bytes of in to the current position of out, sets the stream size */
+Status lz_compress_file(FILE *in, off_t size, FILE *out, off_t *compressed_size);
+
+/* Compress n bytes into dst, which must hold LZ_COMPRESS_BOUND(n) bytes, returns the stream size */
+size_t lz_compress_buffer(const unsigned char *src, size_t n, unsigned char *dst);
+
+/* Prepare a decoder working in two LZ_BLOCK_SIZE buffers of the caller */
+void lz_decoder_init(LzDecoder *decoder, unsigned char *block, unsigned char *output);
+
+/* Decompress the next n bytes of the stream, complete blocks go to sink */
+Status lz_decoder_feed(LzDecoder *decoder, const char *data, size_t n, LzSink sink, void *arg);
+
+/* e_failure if the stream stopped in the middle of a block */
+Status lz_decoder_finish(const LzDecoder *decoder);
+
+#endif
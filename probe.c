@@ -0,0 +1,409 @@
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "probe.h"
+#include "bmp.h"
+#include "decode.h"
+#include "lsb.h"
+#include "stats.h"
+#include "stego_io.h"
+#include "types.h"
+
+/* Path waiting on the walk stack */
+typedef struct _ProbeItem
+{
+    char *path;
+    int is_dir;
+} ProbeItem;
+
+/* State shared by the probe workers */
+typedef struct _ProbeRun
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    ProbeItem *stack;
+    size_t num_items;
+    size_t capacity;
+    int busy;               /* workers handling an item, the walk ends at 0 with an empty stack */
+    int quiet;
+    size_t files;
+    size_t payloads;
+    size_t errors;
+} ProbeRun;
+
+/* Function Definitions */
+
+/*
+Parse probed fields
+* Input: Dense carriers of the header fields, their count and the image capacity
+*Output: ProbeResult verdict and fields
+*Description: Same checks as the decoder. A magic string alone matches
+one random image in 65536, so the option bits and a payload that fits
+in the image are required as well before reporting a payload.
+*/
+static void parse_fields(const char *carriers, size_t count, size_t capacity, ProbeResult *result)
+{
+	size_t magic_carriers = 8 * strlen(MAGIC_STRING);
+	char magic[sizeof(MAGIC_STRING)];
+
+	result -> verdict = probe_no_payload;
+	if(count < magic_carriers + 32)
+		return;
+
+	decode_bytes_from_lsb(carriers, strlen(MAGIC_STRING), magic);
+	if(memcmp(magic, MAGIC_STRING, strlen(MAGIC_STRING)) != 0)
+		return;
+
+	uint field = decode_size_from_LSB((char *)carriers + magic_carriers);
+	if(!HEADER_SUPPORTED(field))
+	{
+		result -> verdict = probe_unsupported;
+		return;
+	}
+
+	uint extn_size = field & HEADER_EXTN_SIZE_MASK;
+	size_t size_carriers = HEADER_SIZE_CARRIERS(field >> HEADER_VERSION_SHIFT);
+	size_t cipher_carriers = (field & HEADER_ENCRYPTED) ? 8 * CHACHA20_SALT_SIZE + 32 : 0;
+	size_t header_carriers = magic_carriers + 32 + 8 * extn_size + size_carriers + cipher_carriers + ((field & HEADER_CRC) ? 32 : 0);
+	if(count < header_carriers)
+		return;
+
+	result -> depth = ((field >> HEADER_DEPTH_SHIFT) & HEADER_DEPTH_MASK) + 1;
+	result -> compressed = (field & HEADER_COMPRESSED) != 0;
+	result -> scattered = (field & HEADER_SCATTERED) != 0;
+	result -> encrypted = (field & HEADER_ENCRYPTED) != 0;
+	result -> container = (field & HEADER_CONTAINER) != 0;
+	result -> has_crc = (field & HEADER_CRC) != 0;
+	decode_bytes_from_lsb(carriers + magic_carriers + 32, extn_size, result -> extension);
+	result -> extension[extn_size] = '\0';
+	result -> payload_size = decode_size_field((char *)carriers + magic_carriers + 32 + 8 * extn_size, field >> HEADER_VERSION_SHIFT);
+	if(result -> has_crc)
+		result -> payload_crc = decode_size_from_LSB((char *)carriers + magic_carriers + 32 + 8 * extn_size + size_carriers + cipher_carriers);
+
+	if(result -> payload_size <= lsb_payload_capacity(capacity - header_carriers, result -> depth))
+		result -> verdict = probe_payload;
+}
+
+/*
+Probe file
+* Input: File name
+*Output: ProbeResult, e_failure when the file cannot be opened or read
+*Description: Two preads: the BMP headers, then the span holding the first
+PROBE_MAX_CARRIERS carriers, which is a few KB whatever the image size.
+*/
+Status probe_file(const char *fname, ProbeResult *result)
+{
+	unsigned char header[BMP_MAX_HEADER_SIZE];
+	unsigned char span[PROBE_SPAN_SIZE];
+	char carriers[PROBE_MAX_CARRIERS];
+	BmpInfo bmp;
+	struct stat st;
+	Status status = e_failure;
+
+	memset(result, 0, sizeof(*result));
+	int fd = open(fname, O_RDONLY);
+	if(fd < 0)
+		return e_failure;
+
+	ssize_t n = (fstat(fd, &st) == 0) ? pread(fd, header, sizeof(header), 0) : -1;
+	if(n < 0)
+		goto done;
+	stats_count_io(io_read, n);
+
+	status = e_success;
+	result -> verdict = probe_not_bmp;
+	if(bmp_parse_header(header, n, &bmp) != e_success)
+		goto done;
+
+	//Only the carriers present in the file, truncated images are probed too
+	size_t count = bmp_capacity(&bmp) < PROBE_MAX_CARRIERS ? bmp_capacity(&bmp) : PROBE_MAX_CARRIERS;
+	if(bmp_carrier_end(&bmp, count) > (size_t)st.st_size)
+		count = bmp_carriers_before(&bmp, st.st_size);
+
+	size_t span_size = bmp_carrier_end(&bmp, count) - bmp.data_offset;
+	if(span_size > sizeof(span) || read_file_at(fd, span, span_size, bmp.data_offset) != e_success)
+	{
+		status = e_failure;
+		goto done;
+	}
+
+	bmp_gather(&bmp, 0, count, span, (unsigned char *)carriers);
+	parse_fields(carriers, count, bmp_capacity(&bmp), result);
+
+done:
+	close(fd);
+	return status;
+}
+
+/* File names ending in .bmp, in any case */
+static int is_bmp_name(const char *name)
+{
+	size_t length = strlen(name);
+	return length > 4 && strcasecmp(name + length - 4, ".bmp") == 0;
+}
+
+/*
+Push items
+* Input: ProbeRun and items to add to the walk stack
+*Output: e_failure when the stack cannot grow
+*Description: Called with the lock held.
+*/
+static Status push_items(ProbeRun *run, const ProbeItem *items, size_t n)
+{
+	if(run -> num_items + n > run -> capacity)
+	{
+		size_t capacity = (run -> capacity ? run -> capacity * 2 : 256);
+		while(capacity < run -> num_items + n)
+			capacity *= 2;
+		ProbeItem *stack = realloc(run -> stack, capacity * sizeof(ProbeItem));
+		if(stack == NULL)
+			return e_failure;
+		run -> stack = stack;
+		run -> capacity = capacity;
+	}
+
+	memcpy(run -> stack + run -> num_items, items, n * sizeof(ProbeItem));
+	run -> num_items += n;
+	return e_success;
+}
+
+/*
+List directory
+* Input: ProbeRun and a directory
+*Output: Its subdirectories and .bmp files on the walk stack
+*Description: The entries are collected first and pushed with one lock,
+d_type saves a stat per entry on the usual filesystems.
+*/
+static Status list_directory(ProbeRun *run, const char *path)
+{
+	DIR *dir = opendir(path);
+	if(dir == NULL)
+		return e_failure;
+
+	ProbeItem *items = NULL;
+	size_t num_items = 0, capacity = 0;
+	Status status = e_success;
+	struct dirent *entry;
+
+	while(status == e_success && (entry = readdir(dir)) != NULL)
+	{
+		if(strcmp(entry -> d_name, ".") == 0 || strcmp(entry -> d_name, "..") == 0)
+			continue;
+
+		unsigned char type = entry -> d_type;
+		char *child;
+		if(asprintf(&child, "%s/%s", path, entry -> d_name) < 0)
+		{
+			status = e_failure;
+			break;
+		}
+
+		struct stat st;
+		if(type == DT_UNKNOWN)
+			type = (lstat(child, &st) != 0) ? DT_UNKNOWN : S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+
+		if(type != DT_DIR && (type != DT_REG || !is_bmp_name(entry -> d_name)))
+		{
+			free(child);
+			continue;
+		}
+
+		if(num_items == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			ProbeItem *grown = realloc(items, capacity * sizeof(ProbeItem));
+			if(grown == NULL)
+			{
+				free(child);
+				status = e_failure;
+				break;
+			}
+			items = grown;
+		}
+		items[num_items++] = (ProbeItem){ child, type == DT_DIR };
+	}
+	closedir(dir);
+
+	pthread_mutex_lock(&run -> lock);
+	if(status == e_success && push_items(run, items, num_items) != e_success)
+		status = e_failure;
+	pthread_mutex_unlock(&run -> lock);
+
+	if(status != e_success)
+	{
+		for(size_t i = 0; i < num_items; i++)
+			free(items[i].path);
+	}
+	free(items);
+	return status;
+}
+
+/*
+Report probe
+* Input: ProbeRun, file name and what was found
+*Output: One line per file, quiet runs print the payloads only
+*/
+static void report_probe(const ProbeRun *run, const char *path, const ProbeResult *result)
+{
+	char crc[32];
+
+	switch(result -> verdict)
+	{
+	case probe_payload:
+		//One printf per line, the workers report concurrently
+		snprintf(crc, sizeof(crc), ", crc32c %08x", result -> payload_crc);
+		printf("%s: payload %s, %llu bytes, depth %u%s%s%s%s\n", path, result -> container ? "container" : result -> extension, (unsigned long long)result -> payload_size,
+		       result -> depth, result -> compressed ? ", compressed" : "", result -> scattered ? ", scattered" : "",
+		       result -> encrypted ? ", encrypted" : "", result -> has_crc ? crc : "");
+		break;
+	case probe_unsupported:
+		printf("%s: payload with options this version does not support\n", path);
+		break;
+	case probe_no_payload:
+		if(!run -> quiet)
+			printf("%s: no payload\n", path);
+		break;
+	case probe_not_bmp:
+		if(!run -> quiet)
+			printf("%s: not an uncompressed 24 or 32 bit BMP\n", path);
+		break;
+	}
+}
+
+/*
+Probe worker
+* Input: ProbeRun
+*Description: Takes items from the stack until it is empty and no other
+worker is busy, as a busy worker may still push a directory's entries.
+*/
+static void *probe_worker(void *arg)
+{
+	ProbeRun *run = arg;
+	size_t files = 0, payloads = 0, errors = 0;
+
+	pthread_mutex_lock(&run -> lock);
+	for(;;)
+	{
+		while(run -> num_items == 0 && run -> busy > 0)
+			pthread_cond_wait(&run -> cond, &run -> lock);
+		if(run -> num_items == 0)
+			break;
+
+		ProbeItem item = run -> stack[--run -> num_items];
+		run -> busy++;
+		pthread_mutex_unlock(&run -> lock);
+
+		ProbeResult result;
+		if(item.is_dir)
+		{
+			if(list_directory(run, item.path) != e_success)
+			{
+				fprintf(stderr, "ERROR: Unable to read directory %s\n", item.path);
+				errors++;
+			}
+		}
+		else if(probe_file(item.path, &result) != e_success)
+		{
+			fprintf(stderr, "ERROR: Unable to probe %s\n", item.path);
+			errors++;
+		}
+		else
+		{
+			report_probe(run, item.path, &result);
+			files++;
+			payloads += (result.verdict == probe_payload);
+		}
+		free(item.path);
+
+		pthread_mutex_lock(&run -> lock);
+		run -> busy--;
+		pthread_cond_broadcast(&run -> cond);
+	}
+
+	run -> files += files;
+	run -> payloads += payloads;
+	run -> errors += errors;
+	pthread_cond_broadcast(&run -> cond);
+	pthread_mutex_unlock(&run -> lock);
+	return NULL;
+}
+
+/*
+Do probe
+* Input: Files and directories, number of worker threads, quiet and statistics flags
+*Output: e_success unless a file or directory could not be read
+*Description: Files named on the command line are probed whatever their
+extension, directories are walked for .bmp files. Prints one line per
+file and a summary with the probe rate.
+*/
+Status do_probe(char *paths[], int num_paths, int num_threads, int quiet, int print_stats)
+{
+	ProbeRun run = { 0 };
+	RunStats stats;
+	Status status = e_success;
+
+	pthread_mutex_init(&run.lock, NULL);
+	pthread_cond_init(&run.cond, NULL);
+	run.quiet = quiet;
+
+	for(int i = 0; i < num_paths && status == e_success; i++)
+	{
+		struct stat st;
+		ProbeItem item = { strdup(paths[i]), stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode) };
+		if(item.path == NULL || push_items(&run, &item, 1) != e_success)
+		{
+			free(item.path);
+			status = e_failure;
+		}
+	}
+
+	if(print_stats)
+	{
+		stats_init(&stats, "probe");
+		stats_stage_begin(&stats, "probe_files");
+	}
+
+	double start = stats_now();
+	pthread_t *workers = calloc(num_threads > 1 ? num_threads : 1, sizeof(pthread_t));
+	int started = 1;
+	if(status == e_success && workers != NULL)
+	{
+		for(; started < num_threads; started++)
+		{
+			if(pthread_create(&workers[started], NULL, probe_worker, &run) != 0)
+				break;
+		}
+		probe_worker(&run);
+		for(int w = 1; w < started; w++)
+			pthread_join(workers[w], NULL);
+	}
+	else
+		status = e_failure;
+	double seconds = stats_now() - start;
+
+	if(run.errors)
+		status = e_failure;
+	if(print_stats)
+	{
+		stats_stage_end(&stats, status);
+		stats_print_json(&stats, stdout);
+	}
+	printf("Probe: %zu files, %zu with payload, %zu errors, %.3f s, %.1f files/s\n", run.files, run.payloads,
+	       run.errors, seconds, seconds > 0 ? run.files / seconds : 0.0);
+
+	for(size_t i = 0; i < run.num_items; i++)
+		free(run.stack[i].path);
+	free(run.stack);
+	free(workers);
+	pthread_mutex_destroy(&run.lock);
+	pthread_cond_destroy(&run.cond);
+	return status;
+}
@@ -0,0 +1,54 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "common.h"
+#include "chacha20.h"
+
+/*
+ * Probe mode: tells whether BMP files carry hidden data by
+ * reading only the carriers of the magic string and of the
+ * header fields, never the payload, and without writing
+ * anything. Directory trees are walked by the workers
+ * themselves: a directory taken from the shared stack is
+ * listed and its subdirectories and .bmp files pushed back.
+ * Symbolic links met during the walk are not followed.
+ */
+
+/* Carriers of the magic string, extension size field, longest extension, size, salt, key check and CRC fields */
+#define PROBE_MAX_CARRIERS (8 * (sizeof(MAGIC_STRING) - 1) + 32 + 8 * HEADER_EXTN_SIZE_MASK + HEADER_SIZE_CARRIERS(HEADER_VERSION) + 8 * CHACHA20_SALT_SIZE + 32 + 32)
+
+/* File span read for those carriers, padding and alpha bytes add at most a third */
+#define PROBE_SPAN_SIZE 4096
+
+/* What a probe found */
+typedef enum
+{
+    probe_not_bmp,          /* not an uncompressed 24 or 32 bit BMP */
+    probe_no_payload,       /* no magic string or inconsistent header */
+    probe_unsupported,      /* magic string with option bits of a newer version */
+    probe_payload           /* hidden data, the fields below are set */
+} ProbeVerdict;
+
+typedef struct _ProbeResult
+{
+    ProbeVerdict verdict;
+    char extension[HEADER_EXTN_SIZE_MASK + 1];
+    uint depth;
+    int compressed;
+    int scattered;
+    int encrypted;
+    int container;          /* payload is a container of files, extension is empty */
+    int has_crc;            /* payload_crc is set, images of older versions have none */
+    uint payload_crc;
+    uint64_t payload_size;  /* bytes embedded, the compressed size with -z */
+} ProbeResult;
+
+/* Probe one file, e_failure only when it cannot be read */
+Status probe_file(const char *fname, ProbeResult *result);
+
+/* Probe files and directory trees on num_threads workers, one line per file and a summary */
+Status do_probe(char *paths[], int num_paths, int num_threads, int quiet, int print_stats);
+
+#endif
@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include "scatter.h"
+#include "lsb.h"
+
+/* Function Definitions */
+
+/* Next number of a splitmix64 sequence */
+static inline uint64_t next_random(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/*
+Scatter key
+* Input: Passphrase
+*Output: 64 bit key, FNV-1a of the passphrase mixed by splitmix64
+*/
+uint64_t scatter_key(const char *passphrase)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	for(const unsigned char *p = (const unsigned char *)passphrase; *p != '\0'; p++)
+		hash = (hash ^ *p) * 0x100000001B3ULL;
+	return next_random(&hash);
+}
+
+/*
+Scatter init
+* Input: ScatterMap, key, number of data carriers, payload size and depth
+*Output: e_success when the payload fits, e_failure otherwise
+*Description: The carriers are cut into the fewest tiles of at most
+SCATTER_TILE carriers, all of the same size; the few carriers left over
+at the end are not used. Tile t holds payload groups G * t / T up to
+G * (t + 1) / T, never more than G / T rounded up.
+*/
+Status scatter_init(ScatterMap *map, uint64_t key, size_t carriers, size_t size, int depth)
+{
+	size_t group_bytes = LSB_GROUP_BYTES(depth);
+	size_t group_carriers = lsb_image_bytes(group_bytes, depth);
+
+	map -> key = key;
+	map -> depth = depth;
+	map -> size = size;
+	map -> num_tiles = (carriers + SCATTER_TILE - 1) / SCATTER_TILE;
+	map -> tile_size = map -> num_tiles ? (carriers / map -> num_tiles) & ~(size_t)7 : 0;
+	map -> groups = size / group_bytes + (size % group_bytes != 0);
+
+	if(map -> groups == 0)
+		return e_success;
+	if(map -> num_tiles == 0 || map -> groups > carriers)
+		return e_failure;
+	return ((map -> groups + map -> num_tiles - 1) / map -> num_tiles * group_carriers <= map -> tile_size) ? e_success : e_failure;
+}
+
+/* First group of a tile, G * t / T without overflowing */
+static size_t tile_first_group(const ScatterMap *map, size_t tile)
+{
+	size_t quotient = map -> groups / map -> num_tiles;
+	size_t remainder = map -> groups % map -> num_tiles;
+	return tile * quotient + tile * remainder / map -> num_tiles;
+}
+
+/*
+Scatter tile range
+* Input: ScatterMap and a tile index
+*Output: Payload bytes [*start, *end) held by the tile, empty for tiles
+without a group
+*/
+void scatter_tile_range(const ScatterMap *map, size_t tile, size_t *start, size_t *end)
+{
+	size_t group_bytes = LSB_GROUP_BYTES(map -> depth);
+
+	if(map -> groups == 0)
+	{
+		*start = *end = 0;
+		return;
+	}
+
+	*start = tile_first_group(map, tile) * group_bytes;
+	*end = tile_first_group(map, tile + 1) * group_bytes;
+	if(*start > map -> size)
+		*start = map -> size;
+	if(*end > map -> size)
+		*end = map -> size;
+}
+
+/*
+Shuffle tile
+* Input: ScatterMap, tile index, dense carriers of the tile, number of
+carriers to pick and scratch area
+*Output: The first count positions are the picked tile offsets, in the order
+the payload bits fill them, and selected holds their carriers
+*Description: A Fisher-Yates shuffle stopped after count draws, seeded from
+the key and the tile index. Each 64 bit random number gives two draws,
+which are unbiased enough for tiles of at most 2^16 carriers.
+*/
+static void shuffle_tile(const ScatterMap *map, size_t tile, const unsigned char *carriers, size_t count, ScatterScratch *scratch)
+{
+	uint64_t state = map -> key ^ (tile * 0xD1B54A32D192ED03ULL);
+	uint16_t *positions = scratch -> positions;
+	size_t size = map -> tile_size;
+	uint64_t bits = 0;
+
+	for(size_t i = 0; i < size; i++)
+		positions[i] = i;
+
+	for(size_t j = 0; j < count; j++)
+	{
+		if((j & 1) == 0)
+			bits = next_random(&state);
+		else
+			bits >>= 32;
+
+		size_t r = j + (((bits & 0xFFFFFFFF) * (size - j)) >> 32);
+		uint16_t picked = positions[r];
+		positions[r] = positions[j];
+		positions[j] = picked;
+		scratch -> selected[j] = carriers[picked];
+	}
+}
+
+/*
+Scatter encode tile
+* Input: ScatterMap, tile index, payload bytes of the tile, dense carriers of
+the tile and a scratch area
+*Output: The picked carriers hold the payload at the map's depth
+*Description: The picked carriers are gathered, encoded by the depth kernel
+like consecutive carriers and put back, so tiles are as fast as the kernel
+plus one random access per carrier inside the cached tile.
+*/
+void scatter_encode_tile(const ScatterMap *map, size_t tile, const char *data, unsigned char *carriers, ScatterScratch *scratch)
+{
+	size_t start, end;
+
+	scatter_tile_range(map, tile, &start, &end);
+	if(start == end)
+		return;
+
+	size_t count = lsb_image_bytes(end - start, map -> depth);
+	shuffle_tile(map, tile, carriers, count, scratch);
+	encode_bytes_to_lsb_depth(data, end - start, (char *)scratch -> selected, map -> depth);
+	for(size_t j = 0; j < count; j++)
+		carriers[scratch -> positions[j]] = scratch -> selected[j];
+}
+
+/*
+Scatter decode tile
+* Input: ScatterMap, tile index, dense carriers of the tile, output buffer
+and a scratch area
+*Output: Payload bytes of the tile
+*/
+void scatter_decode_tile(const ScatterMap *map, size_t tile, const unsigned char *carriers, char *data, ScatterScratch *scratch)
+{
+	size_t start, end;
+
+	scatter_tile_range(map, tile, &start, &end);
+	if(start == end)
+		return;
+
+	size_t count = lsb_image_bytes(end - start, map -> depth);
+	shuffle_tile(map, tile, carriers, count, scratch);
+	decode_bytes_from_lsb_depth((const char *)scratch -> selected, end - start, data, map -> depth);
+}
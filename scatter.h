@@ -0,0 +1,63 @@
+#ifndef SCATTER_H
+#define SCATTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Keyed scatter of the secret data: rather than filling the
+ * carriers right after the header, the payload is spread over
+ * the whole image by a permutation derived from a passphrase.
+ * The data carriers are cut into tiles of equal size, at most
+ * SCATTER_TILE carriers, and every tile holds an even share of
+ * the payload groups (see LSB_GROUP_BYTES). Inside a tile a
+ * keyed shuffle picks which carriers receive the tile's bits,
+ * so the random accesses stay within a tile that fits in the
+ * L2 cache, and tiles are visited in file order like the spans
+ * of the consecutive layout. The permutation of a tile depends
+ * only on the key and the tile index, so tiles are encoded and
+ * decoded independently. The key hides where the data is, it
+ * does not encrypt it.
+ */
+
+/* Most carriers per tile, tile offsets fit in 16 bits */
+#define SCATTER_TILE (64 * 1024)
+
+/* Tiles per task of the multi-threaded encoder and decoder */
+#define SCATTER_STRIPE_TILES 16
+
+typedef struct _ScatterMap
+{
+    uint64_t key;
+    int depth;
+    size_t size;            /* payload bytes */
+    size_t tile_size;       /* carriers per tile, a multiple of 8 */
+    size_t num_tiles;
+    size_t groups;          /* payload groups, the last one may be partial */
+} ScatterMap;
+
+/* Work area of one thread encoding or decoding tiles */
+typedef struct _ScatterScratch
+{
+    uint16_t positions[SCATTER_TILE];       /* tile offsets, shuffled */
+    unsigned char selected[SCATTER_TILE];   /* carriers picked by the shuffle */
+    unsigned char carriers[SCATTER_TILE];   /* for the caller, dense carriers of a tile */
+} ScatterScratch;
+
+/* Key of a passphrase */
+uint64_t scatter_key(const char *passphrase);
+
+/* Lay out size payload bytes at depth over carriers data carriers, e_failure when they do not fit */
+Status scatter_init(ScatterMap *map, uint64_t key, size_t carriers, size_t size, int depth);
+
+/* Payload bytes [*start, *end) held by a tile */
+void scatter_tile_range(const ScatterMap *map, size_t tile, size_t *start, size_t *end);
+
+/* Embed the payload bytes of a tile (from scatter_tile_range) into its tile_size dense carriers */
+void scatter_encode_tile(const ScatterMap *map, size_t tile, const char *data, unsigned char *carriers, ScatterScratch *scratch);
+
+/* Extract the payload bytes of a tile (from scatter_tile_range) from its tile_size dense carriers */
+void scatter_decode_tile(const ScatterMap *map, size_t tile, const unsigned char *carriers, char *data, ScatterScratch *scratch);
+
+#endif
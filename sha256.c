@@ -0,0 +1,189 @@
+#include <string.h>
+#include "sha256.h"
+
+/* Round constants, the first 32 bits of the fractional parts of the cube roots of the first 64 primes */
+static const uint32_t K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Function Definitions */
+
+/* Hash one 64 byte block into the state */
+static void compress_block(uint32_t state[8], const unsigned char *block)
+{
+	uint32_t w[64];
+
+	for(int i = 0; i < 16; i++)
+		w[i] = (uint32_t)block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+	for(int i = 16; i < 64; i++)
+	{
+		uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for(int i = 0; i < 64; i++)
+	{
+		uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+		uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+void sha256_init(Sha256 *ctx)
+{
+	static const uint32_t initial[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(ctx -> state, initial, sizeof(initial));
+	ctx -> length = 0;
+}
+
+void sha256_update(Sha256 *ctx, const void *data, size_t n)
+{
+	const unsigned char *bytes = data;
+	size_t used = ctx -> length % SHA256_BLOCK_SIZE;
+
+	ctx -> length += n;
+
+	//Complete the pending block first
+	if(used > 0)
+	{
+		size_t take = (n < SHA256_BLOCK_SIZE - used) ? n : SHA256_BLOCK_SIZE - used;
+		memcpy(ctx -> block + used, bytes, take);
+		bytes += take;
+		n -= take;
+		if(used + take < SHA256_BLOCK_SIZE)
+			return;
+		compress_block(ctx -> state, ctx -> block);
+	}
+
+	for(; n >= SHA256_BLOCK_SIZE; n -= SHA256_BLOCK_SIZE, bytes += SHA256_BLOCK_SIZE)
+		compress_block(ctx -> state, bytes);
+	memcpy(ctx -> block, bytes, n);
+}
+
+void sha256_final(Sha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+	uint64_t bits = ctx -> length * 8;
+	size_t used = ctx -> length % SHA256_BLOCK_SIZE;
+
+	//A 1 bit, zeros up to 8 bytes before a block end, and the length in bits
+	ctx -> block[used++] = 0x80;
+	if(used > SHA256_BLOCK_SIZE - 8)
+	{
+		memset(ctx -> block + used, 0, SHA256_BLOCK_SIZE - used);
+		compress_block(ctx -> state, ctx -> block);
+		used = 0;
+	}
+	memset(ctx -> block + used, 0, SHA256_BLOCK_SIZE - 8 - used);
+	for(int i = 0; i < 8; i++)
+		ctx -> block[SHA256_BLOCK_SIZE - 1 - i] = bits >> (8 * i);
+	compress_block(ctx -> state, ctx -> block);
+
+	for(int i = 0; i < 8; i++)
+	{
+		digest[4 * i] = ctx -> state[i] >> 24;
+		digest[4 * i + 1] = ctx -> state[i] >> 16;
+		digest[4 * i + 2] = ctx -> state[i] >> 8;
+		digest[4 * i + 3] = ctx -> state[i];
+	}
+}
+
+/*
+PBKDF2-HMAC-SHA256
+* Input: Password, salt, number of iterations and size of the output
+*Output: size derived bytes in out
+*Description: The inner and outer HMAC states are keyed once, so every
+iteration costs two block compressions.
+*/
+void pbkdf2_sha256(const char *password, size_t password_size, const unsigned char *salt, size_t salt_size,
+                   unsigned iterations, unsigned char *out, size_t size)
+{
+	unsigned char key[SHA256_BLOCK_SIZE] = { 0 };
+	unsigned char pad[SHA256_BLOCK_SIZE];
+	Sha256 inner, outer, ctx;
+
+	//Passwords longer than a block are hashed first
+	if(password_size > SHA256_BLOCK_SIZE)
+	{
+		sha256_init(&ctx);
+		sha256_update(&ctx, password, password_size);
+		sha256_final(&ctx, key);
+	}
+	else
+		memcpy(key, password, password_size);
+
+	for(int i = 0; i < SHA256_BLOCK_SIZE; i++)
+		pad[i] = key[i] ^ 0x36;
+	sha256_init(&inner);
+	sha256_update(&inner, pad, SHA256_BLOCK_SIZE);
+	for(int i = 0; i < SHA256_BLOCK_SIZE; i++)
+		pad[i] = key[i] ^ 0x5c;
+	sha256_init(&outer);
+	sha256_update(&outer, pad, SHA256_BLOCK_SIZE);
+
+	for(uint32_t block = 1; size > 0; block++)
+	{
+		unsigned char index[4] = { block >> 24, block >> 16, block >> 8, block };
+		unsigned char u[SHA256_DIGEST_SIZE], t[SHA256_DIGEST_SIZE];
+
+		//U1 = HMAC(password, salt || block)
+		ctx = inner;
+		sha256_update(&ctx, salt, salt_size);
+		sha256_update(&ctx, index, 4);
+		sha256_final(&ctx, u);
+		ctx = outer;
+		sha256_update(&ctx, u, SHA256_DIGEST_SIZE);
+		sha256_final(&ctx, u);
+		memcpy(t, u, SHA256_DIGEST_SIZE);
+
+		//Un = HMAC(password, Un-1), T = U1 ^ ... ^ Un
+		for(unsigned n = 1; n < iterations; n++)
+		{
+			ctx = inner;
+			sha256_update(&ctx, u, SHA256_DIGEST_SIZE);
+			sha256_final(&ctx, u);
+			ctx = outer;
+			sha256_update(&ctx, u, SHA256_DIGEST_SIZE);
+			sha256_final(&ctx, u);
+			for(int i = 0; i < SHA256_DIGEST_SIZE; i++)
+				t[i] ^= u[i];
+		}
+
+		size_t take = (size < SHA256_DIGEST_SIZE) ? size : SHA256_DIGEST_SIZE;
+		memcpy(out, t, take);
+		out += take;
+		size -= take;
+	}
+}
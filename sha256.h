@@ -0,0 +1,37 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * SHA-256 (FIPS 180-4) and PBKDF2-HMAC-SHA256 (RFC 8018), used
+ * to derive the key of encrypted secret data from a passphrase
+ * (see chacha20.h). Portable C, the key is derived once per
+ * image so speed is of no concern.
+ */
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+typedef struct _Sha256
+{
+    uint32_t state[8];
+    uint64_t length;                        /* bytes hashed so far */
+    unsigned char block[SHA256_BLOCK_SIZE]; /* pending bytes of the next block */
+} Sha256;
+
+/* Start a hash */
+void sha256_init(Sha256 *ctx);
+
+/* Hash n more bytes */
+void sha256_update(Sha256 *ctx, const void *data, size_t n);
+
+/* Finish the hash, ctx must be started again before reuse */
+void sha256_final(Sha256 *ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+/* Derive size bytes from a password and a salt with iterations rounds of HMAC-SHA256 */
+void pbkdf2_sha256(const char *password, size_t password_size, const unsigned char *salt, size_t salt_size,
+                   unsigned iterations, unsigned char *out, size_t size);
+
+#endif
@@ -0,0 +1,131 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+#include "types.h"
+
+/* Names of the IoKind values in the JSON output */
+static const char *io_kind_names[io_num_kinds] = { "read", "write", "copy", "map", "clone" };
+
+/* Process wide counters, updated with relaxed atomics */
+static IoCounters io_totals;
+
+/* Function Definitions */
+
+/*
+Count I/O
+* Input: Kind of call and number of bytes it moved
+*Description: Safe to call from any thread.
+*/
+void stats_count_io(IoKind kind, size_t bytes)
+{
+	__atomic_fetch_add(&io_totals.calls[kind], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&io_totals.bytes[kind], bytes, __ATOMIC_RELAXED);
+}
+
+/* Copy of the process wide counters */
+static void snapshot_io(IoCounters *io)
+{
+	for(int k = 0; k < io_num_kinds; k++)
+	{
+		io -> calls[k] = __atomic_load_n(&io_totals.calls[k], __ATOMIC_RELAXED);
+		io -> bytes[k] = __atomic_load_n(&io_totals.bytes[k], __ATOMIC_RELAXED);
+	}
+}
+
+/* Monotonic clock in seconds */
+double stats_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+Stats init
+* Input: Run statistics and operation name
+*Output: Empty run, stages are added by RUN_STAGE
+*/
+void stats_init(RunStats *stats, const char *operation)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats -> operation = operation;
+}
+
+/*
+Stage begin
+* Input: Run statistics (may be NULL) and stage name
+*Description: Stages past MAX_STAGES are not recorded.
+*/
+void stats_stage_begin(RunStats *stats, const char *name)
+{
+	if(stats == NULL || stats -> num_stages == MAX_STAGES)
+		return;
+
+	stats -> stage[stats -> num_stages].name = name;
+	snapshot_io(&stats -> io_start);
+	stats -> stage_start = stats_now();
+}
+
+/*
+Stage end
+* Input: Run statistics (may be NULL) and the status of the stage
+*Output: The status, so that the call can stay in the if of the caller
+*/
+Status stats_stage_end(RunStats *stats, Status status)
+{
+	if(stats == NULL || stats -> num_stages == MAX_STAGES)
+		return status;
+
+	StageStats *stage = &stats -> stage[stats -> num_stages++];
+	IoCounters now;
+
+	stage -> seconds = stats_now() - stats -> stage_start;
+	snapshot_io(&now);
+	for(int k = 0; k < io_num_kinds; k++)
+	{
+		stage -> io.calls[k] = now.calls[k] - stats -> io_start.calls[k];
+		stage -> io.bytes[k] = now.bytes[k] - stats -> io_start.bytes[k];
+	}
+	return status;
+}
+
+/* Print the counters as JSON members */
+static void print_io_json(const IoCounters *io, FILE *fptr)
+{
+	for(int k = 0; k < io_num_kinds; k++)
+		fprintf(fptr, ", \"%s_calls\": %llu, \"%s_bytes\": %llu", io_kind_names[k], io -> calls[k],
+		        io_kind_names[k], io -> bytes[k]);
+}
+
+/*
+Print JSON
+* Input: Run statistics and output stream
+*Output: One line holding the per stage objects and their totals
+*/
+void stats_print_json(const RunStats *stats, FILE *fptr)
+{
+	IoCounters total = { { 0 }, { 0 } };
+	double seconds = 0;
+
+	fprintf(fptr, "{\"operation\": \"%s\", \"stages\": [", stats -> operation);
+	for(int i = 0; i < stats -> num_stages; i++)
+	{
+		const StageStats *stage = &stats -> stage[i];
+
+		fprintf(fptr, "%s{\"name\": \"%s\", \"seconds\": %.6f", i ? ", " : "", stage -> name, stage -> seconds);
+		print_io_json(&stage -> io, fptr);
+		fputc('}', fptr);
+
+		seconds += stage -> seconds;
+		for(int k = 0; k < io_num_kinds; k++)
+		{
+			total.calls[k] += stage -> io.calls[k];
+			total.bytes[k] += stage -> io.bytes[k];
+		}
+	}
+	fprintf(fptr, "], \"total\": {\"seconds\": %.6f", seconds);
+	print_io_json(&total, fptr);
+	fprintf(fptr, "}}\n");
+}
@@ -0,0 +1,78 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Run statistics: wall time of every stage of an encoding
+ * or decoding, and the I/O issued while the stage ran.
+ * The I/O counters are process wide; stages only record
+ * the difference, so with concurrent jobs (batch -j N) a
+ * stage also sees the I/O of the other jobs.
+ */
+
+/* Most stages recorded for one run */
+#define MAX_STAGES 16
+
+/* Kinds of I/O calls counted */
+typedef enum
+{
+    io_read,      /* read, pread, fread */
+    io_write,     /* write, pwrite, fwrite */
+    io_copy,      /* copy_file_range, sendfile */
+    io_map,       /* mmap, bytes are the mapping size */
+    io_clone,     /* FICLONE, bytes are the size shared, not moved */
+    io_num_kinds
+} IoKind;
+
+typedef struct _IoCounters
+{
+    unsigned long long calls[io_num_kinds];
+    unsigned long long bytes[io_num_kinds];
+} IoCounters;
+
+typedef struct _StageStats
+{
+    const char *name;
+    double seconds;
+    IoCounters io;
+} StageStats;
+
+typedef struct _RunStats
+{
+    const char *operation;
+    StageStats stage[MAX_STAGES];
+    int num_stages;
+    double stage_start;
+    IoCounters io_start;
+} RunStats;
+
+/*
+ * Run one stage of do_encoding/do_decoding, returns the
+ * Status of call. Does nothing more than call when
+ * (info)->stats is NULL.
+ */
+#define RUN_STAGE(info, name, call) \
+    (stats_stage_begin((info)->stats, name), stats_stage_end((info)->stats, (call)))
+
+/* Count one I/O call of the given kind moving bytes bytes */
+void stats_count_io(IoKind kind, size_t bytes);
+
+/* Monotonic clock in seconds */
+double stats_now(void);
+
+/* Start a run, operation is "encode" or "decode" */
+void stats_init(RunStats *stats, const char *operation);
+
+/* Start timing a stage */
+void stats_stage_begin(RunStats *stats, const char *name);
+
+/* Finish the current stage, returns status unchanged */
+Status stats_stage_end(RunStats *stats, Status status);
+
+/* Print the run as one JSON object */
+void stats_print_json(const RunStats *stats, FILE *fptr);
+
+#endif
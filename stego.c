@@ -0,0 +1,203 @@
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stego.h"
+#include "bmp.h"
+#include "common.h"
+#include "lsb.h"
+#include "types.h"
+
+/* Function Definitions */
+
+/*
+Context init
+* Input: Context
+*Output: Default options and empty encoder and decoder state
+*/
+void stego_context_init(StegoContext *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx -> depth = 1;
+	ctx -> num_threads = 1;
+}
+
+/*
+Context free
+* Input: Context
+*Output: Frees the buffers kept across calls, the context can be initialised again
+*/
+void stego_context_free(StegoContext *ctx)
+{
+	release_encode_info(&ctx -> encInfo);
+	release_decode_info(&ctx -> decInfo);
+}
+
+/*
+Capacity
+* Input: Cover image, its size and a depth
+*Output: Largest secret (before compression) that fits
+*Description: The header fields take 1 bit per carrier byte and a 4 byte
+extension, the secret data depth bits per carrier byte. The salt and key
+check value of encrypted secrets take 160 more carrier bytes, which are
+not counted.
+*/
+size_t stego_capacity(const unsigned char *cover, size_t cover_size, uint depth)
+{
+	BmpInfo bmp;
+	size_t header = 8 * strlen(MAGIC_STRING) + 32 + 8 * strlen(strchr(STEGO_SECRET_NAME, '.')) + HEADER_SIZE_CARRIERS(HEADER_VERSION) + 32;
+
+	if(depth < 1 || depth > LSB_MAX_DEPTH ||
+	   bmp_parse_header(cover, (cover_size < BMP_MAX_HEADER_SIZE) ? cover_size : BMP_MAX_HEADER_SIZE, &bmp) != e_success)
+		return 0;
+
+	//Only the carriers present in the buffer
+	size_t carriers = bmp_capacity(&bmp);
+	if(bmp_carrier_end(&bmp, carriers) > cover_size)
+		carriers = bmp_carriers_before(&bmp, cover_size);
+
+	return (carriers > header) ? lsb_payload_capacity(carriers - header, depth) : 0;
+}
+
+/*
+Encode
+* Input: Context, cover image and its size, secret and its size, output buffer
+*Output: Stego image in stego, e_failure when the secret does not fit
+*Description: Runs do_encoding with the context's encoder in memory mode.
+When stego is the cover the image is modified in place and only the
+carriers of the secret are written.
+*/
+Status stego_encode(StegoContext *ctx, const unsigned char *cover, size_t cover_size,
+                    const char *secret, size_t size, unsigned char *stego)
+{
+	EncodeInfo *encInfo = &ctx -> encInfo;
+
+	//Compressed secrets need LZ_COMPRESS_BOUND(size) bytes, which must not overflow;
+	//the capacity check compares payload bytes, so any other size is safe
+	if(ctx -> depth < 1 || ctx -> depth > LSB_MAX_DEPTH || size > SIZE_MAX / 2)
+		return e_failure;
+
+	encInfo -> src_image_fname = "cover image";
+	encInfo -> secret_fname = STEGO_SECRET_NAME;
+	encInfo -> stego_image_fname = "stego image";
+	encInfo -> in_memory = 1;
+	encInfo -> src_map = (unsigned char *)cover;
+	encInfo -> stego_map = stego;
+	encInfo -> map_size = cover_size;
+	encInfo -> image_pos = 0;
+	encInfo -> in_place = (stego == cover);
+	encInfo -> secret_bytes = secret;
+	encInfo -> size_secret_file = size;
+	encInfo -> bits_per_pixel = ctx -> depth;
+	encInfo -> compress = ctx -> compress;
+	encInfo -> passphrase = ctx -> passphrase;
+	encInfo -> cipher_passphrase = ctx -> cipher_passphrase;
+	encInfo -> num_threads = ctx -> num_threads;
+	encInfo -> quiet = 1;
+	encInfo -> stats = ctx -> stats;
+
+	Status status = do_encoding(encInfo);
+
+	//Nothing of the caller's is kept
+	encInfo -> src_map = NULL;
+	encInfo -> stego_map = NULL;
+	encInfo -> secret_bytes = NULL;
+	return status;
+}
+
+/*
+Decode to output
+* Input: Context, stego image and its size, output buffer and its capacity,
+whether the decoder may grow the output
+*Output: Status of do_decoding, the secret in decInfo.output
+*/
+static Status decode_to_output(StegoContext *ctx, const unsigned char *stego, size_t stego_size,
+                               char *output, size_t capacity, int grow)
+{
+	DecodeInfo *decInfo = &ctx -> decInfo;
+
+	decInfo -> d_stego_image_fname = "stego image";
+	decInfo -> decoded_fname = "secret buffer";
+	decInfo -> in_memory = 1;
+	decInfo -> stego_map = (unsigned char *)stego;
+	decInfo -> map_size = stego_size;
+	decInfo -> image_pos = 0;
+	decInfo -> output = output;
+	decInfo -> output_capacity = capacity;
+	decInfo -> output_size = 0;
+	decInfo -> output_grow = grow;
+	decInfo -> num_threads = ctx -> num_threads;
+	decInfo -> passphrase = ctx -> passphrase;
+	decInfo -> cipher_passphrase = ctx -> cipher_passphrase;
+	decInfo -> quiet = 1;
+	decInfo -> stats = ctx -> stats;
+
+	Status status = do_decoding(decInfo);
+
+	decInfo -> stego_map = NULL;
+	decInfo -> output_grow = 0;
+	return status;
+}
+
+/*
+Decode
+* Input: Context, stego image and its size, output buffer and its capacity
+*Output: Secret in the output buffer and its size, d_failure when the image
+has no secret or it does not fit
+*Description: Runs do_decoding with the context's decoder in memory mode.
+Compressed secrets are decompressed into the output buffer.
+*/
+Status stego_decode(StegoContext *ctx, const unsigned char *stego, size_t stego_size,
+                    char *secret, size_t capacity, size_t *size)
+{
+	Status status = decode_to_output(ctx, stego, stego_size, secret, capacity, 0);
+
+	*size = ctx -> decInfo.output_size;
+	ctx -> decInfo.output = NULL;
+	return status;
+}
+
+/*
+Decode range
+* Input: Context, stego image and its size, offset and length of the slice,
+output buffer and its capacity
+*Output: The slice in the output buffer and its size, shorter when the secret
+ends before offset + length
+*Description: Only the carriers of the slice are decoded (see
+decode_secret_slice), compressed secrets from their start. The CRC of the
+secret is not checked.
+*/
+Status stego_decode_range(StegoContext *ctx, const unsigned char *stego, size_t stego_size, size_t offset,
+                          size_t length, char *secret, size_t capacity, size_t *size)
+{
+	ctx -> decInfo.slice = 1;
+	ctx -> decInfo.slice_offset = offset;
+	ctx -> decInfo.slice_length = length;
+	Status status = stego_decode(ctx, stego, stego_size, secret, capacity, size);
+	ctx -> decInfo.slice = 0;
+	return status;
+}
+
+/*
+Decode and allocate
+* Input: Context, stego image and its size
+*Output: Secret in a malloc'ed buffer and its size, NULL and 0 on failures
+*Description: For callers that cannot bound the secret size, compressed
+secrets in particular. The buffer grows by doubling as the secret is decoded.
+*/
+Status stego_decode_alloc(StegoContext *ctx, const unsigned char *stego, size_t stego_size,
+                          char **secret, size_t *size)
+{
+	Status status = decode_to_output(ctx, stego, stego_size, NULL, 0, 1);
+
+	*secret = ctx -> decInfo.output;
+	*size = ctx -> decInfo.output_size;
+	if(status != d_success)
+	{
+		free(*secret);
+		*secret = NULL;
+		*size = 0;
+	}
+	ctx -> decInfo.output = NULL;
+	return status;
+}
@@ -0,0 +1,65 @@
+#ifndef STEGO_H
+#define STEGO_H
+
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+#include "encode.h"
+#include "decode.h"
+#include "stats.h"
+
+/*
+ * In-memory API: hides a secret held in memory in a BMP cover
+ * held in memory and gets it back, without any file access.
+ * The stages of the command line tool run on the buffers (see
+ * the in_memory fields of EncodeInfo and DecodeInfo), so the
+ * stego images are the same byte for byte.
+ * A StegoContext keeps the encoder and decoder state and their
+ * buffers (compressed secret, carrier spans, decoded chunks)
+ * across calls, so a long running service reuses them rather
+ * than allocating per image. A context must not be used by two
+ * threads at the same time.
+ */
+
+/* Extension recorded for in-memory secrets */
+#define STEGO_SECRET_NAME "secret.txt"
+
+typedef struct _StegoContext
+{
+    /* Options, may be changed between calls */
+    uint depth;             /* LSBs per image byte for the secret data, 1 to LSB_MAX_DEPTH */
+    int compress;           /* compress the secret before embedding it */
+    int num_threads;        /* threads encoding or decoding stripes */
+    const char *passphrase; /* scatter the secret data with this key (scatter.h), NULL for consecutive carriers */
+    const char *cipher_passphrase; /* encrypt the secret data with this passphrase (chacha20.h), NULL to embed it as is */
+    RunStats *stats;        /* per stage statistics of the calls, NULL when not collected */
+
+    EncodeInfo encInfo;
+    DecodeInfo decInfo;
+} StegoContext;
+
+/* Prepare a context with the default options (depth 1, no compression, 1 thread) */
+void stego_context_init(StegoContext *ctx);
+
+/* Free the buffers of a context */
+void stego_context_free(StegoContext *ctx);
+
+/* Largest secret a cover holds at a depth, 0 for unsupported images */
+size_t stego_capacity(const unsigned char *cover, size_t cover_size, uint depth);
+
+/* Hide size secret bytes in a cover, writing cover_size bytes to stego (which may be the cover itself) */
+Status stego_encode(StegoContext *ctx, const unsigned char *cover, size_t cover_size,
+                    const char *secret, size_t size, unsigned char *stego);
+
+/* Get the secret of a stego image into secret, capacity bytes at most, and its size */
+Status stego_decode(StegoContext *ctx, const unsigned char *stego, size_t stego_size,
+                    char *secret, size_t capacity, size_t *size);
+
+/* Get bytes [offset, offset + length) of the secret into secret, capacity bytes at most, and their number */
+Status stego_decode_range(StegoContext *ctx, const unsigned char *stego, size_t stego_size, size_t offset,
+                          size_t length, char *secret, size_t capacity, size_t *size);
+
+/* Get the secret of a stego image into a buffer allocated with malloc, which the caller frees */
+Status stego_decode_alloc(StegoContext *ctx, const unsigned char *stego, size_t stego_size,
+                          char **secret, size_t *size);
+
+#endif
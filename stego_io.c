@@ -0,0 +1,410 @@
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include "stego_io.h"
+#include "stats.h"
+#include "types.h"
+
+/* Largest request handed to a single copy_file_range/sendfile call */
+#define COPY_MAX_CALL ((size_t)1 << 30)
+
+/* Function Definitions */
+
+/*
+Map file for reading
+* Input: FILE pointer opened for reading
+*Output: Address and size of a read-only mapping of the whole file
+*Description: Only regular, non-empty files are mapped. Any other file
+type returns e_failure so that the caller falls back to stdio.
+*/
+Status map_file_for_reading(FILE *fptr, unsigned char **map, size_t *map_size)
+{
+	struct stat st;
+
+	//Only regular files can be mapped
+	if(fstat(fileno(fptr), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return e_failure;
+
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(fptr), 0);
+	if(addr == MAP_FAILED)
+		return e_failure;
+	stats_count_io(io_map, st.st_size);
+
+	//The file is read front to back
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+	*map = addr;
+	*map_size = st.st_size;
+	return e_success;
+}
+
+/*
+Map file for writing
+* Input: FILE pointer opened for writing and the required size
+*Output: Address of a writable shared mapping of map_size bytes
+*Description: Truncates the regular file to map_size bytes and maps it,
+so stores to the mapping end up in the file. Non-regular files
+return e_failure.
+*/
+Status map_file_for_writing(FILE *fptr, size_t map_size, unsigned char **map)
+{
+	struct stat st;
+
+	//Only regular files can be resized and mapped
+	if(fstat(fileno(fptr), &st) != 0 || !S_ISREG(st.st_mode) || map_size == 0)
+		return e_failure;
+
+	if(ftruncate(fileno(fptr), map_size) != 0)
+		return e_failure;
+
+	void *addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(fptr), 0);
+	if(addr == MAP_FAILED)
+		return e_failure;
+	stats_count_io(io_map, map_size);
+
+	*map = addr;
+	return e_success;
+}
+
+/*
+Unmap file
+* Input: Mapping address and size
+*Output: Releases the mapping
+*/
+void unmap_file(unsigned char *map, size_t map_size)
+{
+	if(map != NULL)
+		munmap(map, map_size);
+}
+
+/*
+Read file at
+* Input: File descriptor, buffer, number of bytes and file offset
+*Output: e_success when all n bytes were read
+*Description: pread loop, safe to call from several threads on the same fd.
+*/
+Status read_file_at(int fd, void *buffer, size_t n, off_t offset)
+{
+	for(size_t done = 0; done < n; )
+	{
+		ssize_t bytes_read = pread(fd, (char *)buffer + done, n - done, offset + done);
+		if(bytes_read <= 0)
+			return e_failure;
+		stats_count_io(io_read, bytes_read);
+		done += bytes_read;
+	}
+	return e_success;
+}
+
+/*
+Write file at
+* Input: File descriptor, buffer, number of bytes and file offset
+*Output: e_success when all n bytes were written
+*Description: pwrite loop, safe to call from several threads on the same fd.
+*/
+Status write_file_at(int fd, const void *buffer, size_t n, off_t offset)
+{
+	for(size_t done = 0; done < n; )
+	{
+		ssize_t written = pwrite(fd, (const char *)buffer + done, n - done, offset + done);
+		if(written <= 0)
+			return e_failure;
+		stats_count_io(io_write, written);
+		done += written;
+	}
+	return e_success;
+}
+
+/*
+Release mapped pages
+* Input: Mapping address, offset released so far and the offset already consumed
+*Output: Updates released to the last page boundary below upto
+*Description: Pages that were fully consumed are unmapped from the process
+(they stay in the page cache), so streaming through a large mapping does
+not grow the resident set.
+*/
+void release_mapped_pages(unsigned char *map, size_t *released, size_t upto)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+
+	upto &= ~(page_size - 1);
+	if(map == NULL || upto <= *released)
+		return;
+
+	madvise(map + *released, upto - *released, MADV_DONTNEED);
+	*released = upto;
+}
+
+/*
+Clone file
+* Input: Source fd, destination fd and the source size
+*Output: e_success when dst shares every extent of src
+*Description: FICLONE copies no data, the blocks are shared until either
+file writes them, so the encoder then only pays for the pages it patches.
+Filesystems without reflinks (ext4, tmpfs, ...) fail with EOPNOTSUPP or
+EXDEV/EINVAL and dst is left untouched.
+*/
+Status clone_file(int src_fd, int dst_fd, size_t size)
+{
+#ifdef FICLONE
+	if(ioctl(dst_fd, FICLONE, src_fd) == 0)
+	{
+		stats_count_io(io_clone, size);
+		return e_success;
+	}
+#endif
+	return e_failure;
+}
+
+/*
+Copy file data
+* Input: Source fd and offset, destination fd, number of bytes (or COPY_TO_EOF)
+*Output: e_success once the bytes are written, e_failure on I/O errors
+*Description: The data never passes through user space when the kernel can
+avoid it: copy_file_range between regular files (which can share extents on
+filesystems that support it), then sendfile which also accepts pipes and
+sockets as destination, then a loop over a large page aligned buffer.
+The source is read at explicit offsets so its file position is not used.
+*/
+Status copy_file_data(int src_fd, off_t offset, int dst_fd, size_t length)
+{
+	ssize_t copied;
+
+	//Kernel side copy between regular files
+	while(length > 0 && (copied = copy_file_range(src_fd, &offset, dst_fd, NULL, length < COPY_MAX_CALL ? length : COPY_MAX_CALL, 0)) > 0)
+	{
+		stats_count_io(io_copy, copied);
+		length = (length == COPY_TO_EOF) ? length : length - copied;
+	}
+	if(length == 0 || copied == 0)
+		return e_success;
+	if(errno != EINVAL && errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF)
+		return e_failure;
+
+	//Kernel side copy to any destination
+	while(length > 0 && (copied = sendfile(dst_fd, src_fd, &offset, length < COPY_MAX_CALL ? length : COPY_MAX_CALL)) > 0)
+	{
+		stats_count_io(io_copy, copied);
+		length = (length == COPY_TO_EOF) ? length : length - copied;
+	}
+	if(length == 0 || copied == 0)
+		return e_success;
+	if(errno != EINVAL && errno != ENOSYS)
+		return e_failure;
+
+	//Plain read/write loop
+	char *buffer;
+	if(posix_memalign((void **)&buffer, 4096, COPY_BUF_SIZE) != 0)
+		return e_failure;
+
+	while(length > 0)
+	{
+		ssize_t bytes_read = pread(src_fd, buffer, length < COPY_BUF_SIZE ? length : COPY_BUF_SIZE, offset);
+		if(bytes_read <= 0)
+		{
+			free(buffer);
+			return (bytes_read == 0 && length == COPY_TO_EOF) ? e_success : e_failure;
+		}
+		stats_count_io(io_read, bytes_read);
+
+		for(ssize_t done = 0; done < bytes_read; done += copied)
+		{
+			copied = write(dst_fd, buffer + done, bytes_read - done);
+			if(copied < 0)
+			{
+				free(buffer);
+				return e_failure;
+			}
+			stats_count_io(io_write, copied);
+		}
+
+		offset += bytes_read;
+		length = (length == COPY_TO_EOF) ? length : length - bytes_read;
+	}
+
+	free(buffer);
+	return e_success;
+}
+
+/*
+Copy stream data
+* Input: Source and destination streams, number of bytes (or COPY_TO_EOF)
+*Output: e_success once the bytes are written, e_failure on I/O errors or
+an early end of file; copied holds the number of bytes written
+*Description: For sources that can only be read forward (pipes), whose
+stdio buffer may already hold the next bytes, so copy_file_data cannot
+read them at an offset.
+*/
+Status copy_stream_data(FILE *src, FILE *dst, size_t length, size_t *copied)
+{
+	char *buffer = malloc(COPY_BUF_SIZE);
+	if(buffer == NULL)
+		return e_failure;
+
+	*copied = 0;
+	while(length > 0)
+	{
+		size_t n = fread(buffer, 1, length < COPY_BUF_SIZE ? length : COPY_BUF_SIZE, src);
+		if(n == 0)
+			break;
+		stats_count_io(io_read, n);
+
+		if(fwrite(buffer, 1, n, dst) != n)
+		{
+			free(buffer);
+			return e_failure;
+		}
+		stats_count_io(io_write, n);
+
+		*copied += n;
+		length = (length == COPY_TO_EOF) ? length : length - n;
+	}
+
+	free(buffer);
+	return (ferror(src) || (length > 0 && length != COPY_TO_EOF)) ? e_failure : e_success;
+}
+
+/*
+Chunk reader thread
+*Description: Fills the two buffers in turn. A buffer is only refilled
+after the consumer has handed it back through chunk_reader_next.
+*/
+static void *chunk_reader_thread(void *arg)
+{
+	ChunkReader *reader = arg;
+
+	for(int slot = 0; ; slot ^= 1)
+	{
+		pthread_mutex_lock(&reader -> lock);
+		while(reader -> ready[slot] && !reader -> stop)
+			pthread_cond_wait(&reader -> cond, &reader -> lock);
+		int stop = reader -> stop || reader -> remaining == 0;
+		pthread_mutex_unlock(&reader -> lock);
+		if(stop)
+			break;
+
+		size_t want = (reader -> remaining < (off_t)reader -> chunk_size) ? (size_t)reader -> remaining : reader -> chunk_size;
+		size_t got = fread(reader -> buffer[slot], 1, want, reader -> fptr);
+		stats_count_io(io_read, got);
+
+		pthread_mutex_lock(&reader -> lock);
+		if(got != want)
+			reader -> error = 1;
+		reader -> remaining -= got;
+		reader -> length[slot] = got;
+		reader -> ready[slot] = (got != 0);
+		pthread_cond_broadcast(&reader -> cond);
+		pthread_mutex_unlock(&reader -> lock);
+
+		if(got != want)
+			break;
+	}
+
+	pthread_mutex_lock(&reader -> lock);
+	reader -> done = 1;
+	pthread_cond_broadcast(&reader -> cond);
+	pthread_mutex_unlock(&reader -> lock);
+	return NULL;
+}
+
+/*
+Start chunk reader
+* Input: Reader, FILE pointer positioned at the data, number of bytes and chunk size
+*Output: e_success once the reader thread runs, e_failure otherwise
+*/
+Status chunk_reader_start(ChunkReader *reader, FILE *fptr, off_t size, size_t chunk_size)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader -> fptr = fptr;
+	reader -> chunk_size = chunk_size;
+	reader -> remaining = size;
+	reader -> held = -1;
+
+	reader -> buffer[0] = malloc(chunk_size);
+	reader -> buffer[1] = malloc(chunk_size);
+	if(reader -> buffer[0] == NULL || reader -> buffer[1] == NULL)
+	{
+		free(reader -> buffer[0]);
+		free(reader -> buffer[1]);
+		return e_failure;
+	}
+
+	pthread_mutex_init(&reader -> lock, NULL);
+	pthread_cond_init(&reader -> cond, NULL);
+	if(pthread_create(&reader -> thread, NULL, chunk_reader_thread, reader) != 0)
+	{
+		pthread_mutex_destroy(&reader -> lock);
+		pthread_cond_destroy(&reader -> cond);
+		free(reader -> buffer[0]);
+		free(reader -> buffer[1]);
+		return e_failure;
+	}
+
+	return e_success;
+}
+
+/*
+Next chunk
+* Input: Reader
+*Output: Pointer to the next chunk and its length, 0 after the last chunk, -1 on read errors
+*Description: Hands the previous chunk back to the reader thread, then waits
+for the next one. The chunk stays valid until the following call.
+*/
+long chunk_reader_next(ChunkReader *reader, char **chunk)
+{
+	long length;
+
+	pthread_mutex_lock(&reader -> lock);
+
+	//The previous chunk can be refilled now
+	if(reader -> held >= 0)
+	{
+		reader -> ready[reader -> held] = 0;
+		reader -> held = -1;
+		pthread_cond_broadcast(&reader -> cond);
+	}
+
+	while(!reader -> ready[reader -> next] && !reader -> done)
+		pthread_cond_wait(&reader -> cond, &reader -> lock);
+
+	if(reader -> ready[reader -> next])
+	{
+		reader -> held = reader -> next;
+		reader -> next ^= 1;
+		*chunk = reader -> buffer[reader -> held];
+		length = reader -> length[reader -> held];
+	}
+	else
+		length = reader -> error ? -1 : 0;
+
+	pthread_mutex_unlock(&reader -> lock);
+	return length;
+}
+
+/*
+Stop chunk reader
+* Input: Reader
+*Output: Joins the reader thread and frees both buffers
+*/
+void chunk_reader_stop(ChunkReader *reader)
+{
+	pthread_mutex_lock(&reader -> lock);
+	reader -> stop = 1;
+	pthread_cond_broadcast(&reader -> cond);
+	pthread_mutex_unlock(&reader -> lock);
+
+	pthread_join(reader -> thread, NULL);
+	pthread_mutex_destroy(&reader -> lock);
+	pthread_cond_destroy(&reader -> cond);
+	free(reader -> buffer[0]);
+	free(reader -> buffer[1]);
+}
@@ -0,0 +1,82 @@
+#ifndef STEGO_IO_H
+#define STEGO_IO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * I/O helpers shared by the encoder and the decoder.
+ * Regular files are memory mapped so that the LSB kernels
+ * can work on the pixel array directly; anything else
+ * (pipes, character devices) keeps using stdio.
+ */
+
+/* Length value asking copy_file_data to copy up to end of file */
+#define COPY_TO_EOF ((size_t)-1)
+
+/* Buffer size of the copy fallback loop */
+#define COPY_BUF_SIZE (1 << 20)
+
+/*
+ * Double buffered reader: a helper thread fills one
+ * buffer while the caller processes the other, so memory
+ * use is two chunks whatever the size of the file.
+ */
+typedef struct _ChunkReader
+{
+    FILE *fptr;
+    size_t chunk_size;
+    off_t remaining;
+    char *buffer[2];
+    size_t length[2];
+    int ready[2];
+    int next;
+    int held;
+    int done;
+    int error;
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} ChunkReader;
+
+/* Map a regular file read-only */
+Status map_file_for_reading(FILE *fptr, unsigned char **map, size_t *map_size);
+
+/* Resize a regular file and map it writable */
+Status map_file_for_writing(FILE *fptr, size_t map_size, unsigned char **map);
+
+/* Release a mapping created by the functions above */
+void unmap_file(unsigned char *map, size_t map_size);
+
+/* Read exactly n bytes at offset, e_failure on errors or end of file */
+Status read_file_at(int fd, void *buffer, size_t n, off_t offset);
+
+/* Write exactly n bytes at offset, e_failure on errors */
+Status write_file_at(int fd, const void *buffer, size_t n, off_t offset);
+
+/* Drop the pages of a mapping below upto from the resident set */
+void release_mapped_pages(unsigned char *map, size_t *released, size_t upto);
+
+/* Make dst_fd a copy-on-write clone of all size bytes of src_fd, e_failure without reflink support */
+Status clone_file(int src_fd, int dst_fd, size_t size);
+
+/* Copy length bytes at offset of src_fd to the current position of dst_fd */
+Status copy_file_data(int src_fd, off_t offset, int dst_fd, size_t length);
+
+/* Copy length bytes from the current position of src to dst through stdio */
+Status copy_stream_data(FILE *src, FILE *dst, size_t length, size_t *copied);
+
+/* Start reading size bytes of fptr in chunks of chunk_size */
+Status chunk_reader_start(ChunkReader *reader, FILE *fptr, off_t size, size_t chunk_size);
+
+/* Get the next chunk, returns its length, 0 at the end, -1 on errors */
+long chunk_reader_next(ChunkReader *reader, char **chunk);
+
+/* Stop the reader thread and free the buffers */
+void chunk_reader_stop(ChunkReader *reader);
+
+#endif
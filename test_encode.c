@@ -35,55 +35,136 @@ Methodology -
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include "encode.h"
 #include "types.h"
+#include "common.h"
 #include "decode.h"
+#include "batch.h"
+#include "probe.h"
+#include "stats.h"
+#include "container.h"
+
+/* Options accepted anywhere after -e/-d */
+typedef struct _CliOptions
+{
+	int num_threads;
+	int depth;
+	int compress;
+	int quiet;
+	int stats;
+	IoBackend aio;
+	const char *passphrase;
+	const char *cipher_passphrase;
+	int container;
+	char *more_files[CONTAINER_MAX_FILES];
+	int num_more_files;
+	const char *member_name;
+	int list_only;
+	int slice;
+	size_t slice_offset;
+	size_t slice_length;
+} CliOptions;
+
+int extract_options(int argc, char *argv[], CliOptions *options);
 
 
 int main(int argc, char *argv[])
 {
+	CliOptions options = { 1, 1, 0, 0, 0, io_backend_sync, NULL, NULL, 0, { NULL }, 0, NULL, 0, 0, 0, 0 };
+	RunStats stats;
+
+	//Remove the options, leaving the file names at their usual positions
+	argc = extract_options(argc, argv, &options);
+
+	//Probe any number of files and directory trees
+	if(argc > 2 && check_operation_type(argv) == e_probe)
+		return (do_probe(argv + 2, argc - 2, options.num_threads, options.quiet, options.stats) == e_success) ? 0 : 1;
+
 	//Number of input arguments validation
-	if(argc > 1 && argc < 8)
+	if(argc > 1 && argc < 6)
 	{	
 		//Encoding
 		if(check_operation_type(argv) == e_encode)
 		{
-			printf("Selected Encoding\n");
-			EncodeInfo encInfo;
+			EncodeInfo encInfo = { 0 };
+			encInfo.num_threads = options.num_threads;
+			encInfo.bits_per_pixel = options.depth;
+			encInfo.compress = options.compress;
+			encInfo.quiet = options.quiet;
+			encInfo.passphrase = options.passphrase;
+			encInfo.cipher_passphrase = options.cipher_passphrase;
+			encInfo.container = options.container;
+			encInfo.more_files = options.more_files;
+			encInfo.num_more_files = options.num_more_files;
+			if(options.stats)
+			{
+				stats_init(&stats, "encode");
+				encInfo.stats = &stats;
+			}
+			STAGE_MSG(&encInfo, "Selected Encoding\n");
 			
 			//Read the file name and validate
 			if(read_and_validate_encode_args(argv, &encInfo) == e_success)
 			{
-				printf("Read and validate encode arguments is a success\n");
+				STAGE_MSG(&encInfo, "Read and validate encode arguments is a success\n");
 				
 				if(do_encoding(&encInfo) == e_success)
-					printf("Encoding completed successfully\n");
+					STAGE_MSG(&encInfo, "Encoding completed successfully\n");
 				else
 					printf("ERROR : Encoding was not successful\n");
+				close_files(&encInfo);
+				if(options.stats)
+					stats_print_json(&stats, stdout);
+				release_encode_info(&encInfo);
 			}			
 			else
 				printf("ERROR : Read and validate encode arguments is a failure\n");
 		}
+		//Batch of encodings and decodings listed in a manifest
+		else if(check_operation_type(argv) == e_batch && argc == 3)
+		{
+			if(do_batch(argv[2], options.num_threads, options.stats, options.aio) != e_success)
+				return 1;
+		}
 		//Decoding
 		else if(check_operation_type(argv) == e_decode)
 		{
-            		printf("Selected Decoding\n");
-            		DecodeInfo decInfo;
+            		DecodeInfo decInfo = { 0 };
+            		decInfo.num_threads = options.num_threads;
+            		decInfo.quiet = options.quiet;
+            		decInfo.passphrase = options.passphrase;
+            		decInfo.cipher_passphrase = options.cipher_passphrase;
+            		decInfo.member_name = options.member_name;
+            		decInfo.list_only = options.list_only;
+            		decInfo.slice = options.slice;
+            		decInfo.slice_offset = options.slice_offset;
+            		decInfo.slice_length = options.slice_length;
+            		if (options.stats)
+            		{
+            			stats_init(&stats, "decode");
+            			decInfo.stats = &stats;
+            		}
+            		STAGE_MSG(&decInfo, "Selected Decoding\n");
 
             		// Read the file name and validate
             		if (read_and_validate_decode_args(argv, &decInfo) == d_success)
             		{
-            			printf("Read and validated decode arguments successfully\n");
+            			STAGE_MSG(&decInfo, "Read and validated decode arguments successfully\n");
 
 				// Do decoding
                 		if (do_decoding(&decInfo) == d_success)
                 		{
-                    			printf("Decoding completed successfully\n");
+                    			STAGE_MSG(&decInfo, "Decoding completed successfully\n");
                 		}
                 		else
                 		{
                    			printf("ERROR: Decoding was not successful\n");
                 		}
+				close_files_for_decoding(&decInfo);
+				if (options.stats)
+					stats_print_json(&stats, stdout);
+				release_decode_info(&decInfo);
             		}
            		 else
             		{
@@ -92,11 +173,95 @@ int main(int argc, char *argv[])
         	}
 
 		else
-			printf("ERROR : Invalid argument\nFor encoding : ./a.out -e beautiful.bmp secret.txt [stego.bmp]\nFor decoding : ./a.out -d stego.bmp [decode.txt]\n");
+			printf("ERROR : Invalid argument\nFor encoding : ./a.out -e beautiful.bmp secret.txt [stego.bmp] [-k depth] [-z] [-c] [-a file]... [-s passphrase] [-x passphrase] [-j threads] [-q] [--stats]\nFor decoding : ./a.out -d stego.bmp [decode.txt|directory] [-f name] [-l] [-r offset[:length]] [-s passphrase] [-x passphrase] [-j threads] [-q] [--stats]\nFor a batch : ./a.out -b manifest.txt [-j threads] [--aio[=uring|pool]] [-q] [--stats]\nFor probing : ./a.out -p image.bmp|directory ... [-j threads] [-q] [--stats]\n");
 	
 	}
 	else 
-	printf("ERROR : Invalid argument\nFor encoding : ./a.out -e beautiful.bmp secret.txt [stego.bmp]\nFor decoding : ./a.out -d stego.bmp [decode.txt]\n");
+	printf("ERROR : Invalid argument\nFor encoding : ./a.out -e beautiful.bmp secret.txt [stego.bmp] [-k depth] [-z] [-c] [-a file]... [-s passphrase] [-x passphrase] [-j threads] [-q] [--stats]\nFor decoding : ./a.out -d stego.bmp [decode.txt|directory] [-f name] [-l] [-r offset[:length]] [-s passphrase] [-x passphrase] [-j threads] [-q] [--stats]\nFor a batch : ./a.out -b manifest.txt [-j threads] [--aio[=uring|pool]] [-q] [--stats]\nFor probing : ./a.out -p image.bmp|directory ... [-j threads] [-q] [--stats]\n");
+}
+
+/*
+Extract options
+* Input: Command line arguments and the options structure
+*Output: Number of arguments left after removing the options, 0 on invalid options
+*Description: Options may appear anywhere after the operation flag. They are
+removed from argv so that the file names keep their positions.
+*/
+int extract_options(int argc, char *argv[], CliOptions *options)
+{
+	int count = (argc > 1) ? 2 : argc;
+
+	for(int i = 2; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-j") == 0)
+		{
+			if(i + 1 >= argc || (options -> num_threads = atoi(argv[++i])) < 1)
+				return 0;
+		}
+		else if(strcmp(argv[i], "-k") == 0)
+		{
+			if(i + 1 >= argc || (options -> depth = atoi(argv[++i])) < 1)
+				return 0;
+		}
+		else if(strcmp(argv[i], "-s") == 0)
+		{
+			if(i + 1 >= argc)
+				return 0;
+			options -> passphrase = argv[++i];
+		}
+		else if(strcmp(argv[i], "-x") == 0)
+		{
+			if(i + 1 >= argc)
+				return 0;
+			options -> cipher_passphrase = argv[++i];
+		}
+		else if(strcmp(argv[i], "-a") == 0)
+		{
+			if(i + 1 >= argc || options -> num_more_files + 1 >= CONTAINER_MAX_FILES)
+				return 0;
+			options -> more_files[options -> num_more_files++] = argv[++i];
+			options -> container = 1;
+		}
+		else if(strcmp(argv[i], "-f") == 0)
+		{
+			if(i + 1 >= argc)
+				return 0;
+			options -> member_name = argv[++i];
+		}
+		else if(strcmp(argv[i], "-r") == 0)
+		{
+			//offset[:length], the rest of the secret without a length
+			char *end;
+			if(i + 1 >= argc || argv[i + 1][0] < '0' || argv[i + 1][0] > '9')
+				return 0;
+			options -> slice = 1;
+			options -> slice_offset = strtoull(argv[++i], &end, 10);
+			options -> slice_length = (*end == ':') ? strtoull(end + 1, &end, 10) : SIZE_MAX;
+			if(*end != '\0')
+				return 0;
+		}
+		else if(strcmp(argv[i], "-c") == 0)
+			options -> container = 1;
+		else if(strcmp(argv[i], "-l") == 0)
+			options -> list_only = 1;
+		else if(strcmp(argv[i], "-z") == 0)
+			options -> compress = 1;
+		else if(strcmp(argv[i], "-q") == 0)
+			options -> quiet = 1;
+		else if(strcmp(argv[i], "--stats") == 0)
+			options -> stats = 1;
+		else if(strcmp(argv[i], "--aio") == 0)
+			options -> aio = io_backend_auto;
+		else if(strcmp(argv[i], "--aio=uring") == 0)
+			options -> aio = io_backend_uring;
+		else if(strcmp(argv[i], "--aio=pool") == 0)
+			options -> aio = io_backend_pool;
+		else
+			argv[count++] = argv[i];
+	}
+
+	argv[count] = NULL;
+	return count;
 }
 
 OperationType check_operation_type(char *argv[]){
@@ -104,6 +269,10 @@ OperationType check_operation_type(char *argv[]){
 		return e_encode;
 	else if(strcmp(argv[1], "-d") == 0)
 		return e_decode;
+	else if(strcmp(argv[1], "-b") == 0)
+		return e_batch;
+	else if(strcmp(argv[1], "-p") == 0)
+		return e_probe;
 	else
 		return e_unsupported;
 }
@@ -0,0 +1,74 @@
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "thread_pool.h"
+#include "types.h"
+
+/* State shared by the workers of one run_parallel call */
+typedef struct _ParallelRun
+{
+    ParallelTask task;
+    void *arg;
+    size_t num_tasks;
+    size_t next_task;
+    int failed;
+} ParallelRun;
+
+/* Function Definitions */
+
+/*
+Worker
+*Description: Claims the next task index until none are left
+or a task has failed.
+*/
+static void *parallel_worker(void *arg)
+{
+	ParallelRun *run = arg;
+
+	while(!__atomic_load_n(&run -> failed, __ATOMIC_RELAXED))
+	{
+		size_t index = __atomic_fetch_add(&run -> next_task, 1, __ATOMIC_RELAXED);
+		if(index >= run -> num_tasks)
+			break;
+
+		if(run -> task(run -> arg, index) != e_success)
+			__atomic_store_n(&run -> failed, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/*
+Run parallel
+* Input: Number of threads, number of tasks, task callback and its argument
+*Output: e_success if every task succeeded, e_failure otherwise
+*Description: The calling thread works as one of the workers, so
+num_threads = 1 runs all tasks inline without creating threads.
+*/
+Status run_parallel(int num_threads, size_t num_tasks, ParallelTask task, void *arg)
+{
+	ParallelRun run = { task, arg, num_tasks, 0, 0 };
+
+	if(num_threads < 1)
+		num_threads = 1;
+	if((size_t)num_threads > num_tasks)
+		num_threads = num_tasks ? num_tasks : 1;
+
+	pthread_t *threads = malloc((num_threads - 1) * sizeof(pthread_t) + 1);
+	if(threads == NULL)
+		return e_failure;
+
+	int started = 0;
+	for(; started < num_threads - 1; started++)
+	{
+		if(pthread_create(&threads[started], NULL, parallel_worker, &run) != 0)
+			break;
+	}
+
+	parallel_worker(&run);
+
+	for(int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	return run.failed ? e_failure : e_success;
+}
@@ -0,0 +1,19 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Minimal fork/join pool: num_threads workers pull task
+ * indices from a shared counter until all tasks are done
+ * or one of them fails.
+ */
+
+/* Task callback, index runs from 0 to num_tasks - 1 */
+typedef Status (*ParallelTask)(void *arg, size_t index);
+
+/* Run num_tasks tasks on num_threads threads, e_failure if any task failed */
+Status run_parallel(int num_threads, size_t num_tasks, ParallelTask task, void *arg);
+
+#endif
@@ -17,6 +17,8 @@ typedef enum
 {
     e_encode,
     e_decode,
+    e_batch,
+    e_probe,
     e_unsupported
 } OperationType;
 